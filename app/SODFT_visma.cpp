@@ -12,6 +12,7 @@
 // feh
 #include "tracker_utils.h"
 #include "message_utils.h"
+#include "shm_ring.h"
 #include "dataloaders.h"
 #include "gravity_aligned_tracker.h"
 #include "vlslam.pb.h"
@@ -29,12 +30,25 @@ int main(int argc, char **argv) {
     auto config = LoadJson(config_file);
     auto cam_cfg = LoadJson(config["camera_config"].asString());
 
-    // setup zmq client
+    // setup detection client: shared memory rings on the same machine, zmq otherwise
     zmqpp::context context;
     std::shared_ptr<zmqpp::socket> socket = nullptr;
+    ShmRingPtr request_ring, reply_ring;
     if (config["request_detection"].asBool()) {
-      socket = std::make_shared<zmqpp::socket>(context, zmqpp::socket_type::request);
-      socket->connect(absl::StrFormat("tcp://localhost:%d", config["port"].asInt()));
+      if (config.get("transport", "zmq").asString() == "shm") {
+        std::string name = config.get("shm_name", "/visma_detection").asString();
+        request_ring = ShmRing::Create(name + "_request", 2,
+            sizeof(FrameHeader) + cam_cfg["rows"].asInt() * cam_cfg["cols"].asInt() * 3);
+        reply_ring = ShmRing::Create(name + "_reply", 2, 1 << 20);
+        if (!request_ring || !reply_ring) {
+          LOG(WARNING) << "shared memory transport unavailable, fall back to zmq";
+          request_ring = reply_ring = nullptr;
+        }
+      }
+      if (!request_ring) {
+        socket = std::make_shared<zmqpp::socket>(context, zmqpp::socket_type::request);
+        socket->connect(absl::StrFormat("tcp://localhost:%d", config["port"].asInt()));
+      }
     } 
 
     MatXf V;
@@ -83,16 +97,27 @@ int main(int argc, char **argv) {
         bool success = loader.Grab(i, img, edgemap, bboxlist, gwc, Rg, imagepath);
         if (!success) break;
 
-        if (socket) {
-          zmqpp::message msg;
-          msg.add_raw<uint8_t>(img.data, img.rows * img.cols * 3);
-          socket->send(msg);
-          // receive message
-          std::string bbox_msg;
-          bool recv_ok = socket->receive(bbox_msg);
+        if (socket || request_ring) {
+          vlslam_pb::NewBoxList boxlist;
+          bool recv_ok(false);
+          if (request_ring) {
+            // the frame is written to and the reply is parsed from shared memory in place
+            uint8_t *slot = request_ring->Reserve();
+            size_t size = WriteFrameMessage(img, nullptr, slot, request_ring->slot_size());
+            CHECK_GT(size, 0) << "frame exceeds the slot";
+            request_ring->Commit(size);
+            const uint8_t *reply = reply_ring->Acquire(&size);
+            recv_ok = boxlist.ParseFromArray(reply, size);
+            reply_ring->Release();
+          } else {
+            zmqpp::message msg;
+            msg.add_raw<uint8_t>(img.data, img.rows * img.cols * 3);
+            socket->send(msg);
+            // receive message
+            std::string bbox_msg;
+            recv_ok = socket->receive(bbox_msg) && boxlist.ParseFromString(bbox_msg);
+          }
           if (recv_ok) {
-            vlslam_pb::NewBoxList boxlist;
-            boxlist.ParseFromString(bbox_msg);
             disp_det = DrawBoxList(img, boxlist);
 
             for (auto box : boxlist.boxes()) {
@@ -0,0 +1,217 @@
+// End-to-end latency & throughput of the transports between trackers and the detector:
+// from publishing the hypotheses of a frame to having all their scores.
+// Run against the mock detector, such that only the transport and the configured processing
+// time are measured, and scores can be checked against the deterministic reference.
+// stl
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+// 3rd party
+#include "glog/logging.h"
+#include "json/json.h"
+#include "absl/strings/str_format.h"
+#include "opencv2/core/core.hpp"
+#include "zmqpp/zmqpp.hpp"
+
+// feh
+#include "bbox_likelihood_client.h"
+#include "message_utils.h"
+#include "mock_detector.h"
+#include "philox.h"
+#include "shm_ring.h"
+#include "utils.h"
+
+using namespace feh;
+
+typedef std::chrono::steady_clock Clock;
+
+/// \brief: Random hypotheses of a tracker on a frame, the same for every transport.
+std::vector<vlslam_pb::BoundingBox> GenerateHypotheses(int frame, int tracker, int num_boxes, int rows, int cols) {
+    Philox rng(0, frame, tracker);
+    std::vector<vlslam_pb::BoundingBox> bboxes(num_boxes);
+    for (auto &bbox : bboxes) {
+        float width = cols * (0.05 + 0.4 * rng.Uniform());
+        float height = rows * (0.05 + 0.4 * rng.Uniform());
+        float x0 = (cols - width) * rng.Uniform();
+        float y0 = (rows - height) * rng.Uniform();
+        bbox.set_top_left_x(std::round(x0));
+        bbox.set_top_left_y(std::round(y0));
+        bbox.set_bottom_right_x(std::round(x0 + width));
+        bbox.set_bottom_right_y(std::round(y0 + height));
+        bbox.set_class_name("chair");
+    }
+    return bboxes;
+}
+
+float Percentile(std::vector<float> sorted, float p) {
+    if (sorted.empty()) return 0;
+    return sorted[std::min<int>(sorted.size() - 1, p * sorted.size())];
+}
+
+int main(int argc, char **argv) {
+    std::string config_file("../cfg/ipc_benchmark.json");
+    if (argc > 1) {
+        config_file = argv[1];
+    }
+    auto config = LoadJson(config_file);
+    auto mock_cfg = LoadJson(config["mock_config"].asString());
+    auto cam_cfg = LoadJson(config["camera_config"].asString());
+    int rows = cam_cfg["rows"].asInt();
+    int cols = cam_cfg["cols"].asInt();
+    std::string transport = config["transport"].asString();
+    int num_frames = config["num_frames"].asInt();
+    int num_trackers = config["num_trackers"].asInt();
+    int num_boxes = config["num_boxes"].asInt();
+    int timeout_ms = config["timeout_ms"].asInt();
+    bool spawn_mock = config["spawn_mock"].asBool();
+
+    // clients, the rings have to exist before the detector opens them
+    std::vector<std::unique_ptr<BBoxLikelihoodClient>> clients;
+    BBoxLikelihoodBatcherPtr batcher;
+    ShmRingPtr request_ring, reply_ring;
+    zmqpp::context context;
+    std::unique_ptr<zmqpp::socket> socket;
+    bool detection = (transport == "zmq" || transport == "shm_detection");
+    if (transport == "shm_batch" || transport == "shm_detection") {
+        std::string name = mock_cfg[transport].asString();
+        CHECK(!name.empty()) << transport << " is disabled in the mock configuration";
+        size_t max_payload = config["shm_max_payload_mb"].asInt() << 20;
+        request_ring = ShmRing::Create(name + "_request", config["shm_slots"].asInt(),
+                                       sizeof(FrameHeader) + rows * cols * 3 + max_payload);
+        reply_ring = ShmRing::Create(name + "_reply", config["shm_slots"].asInt(), max_payload);
+        CHECK(request_ring && reply_ring) << "failed to create shared memory rings";
+    }
+    if (transport == "lcm") {
+        for (int t = 0; t < num_trackers; ++t) {
+            clients.emplace_back(new BBoxLikelihoodClient(t));
+            CHECK(clients.back()->good()) << "failed to setup LCM port";
+        }
+    } else if (transport == "lcm_batch" || transport == "shm_batch") {
+        batcher = std::make_shared<BBoxLikelihoodBatcher>(request_ring, reply_ring);
+        CHECK(batcher->good()) << "failed to setup LCM port";
+    } else if (transport == "zmq") {
+        socket.reset(new zmqpp::socket(context, zmqpp::socket_type::request));
+        socket->set(zmqpp::socket_option::receive_timeout, timeout_ms);
+        socket->connect(absl::StrFormat("tcp://localhost:%d", mock_cfg["port"].asInt()));
+    } else if (transport != "shm_detection") {
+        LOG(FATAL) << "unknown transport " << transport;
+    }
+
+    // the reference is never started, it only reproduces the scores & detections
+    MockDetector reference(mock_cfg);
+    std::unique_ptr<MockDetector> mock;
+    if (spawn_mock) {
+        mock.reset(new MockDetector(mock_cfg));
+        mock->Start();
+        // LCM subscriptions & shared memory rings are set up by the serving threads
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+
+    cv::Mat image(rows, cols, CV_8UC3);
+    std::vector<float> latency_ms;
+    int lost(0), mismatches(0);
+    int64_t num_scores(0);
+    double total_ms(0), simulated_ms(0);
+    for (int f = 0; f < num_frames; ++f) {
+        std::vector<std::vector<vlslam_pb::BoundingBox>> hypotheses(num_trackers);
+        if (!detection) {
+            for (int t = 0; t < num_trackers; ++t) {
+                hypotheses[t] = GenerateHypotheses(f, t, num_boxes, rows, cols);
+            }
+        }
+        image.setTo(cv::Scalar::all(f & 0xff));
+        std::string description = absl::StrFormat("frame_%04d", f);
+
+        auto start = Clock::now();
+        auto deadline = start + std::chrono::milliseconds(timeout_ms);
+        std::vector<std::future<std::vector<float>>> futures;
+        vlslam_pb::NewBoxList boxlist;
+        bool received(true);
+        if (transport == "lcm") {
+            for (int t = 0; t < num_trackers; ++t) {
+                vlslam_pb::BoundingBoxList bboxlist;
+                bboxlist.set_description(absl::StrFormat("%04d%s", t, description));
+                for (const auto &bbox : hypotheses[t]) *bboxlist.add_bounding_boxes() = bbox;
+                futures.push_back(clients[t]->Request(bboxlist));
+            }
+        } else if (batcher) {
+            for (int t = 0; t < num_trackers; ++t) {
+                futures.push_back(batcher->Add(t, hypotheses[t]));
+            }
+            batcher->Flush(description, image);
+        } else if (socket) {
+            zmqpp::message msg;
+            msg.add_raw<uint8_t>(image.data, image.rows * image.cols * 3);
+            socket->send(msg);
+            std::string reply;
+            received = socket->receive(reply) && boxlist.ParseFromString(reply);
+        } else {
+            uint8_t *slot = request_ring->Reserve(timeout_ms);
+            size_t size = slot ? WriteFrameMessage(image, nullptr, slot, request_ring->slot_size()) : 0;
+            CHECK_GT(size, 0) << "request ring stalled";
+            request_ring->Commit(size);
+            const uint8_t *reply = reply_ring->Acquire(&size, timeout_ms);
+            received = reply && boxlist.ParseFromArray(reply, size);
+            if (reply) reply_ring->Release();
+        }
+        for (int t = 0; t < futures.size(); ++t) {
+            if (futures[t].wait_until(deadline) != std::future_status::ready) {
+                ++lost;
+                continue;
+            }
+            std::vector<float> scores = futures[t].get();
+            if (scores.size() != hypotheses[t].size()) {
+                ++lost;
+                continue;
+            }
+            for (int i = 0; i < scores.size(); ++i) {
+                mismatches += (scores[i] != reference.Score(hypotheses[t][i]));
+            }
+            num_scores += scores.size();
+        }
+        float elapsed = std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+
+        if (detection) {
+            if (!received) {
+                // a late reply would answer the next request, the benchmark cannot go on
+                LOG(ERROR) << "no detections for frame #" << f << ", stopped";
+                ++lost;
+                break;
+            }
+            // requests of a transport are numbered by the mock from its start
+            if (spawn_mock && boxlist.SerializeAsString() != reference.Detect(f, rows, cols).SerializeAsString()) {
+                ++mismatches;
+            }
+            num_scores += boxlist.boxes_size();
+        }
+        latency_ms.push_back(elapsed);
+        total_ms += elapsed;
+        // per-tracker requests are served one after another
+        int served = (transport == "lcm") ? num_trackers : 1;
+        for (int k = 0; k < served; ++k) simulated_ms += reference.LatencyUs(f * served + k) * 1e-3;
+    }
+    if (mock) mock->Stop();
+
+    std::vector<float> sorted(latency_ms);
+    std::sort(sorted.begin(), sorted.end());
+    std::cout << absl::StrFormat("transport=%s, %d frames x %d trackers x %d boxes\n",
+                                 transport, latency_ms.size(), num_trackers, detection ? 1 : num_boxes);
+    std::cout << absl::StrFormat("latency (ms): mean=%0.3f p50=%0.3f p95=%0.3f p99=%0.3f max=%0.3f\n",
+                                 total_ms / std::max<int>(latency_ms.size(), 1),
+                                 Percentile(sorted, 0.5), Percentile(sorted, 0.95),
+                                 Percentile(sorted, 0.99), Percentile(sorted, 1));
+    if (spawn_mock) {
+        // the simulated processing time is known exactly, the rest is spent in transport
+        std::cout << absl::StrFormat("transport overhead (ms): mean=%0.3f\n",
+                                     (total_ms - simulated_ms) / std::max<int>(latency_ms.size(), 1));
+    }
+    std::cout << absl::StrFormat("throughput: %0.1f frames/s, %0.1f %s/s\n",
+                                 1000 * latency_ms.size() / total_ms, 1000 * num_scores / total_ms,
+                                 detection ? "detections" : "scores");
+    std::cout << absl::StrFormat("lost=%d mismatches=%d\n", lost, mismatches);
+    return (lost || mismatches) ? 1 : 0;
+}
@@ -0,0 +1,44 @@
+// Stand-in for the detector process: serves the LCM, ZMQ and shared memory protocols
+// with configurable latency and deterministic scores, see MockDetector.
+// stl
+#include <csignal>
+#include <iostream>
+#include <thread>
+
+// 3rd party
+#include "glog/logging.h"
+#include "json/json.h"
+
+// feh
+#include "mock_detector.h"
+#include "utils.h"
+
+using namespace feh;
+
+static volatile std::sig_atomic_t stop = 0;
+
+int main(int argc, char **argv) {
+    std::string config_file("../cfg/mock_detector.json");
+    if (argc > 1) {
+        config_file = argv[1];
+    }
+    auto config = LoadJson(config_file);
+
+    std::signal(SIGINT, [](int) { stop = 1; });
+    std::signal(SIGTERM, [](int) { stop = 1; });
+
+    MockDetector detector(config);
+    detector.Start();
+    std::cout << "mock detector serving, latency=" << config.get("latency_ms", 0).asFloat()
+              << "+/-" << config.get("jitter_ms", 0).asFloat() << " ms\n";
+    uint64_t reported(0);
+    while (!stop) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        uint64_t requests = detector.requests();
+        if (requests != reported) {
+            std::cout << requests - reported << " requests/s, " << requests << " in total\n";
+            reported = requests;
+        }
+    }
+    detector.Stop();
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <vector>
+
 #include "se3.h"
 #include "rodrigues.h"
 
@@ -27,6 +29,11 @@ using Mat24f = Eigen::Matrix<float, 2, 4>;
 using MatXf = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic>;
 using MatX3f = Eigen::Matrix<float, Eigen::Dynamic, 3>;
 
+// column major poses as consumed by the renderer, fixed size vectorizable,
+// thus containers need the aligned allocator
+using Mat4fColMajor = Eigen::Matrix<float, 4, 4, Eigen::ColMajor>;
+using Mat4fColMajorList = std::vector<Mat4fColMajor, Eigen::aligned_allocator<Mat4fColMajor>>;
+
 using Mat3d = Eigen::Matrix<double, 3, 3>;
 using Mat4d = Eigen::Matrix<double, 4, 4>;
 using Mat34d = Eigen::Matrix<double, 3, 4>;
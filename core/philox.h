@@ -0,0 +1,122 @@
+//
+// Counter-based random number generation.
+//
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include "math.h"
+
+namespace feh {
+
+/// \brief: Philox4x32-10 counter-based random number generator
+/// (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3").
+/// A block of four random words is a pure function of a 64 bit key and a 128 bit counter,
+/// so random numbers can be drawn in any order and on any thread with the same result.
+/// A stream is identified by the key and the upper three counter words, the lowest counter
+/// word enumerates the blocks of the stream.
+class Philox {
+public:
+    typedef std::array<uint32_t, 4> Block;
+    // UniformRandomBitGenerator, such that the std distributions can be used as well
+    typedef uint32_t result_type;
+
+    Philox(uint64_t key, uint32_t c1=0, uint32_t c2=0, uint32_t c3=0):
+        key_(key),
+        counter_{0, c1, c2, c3},
+        index_(4),
+        has_normal_(false)
+    {}
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+    result_type operator()() {
+        if (index_ == 4) {
+            block_ = Generate(key_, counter_);
+            ++counter_[0];
+            index_ = 0;
+        }
+        return block_[index_++];
+    }
+
+    /// \brief: Uniform in [0, 1).
+    float Uniform() { return ToUniform((*this)()); }
+    /// \brief: Uniform integer in [0, n).
+    uint32_t UniformInt(uint32_t n) { return (uint64_t((*this)()) * n) >> 32; }
+    /// \brief: Standard normal, consecutive uniforms are paired by Box-Muller.
+    float Normal() {
+        if (has_normal_) {
+            has_normal_ = false;
+            return normal_;
+        }
+        float u0 = Uniform(), u1 = Uniform();
+        float n0;
+        BoxMuller(u0, u1, &n0, &normal_);
+        has_normal_ = true;
+        return n0;
+    }
+
+    /// \brief: The block of the given key and counter.
+    static Block Generate(uint64_t key, Block counter) {
+        uint32_t k0 = key, k1 = key >> 32;
+        for (int round = 0; round < 10; ++round) {
+            uint64_t p0 = uint64_t(0xD2511F53) * counter[0];
+            uint64_t p1 = uint64_t(0xCD9E8D57) * counter[2];
+            counter = {uint32_t(p1 >> 32) ^ counter[1] ^ k0, uint32_t(p1),
+                       uint32_t(p0 >> 32) ^ counter[3] ^ k1, uint32_t(p0)};
+            k0 += 0x9E3779B9;
+            k1 += 0xBB67AE85;
+        }
+        return counter;
+    }
+    static float ToUniform(uint32_t x) { return (x >> 8) * (1.0f / (1 << 24)); }
+    /// \brief: Two independent standard normals from two uniforms in [0, 1).
+    static void BoxMuller(float u0, float u1, float *n0, float *n1) {
+        float r = std::sqrt(-2 * std::log(1 - u0));
+        float theta = 2 * M_PI * u1;
+        *n0 = r * std::cos(theta);
+        *n1 = r * std::sin(theta);
+    }
+
+private:
+    uint64_t key_;
+    Block counter_;
+    Block block_;
+    int index_;     // next word of the current block
+    float normal_;  // the spare one of a Box-Muller pair
+    bool has_normal_;
+};
+
+/// \brief: Fill a column-major rows x cols matrix, row i holds the first cols numbers of the
+/// stream Philox(key, first_row + i, c2, c3), i.e., the result does not depend on how rows
+/// are batched. The loops over rows are independent and can be vectorized by the compiler.
+inline void FillUniform(uint64_t key, uint32_t c2, uint32_t c3,
+                        int first_row, int rows, int cols, float *out) {
+    for (int k = 0; 4 * k < cols; ++k) {
+        for (int i = 0; i < rows; ++i) {
+            Philox::Block block = Philox::Generate(key, {uint32_t(k), uint32_t(first_row + i), c2, c3});
+            for (int j = 4 * k; j < std::min(cols, 4 * k + 4); ++j) {
+                out[j * rows + i] = Philox::ToUniform(block[j - 4 * k]);
+            }
+        }
+    }
+}
+
+/// \brief: Same as FillUniform with standard normals, agrees with Philox::Normal.
+inline void FillNormal(uint64_t key, uint32_t c2, uint32_t c3,
+                       int first_row, int rows, int cols, float *out) {
+    for (int k = 0; 4 * k < cols; ++k) {
+        for (int i = 0; i < rows; ++i) {
+            Philox::Block block = Philox::Generate(key, {uint32_t(k), uint32_t(first_row + i), c2, c3});
+            float n[4];
+            Philox::BoxMuller(Philox::ToUniform(block[0]), Philox::ToUniform(block[1]), &n[0], &n[1]);
+            Philox::BoxMuller(Philox::ToUniform(block[2]), Philox::ToUniform(block[3]), &n[2], &n[3]);
+            for (int j = 4 * k; j < std::min(cols, 4 * k + 4); ++j) {
+                out[j * rows + i] = n[j - 4 * k];
+            }
+        }
+    }
+}
+
+}   // namespace feh
@@ -8,7 +8,10 @@ shaders = [
     ('maxpool', 'comp'),
     ('gaussian_blur', 'comp'),
     ('edgelist', 'comp'),
-    ('oned', 'comp')
+    ('oned', 'comp'),
+    ('batch_mvp', 'vert'),
+    ('oned_batch', 'comp'),
+    ('oned_reduce', 'comp')
 ]
 
 
@@ -0,0 +1,48 @@
+// Quantization, lookup and hit rate of the likelihood cache.
+#include "likelihood_cache.h"
+
+#include "glog/logging.h"
+#include "tbb/parallel_for.h"
+
+int main() {
+    feh::LikelihoodCache cache;
+    feh::Vec4f bin_size(0.01, 0.01, 0.02, 0.1);
+    cache.Reset({bin_size, 2 * bin_size});
+    feh::LikelihoodCache::Score score{0.5, 1.0, 10, 20, 30, 40};
+
+    // state snaps to the center of its bin
+    feh::Vec4f v(0.123, -0.456, 0.789, 1.0), center;
+    auto key = cache.Quantize(0, 0, v, &center);
+    std::cout << "state=" << v.transpose() << "; bin center=" << center.transpose() << "\n";
+    CHECK(((v - center).cwiseAbs().array() <= bin_size.array() * 0.5f + 1e-5f).all());
+    CHECK(cache.Quantize(0, 0, center, nullptr) == key);
+    // shape id and level are part of the key
+    CHECK(!(cache.Quantize(1, 0, v, nullptr) == key));
+    CHECK(!(cache.Quantize(0, 1, v, nullptr) == key));
+    // azimuth wraps around
+    CHECK(cache.Quantize(0, 0, {0, 0, 0, 0.01}, nullptr) == cache.Quantize(0, 0, {0, 0, 0, 0.01 + 2 * M_PI}, nullptr));
+
+    feh::LikelihoodCache::Score found;
+    CHECK(!cache.Find(key, found));
+    cache.Insert(key, score);
+    CHECK(cache.Find(key, found));
+    CHECK(found == score);
+
+    // concurrent lookups of particles around a few poses
+    cache.Reset({bin_size});
+    int n = 10000;
+    tbb::parallel_for(0, n, [&cache, &score, &bin_size](int i) {
+        feh::Vec4f v = feh::Vec4f::Constant(i % 10) + 0.1f * bin_size;
+        feh::LikelihoodCache::Score s;
+        auto key = cache.Quantize(0, 0, v, nullptr);
+        if (cache.Find(key, s)) {
+            cache.Record(1, 0);
+        } else {
+            cache.Insert(key, score);
+            cache.Record(0, 1);
+        }
+    });
+    std::cout << "hit rate=" << cache.hit_rate() << "\n";
+    CHECK_EQ(cache.hits() + cache.misses(), n);
+    CHECK_GE(cache.hits(), n - 10 * tbb::this_task_arena::max_concurrency());
+}
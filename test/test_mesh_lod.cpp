@@ -0,0 +1,48 @@
+// Simplify a mesh to a range of triangle budgets and report the silhouette error
+// at the resolution of each pyramid level.
+#include "mesh_simplification.h"
+
+#include "utils.h"
+
+static const int kRows = 480;
+static const int kCols = 640;
+static const float kFx = 400;
+static const float kFy = 400;
+static const float kZNear = 0.05;
+static const float kZFar = 5.0;
+static const float kDepth = 1.5;
+
+int main(int argc, char **argv) {
+    std::string obj_file_path("../resources/swivel_chair_scanned.obj");
+    if (argc == 2) {
+        obj_file_path = std::string(argv[1]);
+    } else if (argc != 1) {
+        LOG(FATAL) << "invalid argument format";
+    }
+
+    feh::MatXf V;
+    feh::MatXi F;
+    std::tie(V, F) = feh::LoadMesh(obj_file_path);
+    std::cout << "#faces=" << F.rows() << "\n";
+
+    feh::Timer timer("mesh lod");
+    for (int level = 0; level < 3; ++level) {
+        int rows = kRows >> level;
+        int cols = kCols >> level;
+        float scale = 1.0f / (1 << level);
+        float intrinsics[] = {kFx * scale, kFy * scale, (cols >> 1), (rows >> 1)};
+        for (int budget : {20000, 5000, 2000, 500}) {
+            feh::MatXf V_lod;
+            feh::MatXi F_lod;
+            timer.Tick("simplify");
+            feh::SimplifyMesh(V, F, budget, V_lod, F_lod);
+            timer.Tock("simplify");
+            CHECK_LE(F_lod.maxCoeff(), V_lod.rows() - 1);
+            float error = feh::SilhouetteError(V, F, V_lod, F_lod, rows, cols, intrinsics, kZNear, kZFar, kDepth);
+            std::cout << "level #" << level << " (" << cols << "x" << rows << ")"
+                      << ": budget=" << budget << "; #faces=" << F_lod.rows()
+                      << "; silhouette error=" << error << " pixels\n";
+        }
+    }
+    std::cout << timer;
+}
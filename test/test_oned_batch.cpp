@@ -0,0 +1,108 @@
+// Check batched one dimensional search against the per-pose search.
+#include "renderer.h"
+
+#include "opencv2/opencv.hpp"
+
+#include "utils.h"
+
+static const int kRows = 480;
+static const int kCols = 640;
+static const float kFx = 400;
+static const float kFy = 400;
+static const float kCx = (kCols >> 1);
+static const float kCy = (kRows >> 1);
+static const float kZNear = 0.05;
+static const float kZFar = 5.0;
+static const int kNumPoses = 100;
+
+int main(int argc, char **argv) {
+    std::string obj_file_path("../resources/swivel_chair_scanned.obj");
+    if (argc == 2) {
+        obj_file_path = std::string(argv[1]);
+    } else if (argc != 1) {
+        LOG(FATAL) << "invalid argument format";
+    }
+
+    feh::MatXf V;
+    feh::MatXi F;
+    std::tie(V, F) = feh::LoadMesh(obj_file_path);
+
+    float intrinsics[] = {kFx, kFy, kCx, kCy};
+    feh::Renderer render(kRows, kCols);
+    render.SetMesh(V, F);
+    render.SetCamera(kZNear, kZFar, intrinsics);
+
+    feh::Mat4fColMajorList models(kNumPoses);
+    for (int i = 0; i < kNumPoses; ++i) {
+        models[i].setIdentity();
+        models[i].block<3, 1>(0, 3) = Eigen::Vector3f(0.01 * (i % 10), 0, 1.0 + 0.01 * i);
+        models[i].block<3, 3>(0, 0) = Eigen::AngleAxisf(2 * M_PI * i / kNumPoses, Eigen::Vector3f::UnitY()).toRotationMatrix();
+    }
+
+    // use the edge map of the first pose as evidence
+    cv::Mat evidence(kRows, kCols, CV_8UC1);
+    cv::Mat evidence_dir(kRows, kCols, CV_32FC1);
+    render.RenderEdge(models[0], evidence);
+    evidence_dir.setTo(0);
+    render.UploadEvidence(evidence.data);
+    render.UploadEvidenceDirection((float*)evidence_dir.data);
+
+    feh::Timer timer("oned search");
+    std::vector<std::vector<feh::EdgePixel>> single(kNumPoses), batch;
+    timer.Tick("single");
+    for (int i = 0; i < kNumPoses; ++i) {
+        render.OneDimSearch(models[i], single[i]);
+    }
+    timer.Tock("single");
+    timer.Tick("batch");
+    render.OneDimSearchBatch(models, batch);
+    timer.Tock("batch");
+
+    // edge pixels come out in arbitrary order, compare counts and matched distances
+    for (int i = 0; i < kNumPoses; ++i) {
+        int single_matched(0), batch_matched(0);
+        float single_dist(0), batch_dist(0);
+        for (const auto &e : single[i]) if (e.depth >= 0) { ++single_matched; single_dist += e.depth; }
+        for (const auto &e : batch[i]) if (e.depth >= 0) { ++batch_matched; batch_dist += e.depth; }
+        std::cout << "pose #" << i << ": #edgepixels=" << single[i].size() << "/" << batch[i].size()
+                  << "; #matched=" << single_matched << "/" << batch_matched
+                  << "; total dist=" << single_dist << "/" << batch_dist << "\n";
+        CHECK_LE(std::abs((int)single[i].size() - (int)batch[i].size()), 0.01 * single[i].size() + 2);
+    }
+
+    // reduction on the device against reduction on the host
+    std::vector<std::array<float, 6>> reduced;
+    timer.Tick("single reduced");
+    for (int i = 0; i < kNumPoses; ++i) {
+        std::array<float, 6> score_and_corner;
+        render.OneDimSearch(models[i], score_and_corner);
+        reduced.push_back(score_and_corner);
+    }
+    timer.Tock("single reduced");
+    std::vector<std::array<float, 6>> batch_reduced;
+    timer.Tick("batch reduced");
+    render.OneDimSearchBatch(models, batch_reduced);
+    timer.Tock("batch reduced");
+    for (int i = 0; i < kNumPoses; ++i) {
+        std::array<float, 6> expected;
+        feh::ReduceEdgelist(single[i], kRows, kCols, expected);
+        std::cout << "pose #" << i << ": ratio=" << expected[0] << "/" << reduced[i][0] << "/" << batch_reduced[i][0]
+                  << "; dist=" << expected[1] << "/" << reduced[i][1] << "/" << batch_reduced[i][1] << "\n";
+        CHECK_LE(std::fabs(expected[0] - reduced[i][0]), 1e-3);
+        CHECK_LE(std::fabs(expected[1] - reduced[i][1]), 1e-2);
+        for (int k = 2; k < 6; ++k) {
+            CHECK_EQ(expected[k], reduced[i][k]);
+        }
+    }
+
+    // packed edge lists are the edge lists as read back from the device
+    timer.Tick("single packed");
+    std::vector<feh::PackedEdgePixel> packed;
+    render.OneDimSearch(models[0], packed);
+    timer.Tock("single packed");
+    std::array<float, 6> packed_reduced;
+    feh::ReduceEdgelist(packed, kRows, kCols, packed_reduced);
+    CHECK_EQ(packed.size(), single[0].size());
+    CHECK_LE(std::fabs(packed_reduced[1] - reduced[0][1]), 1e-2);
+    std::cout << timer;
+}
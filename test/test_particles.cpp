@@ -2,6 +2,7 @@
 // Created by visionlab on 10/26/17.
 //
 #include "particle.h"
+#include "particle_array.h"
 #include "alias.h"
 
 int main() {
@@ -78,6 +79,176 @@ int main() {
     }
     std::cout << "covariance=\n" << particles.Covariance();
 
+    std::cout << "========== test log space weights against arbitrary precision ==========\n";
+    feh::Particles<float, 4, feh::LogWeightPolicy> log_particles;
+    feh::Particles<float, 4, feh::MPFRWeightPolicy> mpfr_particles;
+    for (int i = 0; i < 100; ++i) {
+        feh::Vec4f v = feh::Vec4f::Random();
+        // weights far beyond the range of float
+        double log_w = 500 + 100 * feh::Vec4f::Random()(0);
+        log_particles.push_back({v, 0, log_w});
+        mpfr_particles.push_back({v, 0, log_w});
+    }
+    log_particles[0].set_zero_w();
+    mpfr_particles[0].set_zero_w();
+    log_particles.Normalize();
+    mpfr_particles.Normalize();
+    double max_nw_diff(0);
+    for (int i = 0; i < log_particles.size(); ++i) {
+        max_nw_diff = std::max(max_nw_diff, std::fabs(log_particles[i].nw() - mpfr_particles[i].nw()));
+    }
+    std::cout << "max normalized weight diff=" << max_nw_diff << "\n";
+    CHECK_LT(max_nw_diff, 1e-9);
+    CHECK_EQ(log_particles[0].nw(), 0);
+    CHECK((log_particles.Mode() - mpfr_particles.Mode()).isZero());
+    // an infinite weight is clamped alike by both policies
+    log_particles.push_back({feh::Vec4f::Random(), 0, std::numeric_limits<double>::infinity()});
+    mpfr_particles.push_back({log_particles.back().v(), 0, std::numeric_limits<double>::infinity()});
+    log_particles.Normalize();
+    mpfr_particles.Normalize();
+    for (int i = 0; i < log_particles.size(); ++i) {
+        CHECK(std::isfinite(log_particles[i].nw()));
+        CHECK_LT(std::fabs(log_particles[i].nw() - mpfr_particles[i].nw()), 1e-9);
+    }
+
+    std::cout << "========== test structure of arrays against array of structures ==========\n";
+    feh::ParticleArray<float, 4> soa_particles;
+    feh::Particles<float, 4> aos_particles;
+    soa_particles.Initialize(std::make_shared<std::knuth_b>(0));
+    aos_particles.Initialize(std::make_shared<std::knuth_b>(0));
+    feh::ParticleArray<float, 4>::StateMatrix noise = feh::ParticleArray<float, 4>::StateMatrix::Random(100, 4);
+    feh::Vec4f scale(0.1, 0.1, 0.2, 3);
+    for (int i = 0; i < 100; ++i) {
+        feh::Vec4f v = feh::Vec4f::Random();
+        soa_particles.push_back({v, i % 3, 0.0});
+        aos_particles.push_back({v, i % 3, 0.0});
+    }
+    soa_particles.Perturbate(noise, scale);
+    soa_particles.WarpAngle(3);
+    soa_particles.AddLogWeights(10 * feh::ParticleArray<float, 4>::GaussianLogDensity(noise, 3));
+    for (int i = 0; i < 100; ++i) {
+        auto &p = aos_particles[i];
+        p.Perturbate(scale.cwiseProduct(noise.row(i).transpose()));
+        while (p.v(3) >= 2 * M_PI) p.v()(3) -= 2 * M_PI;
+        while (p.v(3) < 0) p.v()(3) += 2 * M_PI;
+        p.set_log_w(-5 * noise.row(i).head<3>().squaredNorm());
+        CHECK_LT((soa_particles[i].v() - p.v()).norm(), 1e-5);
+        CHECK_LT(std::fabs(soa_particles[i].log_w() - p.log_w()), 1e-4);
+    }
+    CHECK_EQ(soa_particles.MostProbableIndex(), aos_particles.MostProbableIndex());
+    CHECK_LT((soa_particles.Mean(1) - aos_particles.Mean(1)).norm(), 1e-4);
+    CHECK((soa_particles.Mode() - aos_particles.Mode()).isZero());
+    // covariance about the mean of all the particles
+    feh::Vec4f total_mean(0, 0, 0, 0);
+    for (int i = 0; i < 100; ++i) total_mean += float(aos_particles[i].nw()) * aos_particles[i].v();
+    Eigen::Matrix4f total_cov;
+    total_cov.setZero();
+    for (int i = 0; i < 100; ++i) {
+        feh::Vec4f d(aos_particles[i].v() - total_mean);
+        total_cov += float(aos_particles[i].nw()) * d * d.transpose();
+    }
+    CHECK_LT((soa_particles.Covariance() - total_cov).norm(), 1e-4);
+    // a shape without particles has no mean rather than aborting
+    CHECK(soa_particles.Mean(3).hasNaN());
+    soa_particles.SystematicResampling();
+    aos_particles.SystematicResampling();
+    for (int i = 0; i < 100; ++i) {
+        CHECK((soa_particles[i].v() - aos_particles[i].v()).isZero());
+        CHECK_EQ(soa_particles[i].shape_id(), aos_particles[i].shape_id());
+    }
+    soa_particles.PrintSummary();
+
+    std::cout << "========== test KLD-sampling ==========\n";
+    feh::Vec4f bin_size(0.05, 0.05, 0.05, 0.1);
+    feh::ParticleArray<float, 4> kld_particles;
+    kld_particles.Initialize(std::make_shared<std::knuth_b>(0));
+    // tight posterior: all the particles within one bin
+    kld_particles.resize(1000, {feh::Vec4f(0.01, 0.01, 0.01, 0.01), 0, 0.0});
+    int tight_num = kld_particles.KLDSampleSize(0.5, bin_size, 0.05, 2.33, 50, 5000);
+    CHECK_EQ(tight_num, 50);
+    // wide posterior over several shapes
+    for (int i = 0; i < kld_particles.size(); ++i) {
+        kld_particles[i].v() = feh::Vec4f::Random();
+        kld_particles[i].set_shape_id(i % 4);
+    }
+    int wide_num = kld_particles.KLDSampleSize(0.5, bin_size, 0.05, 2.33, 50, 5000);
+    std::cout << "#particles tight=" << tight_num << "; wide=" << wide_num << "\n";
+    CHECK_GT(wide_num, 10 * tight_num);
+    CHECK_LE(wide_num, 5000);
+    kld_particles.SystematicResampling(0.5, wide_num);
+    CHECK_EQ(kld_particles.size(), wide_num);
+    kld_particles.SystematicResampling(0.5, tight_num);
+    CHECK_EQ(kld_particles.size(), tight_num);
+
+    std::cout << "========== test resampling schemes ==========\n";
+    std::vector<double> nw(50);
+    for (int i = 0; i < nw.size(); ++i) nw[i] = (i % 5 == 0) ? 0 : i;
+    double nw_sum = std::accumulate(nw.begin(), nw.end(), 0.0);
+    for (double &w : nw) w /= nw_sum;
+    std::knuth_b generator(0);
+    for (auto scheme : {feh::ResamplingScheme::SYSTEMATIC, feh::ResamplingScheme::STRATIFIED,
+                        feh::ResamplingScheme::RESIDUAL, feh::ResamplingScheme::MULTINOMIAL}) {
+        // copies are unbiased
+        int n(100), trials(2000);
+        std::vector<double> mean_counts(nw.size(), 0);
+        for (int t = 0; t < trials; ++t) {
+            std::vector<int> counts = feh::ResamplingCounts(nw, n, scheme, generator);
+            CHECK_EQ(std::accumulate(counts.begin(), counts.end(), 0), n);
+            for (int i = 0; i < nw.size(); ++i) {
+                if (nw[i] == 0) CHECK_EQ(counts[i], 0);
+                mean_counts[i] += counts[i] / double(trials);
+            }
+        }
+        double max_bias(0);
+        for (int i = 0; i < nw.size(); ++i) max_bias = std::max(max_bias, std::fabs(mean_counts[i] - n * nw[i]));
+        std::cout << "scheme #" << int(scheme) << ": max bias of copies=" << max_bias << "\n";
+        CHECK_LT(max_bias, 0.2);
+    }
+    std::vector<double> large_w(100000, 1.0), cdf;
+    feh::CumulativeSum(large_w, cdf);
+    CHECK_EQ(cdf.back(), large_w.size());
+    CHECK_EQ(cdf[54321], 54322);
+
+    feh::ParticleArray<float, 4> ess_particles;
+    ess_particles.Initialize(std::make_shared<std::knuth_b>(0));
+    for (int i = 0; i < 10; ++i) ess_particles.push_back({feh::Vec4f::Constant(i), i, 0.0});
+    CHECK_LT(std::fabs(ess_particles.EffectiveSampleSize() - 10), 1e-9);
+    ess_particles[0].set_log_w(100);
+    CHECK_LT(std::fabs(ess_particles.EffectiveSampleSize() - 1), 1e-9);
+    // in place replication of the only particle with weight, growing and shrinking
+    for (int n : {25, 3}) {
+        ess_particles.Resample(feh::ResamplingScheme::RESIDUAL, generator, n);
+        CHECK_EQ(ess_particles.size(), n);
+        for (int i = 0; i < n; ++i) {
+            CHECK_EQ(ess_particles[i].shape_id(), 0);
+            CHECK(ess_particles[i].v().isZero());
+        }
+    }
+    // an infinite weight is clamped rather than aborting
+    ess_particles[0].set_log_w(std::numeric_limits<double>::infinity());
+    CHECK(std::isfinite(ess_particles.EffectiveSampleSize()));
+    // all the weights zero: reported instead of aborting, particles untouched
+    for (int i = 0; i < ess_particles.size(); ++i) ess_particles[i].set_zero_w();
+    CHECK(std::isnan(ess_particles.EffectiveSampleSize()));
+    CHECK(!ess_particles.Resample(feh::ResamplingScheme::SYSTEMATIC, generator));
+    CHECK_EQ(ess_particles.size(), 3);
+
+    std::cout << "========== test ping-pong buffers ==========\n";
+    feh::ParticleBuffers<feh::ParticleArray<float, 4>> buffers;
+    buffers.Initialize(std::make_shared<std::knuth_b>(0));
+    for (int i = 0; i < 100; ++i) buffers.current().push_back({feh::Vec4f::Random(), i % 3, 0.0});
+    feh::ParticleArray<float, 4>::StateMatrix before = buffers.current().states();
+    buffers.Begin().Perturbate(buffers.committed(), noise, scale);
+    CHECK_LT((buffers.current().states() - before - noise * scale.asDiagonal()).norm(), 1e-4);
+    CHECK((buffers.committed().states() - before).isZero());
+    buffers.Rollback();
+    CHECK((buffers.current().states() - before).isZero());
+    buffers.Begin().Perturbate(buffers.committed(), noise, scale);
+    buffers.current().SystematicResampling();
+    buffers.Commit();
+    CHECK_EQ(buffers.current().size(), 100);
+    CHECK(!buffers.pending());
+
 //    feh::Particles<feh::Vec4f> particles;
 //    particles.resize(100, {feh::Vec4f::Random(), 1.0f});
 //    particles.Normalize();
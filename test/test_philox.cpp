@@ -0,0 +1,62 @@
+// Known answers of the counter-based generator and agreement of batched and per stream draws.
+#include "philox.h"
+
+#include <iostream>
+#include <vector>
+#include <random>
+
+#include "glog/logging.h"
+
+int main() {
+    // known answer tests of Random123
+    struct {
+        feh::Philox::Block counter;
+        uint64_t key;
+        feh::Philox::Block expected;
+    } kat[] = {
+        {{0, 0, 0, 0}, 0, {0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8}},
+        {{0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff}, 0xffffffffffffffffULL,
+            {0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd}},
+        {{0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}, 0x299f31d0a4093822ULL,
+            {0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}},
+    };
+    for (const auto &test : kat) {
+        CHECK(feh::Philox::Generate(test.key, test.counter) == test.expected);
+    }
+
+    // batched fills agree with the streams of the rows, for any batching
+    const uint64_t key = 0x1234567800000007ULL;
+    const int rows = 1000, cols = 6;
+    std::vector<float> uniform(rows * cols), normal(rows * cols);
+    feh::FillUniform(key, 3, 1, 0, rows, cols, uniform.data());
+    feh::FillNormal(key, 3, 2, 0, rows, cols, normal.data());
+    std::vector<float> tail(cols * 10);
+    feh::FillNormal(key, 3, 2, rows - 10, 10, cols, tail.data());
+    double mean(0), var(0);
+    for (int i = 0; i < rows; ++i) {
+        feh::Philox uniform_stream(key, i, 3, 1), normal_stream(key, i, 3, 2);
+        for (int j = 0; j < cols; ++j) {
+            CHECK_EQ(uniform[j * rows + i], uniform_stream.Uniform());
+            float n = normal_stream.Normal();
+            CHECK_EQ(normal[j * rows + i], n);
+            if (i >= rows - 10) CHECK_EQ(tail[j * 10 + i - rows + 10], n);
+            CHECK_GE(uniform[j * rows + i], 0);
+            CHECK_LT(uniform[j * rows + i], 1);
+            mean += n;
+            var += n * n;
+        }
+    }
+    mean /= rows * cols;
+    var = var / (rows * cols) - mean * mean;
+    std::cout << "normal mean=" << mean << "; var=" << var << "\n";
+    CHECK_LT(std::fabs(mean), 0.05);
+    CHECK_LT(std::fabs(var - 1), 0.05);
+
+    // usable with the std distributions
+    feh::Philox generator(key);
+    std::uniform_int_distribution<int> dist(0, 9);
+    for (int i = 0; i < 100; ++i) {
+        int x = dist(generator);
+        CHECK(x >= 0 && x <= 9);
+    }
+}
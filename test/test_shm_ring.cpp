@@ -0,0 +1,110 @@
+// Round trips through shared memory rings with a forked stand-in detector process.
+#include "shm_ring.h"
+
+// stl
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+#include <string>
+
+// system
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "glog/logging.h"
+
+static const int kRows = 480;
+static const int kCols = 640;
+static const int kFrames = 200;
+static const int kSlots = 4;
+
+// the stand-in replies the frame index and the checksum of the pixels
+static int Detector(const std::string &request_name, const std::string &reply_name) {
+    feh::ShmRingPtr request, reply;
+    for (int trial = 0; trial < 1000 && !(request && reply); ++trial) {
+        if (!request) request = feh::ShmRing::Open(request_name);
+        if (!reply) reply = feh::ShmRing::Open(reply_name);
+        usleep(1000);
+    }
+    CHECK(request && reply) << "failed to open the rings";
+    for (int i = 0; i < kFrames; ++i) {
+        size_t size;
+        const uint8_t *frame = request->Acquire(&size, 5000);
+        CHECK(frame) << "no frame";
+        uint32_t answer[2] = {*reinterpret_cast<const uint32_t *>(frame),
+                              std::accumulate(frame + sizeof(uint32_t), frame + size, 0u)};
+        request->Release();
+        uint8_t *out = reply->Reserve(5000);
+        CHECK(out) << "reply ring full";
+        memcpy(out, answer, sizeof(answer));
+        reply->Commit(sizeof(answer));
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    std::string request_name = "/feh_test_request_" + std::to_string(getpid());
+    std::string reply_name = "/feh_test_reply_" + std::to_string(getpid());
+    size_t frame_size = sizeof(uint32_t) + kRows * kCols * 3;
+    auto request = feh::ShmRing::Create(request_name, kSlots, frame_size);
+    auto reply = feh::ShmRing::Create(reply_name, kSlots, 64);
+    CHECK(request && reply);
+    CHECK_EQ(request->num_slots(), kSlots);
+    CHECK_EQ(request->slot_size(), frame_size);
+
+    pid_t pid = fork();
+    CHECK_GE(pid, 0);
+    if (pid == 0) return Detector(request_name, reply_name);
+
+    // nothing to acquire yet
+    size_t size;
+    CHECK(reply->Acquire(&size, 10) == nullptr);
+
+    double total_ms(0);
+    for (int i = 0; i < kFrames; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        // the frame is written in place
+        uint8_t *frame = request->Reserve(5000);
+        CHECK(frame);
+        *reinterpret_cast<uint32_t *>(frame) = i;
+        uint8_t *pixels = frame + sizeof(uint32_t);
+        for (int k = 0; k < kRows * kCols * 3; ++k) pixels[k] = (k + i) & 0xff;
+        request->Commit(frame_size);
+
+        const uint8_t *answer = reply->Acquire(&size, 5000);
+        CHECK(answer) << "no reply";
+        CHECK_EQ(size, 2 * sizeof(uint32_t));
+        uint32_t index = reinterpret_cast<const uint32_t *>(answer)[0];
+        uint32_t checksum = reinterpret_cast<const uint32_t *>(answer)[1];
+        reply->Release();
+        total_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        CHECK_EQ(index, (uint32_t)i);
+        CHECK_EQ(checksum, std::accumulate(pixels, pixels + kRows * kCols * 3, 0u));
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0) << "stand-in detector failed";
+    CHECK_EQ(request->size(), 0);
+    CHECK_EQ(reply->size(), 0);
+
+    // a full ring times out
+    for (int i = 0; i < kSlots; ++i) {
+        CHECK(request->Reserve(0));
+        request->Commit(0);
+    }
+    CHECK(request->Reserve(10) == nullptr);
+
+    // a size written beyond the slot by a corrupt peer is reported as an empty message
+    uint8_t *slot = reply->Reserve(0);
+    CHECK(slot);
+    reply->Commit(0);
+    *reinterpret_cast<uint64_t *>(slot - sizeof(uint64_t)) = reply->slot_size() + 1;
+    CHECK(reply->Acquire(&size, 0));
+    CHECK_EQ(size, 0);
+    reply->Release();
+    // names are unlinked by the creators
+    std::cout << kFrames << " frames of " << kRows << "x" << kCols
+              << ", average round trip=" << total_ms / kFrames << " ms\n";
+}
@@ -0,0 +1,78 @@
+// Compare contours extracted from mesh edges against rendered contours.
+#include "silhouette_extractor.h"
+#include "renderer.h"
+
+#include "utils.h"
+
+static const int kRows = 480;
+static const int kCols = 640;
+static const float kFx = 400;
+static const float kFy = 400;
+static const float kCx = (kCols >> 1);
+static const float kCy = (kRows >> 1);
+static const float kZNear = 0.05;
+static const float kZFar = 5.0;
+
+// x_min, y_min, x_max, y_max of the edge pixels
+static Eigen::Vector4f BoundingBox(const std::vector<feh::EdgePixel> &edgelist) {
+    Eigen::Vector4f box(kCols, kRows, 0, 0);
+    for (const auto &e : edgelist) {
+        box << std::min(box(0), e.x), std::min(box(1), e.y),
+            std::max(box(2), e.x), std::max(box(3), e.y);
+    }
+    return box;
+}
+
+int main(int argc, char **argv) {
+    std::string obj_file_path("../resources/swivel_chair_scanned.obj");
+    if (argc == 2) {
+        obj_file_path = std::string(argv[1]);
+    } else if (argc != 1) {
+        LOG(FATAL) << "invalid argument format";
+    }
+
+    feh::MatXf V;
+    feh::MatXi F;
+    std::tie(V, F) = feh::LoadMesh(obj_file_path);
+
+    float intrinsics[] = {kFx, kFy, kCx, kCy};
+    feh::Renderer render(kRows, kCols, feh::RenderBackend::SOFTWARE);
+    render.SetMesh(V, F);
+    render.SetCamera(kZNear, kZFar, intrinsics);
+    feh::SilhouetteExtractor extractor(V, F);
+    extractor.SetCamera(kRows, kCols, kZNear, kFx, kFy, kCx, kCy);
+    std::cout << "#faces=" << F.rows() << "; #candidate edges=" << extractor.num_edges() << "\n";
+
+    feh::Timer timer("silhouette");
+    feh::Mat4fColMajorList poses;
+    std::vector<feh::EdgePixel> rendered, extracted;
+    for (int i = 0; i < 72; ++i) {
+        Eigen::Matrix<float, 4, 4, Eigen::ColMajor> model;
+        model.setIdentity();
+        model.block<3, 1>(0, 3) = Eigen::Vector3f(0, 0, 1.5);
+        model.block<3, 3>(0, 0) = Eigen::AngleAxisf(2 * M_PI * i / 72, Eigen::Vector3f::UnitY()).toRotationMatrix();
+        poses.push_back(model);
+
+        timer.Tick("rendered contour");
+        render.ComputeEdgePixels(model, rendered);
+        timer.Tock("rendered contour");
+        timer.Tick("geometric contour");
+        extractor.ComputeEdgePixels(model, extracted);
+        timer.Tock("geometric contour");
+
+        // hidden contours are extracted as well, but the outline has to agree
+        float box_diff = (BoundingBox(rendered) - BoundingBox(extracted)).cwiseAbs().maxCoeff();
+        std::cout << "pose #" << i
+                  << ": #edgepixels=" << rendered.size() << "/" << extracted.size()
+                  << "; max box diff=" << box_diff << "\n";
+        CHECK_LE(box_diff, 2);
+    }
+
+    std::vector<std::vector<feh::EdgePixel>> edgelists;
+    timer.Tick("geometric contour batch");
+    extractor.ComputeEdgePixels(poses, edgelists);
+    timer.Tock("geometric contour batch");
+    CHECK_EQ(edgelists.size(), poses.size());
+    CHECK_EQ(edgelists.back().size(), extracted.size());
+    std::cout << timer;
+}
@@ -0,0 +1,126 @@
+// Compare the software rasterizer against the OpenGL renderer.
+#include "renderer.h"
+
+#include "opencv2/opencv.hpp"
+
+#include "utils.h"
+
+static const int kRows = 480;
+static const int kCols = 640;
+static const float kFx = 400;
+static const float kFy = 400;
+static const float kCx = (kCols >> 1);
+static const float kCy = (kRows >> 1);
+static const float kZNear = 0.05;
+static const float kZFar = 5.0;
+
+int main(int argc, char **argv) {
+    std::string obj_file_path("../resources/swivel_chair_scanned.obj");
+    if (argc == 2) {
+        obj_file_path = std::string(argv[1]);
+    } else if (argc != 1) {
+        LOG(FATAL) << "invalid argument format";
+    }
+
+    feh::MatXf V;
+    feh::MatXi F;
+    std::tie(V, F) = feh::LoadMesh(obj_file_path);
+
+    float intrinsics[] = {kFx, kFy, kCx, kCy};
+    feh::Renderer gl_render(kRows, kCols, feh::RenderBackend::OPENGL);
+    feh::Renderer sw_render(kRows, kCols, feh::RenderBackend::SOFTWARE);
+    for (feh::Renderer *render : {&gl_render, &sw_render}) {
+        render->SetMesh(V, F);
+        render->SetCamera(kZNear, kZFar, intrinsics);
+    }
+
+    feh::Timer timer("renderer");
+    Eigen::Matrix4f model;
+    model.setIdentity();
+    cv::Mat gl_depth(kRows, kCols, CV_32FC1), sw_depth(kRows, kCols, CV_32FC1);
+    cv::Mat gl_mask(kRows, kCols, CV_8UC1), sw_mask(kRows, kCols, CV_8UC1);
+    cv::Mat gl_edge(kRows, kCols, CV_8UC1), sw_edge(kRows, kCols, CV_8UC1);
+    std::vector<feh::EdgePixel> gl_edgelist, sw_edgelist;
+    for (int i = 0; i < 72; ++i) {
+        model.block<3, 1>(0, 3) = Eigen::Vector3f(0, 0, 1);
+        model.block<3, 3>(0, 0) = Eigen::AngleAxisf(2 * M_PI * i / 72, Eigen::Vector3f::UnitY()).toRotationMatrix();
+
+        gl_render.RenderDepth(model, gl_depth);
+        sw_render.RenderDepth(model, sw_depth);
+        double max_depth_diff;
+        cv::minMaxLoc(cv::abs(gl_depth - sw_depth), nullptr, &max_depth_diff);
+
+        gl_render.RenderMask(model, gl_mask);
+        sw_render.RenderMask(model, sw_mask);
+        int mask_diff = cv::countNonZero(gl_mask != sw_mask);
+
+        gl_render.RenderEdge(model, gl_edge);
+        sw_render.RenderEdge(model, sw_edge);
+        int edge_diff = cv::countNonZero(gl_edge != sw_edge);
+
+        if (i == 0) {
+            cv::Mat evidence_dir(kRows, kCols, CV_32FC1);
+            evidence_dir.setTo(0);
+            for (feh::Renderer *render : {&gl_render, &sw_render}) {
+                render->UploadEvidence(gl_edge.data);
+                render->UploadEvidenceDirection((float*)evidence_dir.data);
+            }
+        }
+
+        timer.Tick("opengl one dimensional search");
+        gl_render.OneDimSearch(model, gl_edgelist);
+        timer.Tock("opengl one dimensional search");
+        timer.Tick("software one dimensional search");
+        sw_render.OneDimSearch(model, sw_edgelist);
+        timer.Tock("software one dimensional search");
+
+        std::cout << "pose #" << i
+                  << ": max depth diff=" << max_depth_diff
+                  << "; #mask diff=" << mask_diff
+                  << "; #edge diff=" << edge_diff
+                  << "; #edgepixels=" << gl_edgelist.size() << "/" << sw_edgelist.size() << "\n";
+        CHECK_LE(mask_diff, 0.001 * kRows * kCols);
+    }
+
+    // region of interest: outputs agree with full rendering inside and are background outside
+    cv::Rect roi(kCols / 4, kRows / 4, kCols / 2, kRows / 2);
+    for (feh::Renderer *render : {&gl_render, &sw_render}) {
+        cv::Mat full_mask(kRows, kCols, CV_8UC1), roi_mask(kRows, kCols, CV_8UC1);
+        render->RenderMask(model, full_mask);
+        render->SetROI(roi);
+        render->RenderMask(model, roi_mask);
+        render->ClearROI();
+        cv::Mat expected(kRows, kCols, CV_8UC1, cv::Scalar(255));
+        full_mask(roi).copyTo(expected(roi));
+        int roi_diff = cv::countNonZero(expected != roi_mask);
+        std::cout << render->name() << ": #mask diff with roi=" << roi_diff << "\n";
+        CHECK_EQ(roi_diff, 0);
+    }
+
+    // asynchronous readback agrees with synchronous readback
+    for (feh::Renderer *render : {&gl_render, &sw_render}) {
+        cv::Mat sync_depth(kRows, kCols, CV_32FC1), async_depth(kRows, kCols, CV_32FC1);
+        render->RenderDepth(model, sync_depth);
+        timer.Tick("asynchronous readback");
+        auto readback = render->RenderDepthAsync(model, (float*)async_depth.data);
+        readback->Wait();
+        timer.Tock("asynchronous readback");
+        CHECK_EQ(cv::countNonZero(sync_depth != async_depth), 0) << render->name();
+    }
+
+    // a renderer completes its outstanding readbacks when destroyed
+    {
+        cv::Mat sync_depth(kRows, kCols, CV_32FC1), async_depth(kRows, kCols, CV_32FC1);
+        gl_render.RenderDepth(model, sync_depth);
+        feh::RenderReadbackPtr readback;
+        {
+            feh::Renderer temp_render(kRows, kCols, feh::RenderBackend::OPENGL);
+            temp_render.SetMesh(V, F);
+            temp_render.SetCamera(kZNear, kZFar, intrinsics);
+            readback = temp_render.RenderDepthAsync(model, (float*)async_depth.data);
+        }
+        CHECK(readback->Ready());
+        CHECK_EQ(cv::countNonZero(sync_depth != async_depth), 0);
+    }
+    std::cout << timer;
+}
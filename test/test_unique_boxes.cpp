@@ -0,0 +1,55 @@
+// Quantization & deduplication of the hypothesis boxes sent to the CNN.
+#include "tracker_utils.h"
+
+// stl
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "glog/logging.h"
+
+int main() {
+    std::vector<cv::Rect> boxes{
+        cv::Rect(10, 20, 30, 40),   // snapped to (12, 20, 28, 40)
+        cv::Rect(10, 20, 30, 40),   // identical
+        cv::Rect(11, 21, 30, 40),   // near-identical, same grid points
+        cv::Rect(100, 50, 20, 20),  // distinct, snapped to (100, 52, 20, 20)
+        cv::Rect(101, 51, 20, 20),  // near-identical to the previous one
+        cv::Rect(14, 20, 30, 40)    // close to the first one but rounded to the next grid points
+    };
+    std::vector<int> index;
+    std::vector<cv::Rect> unique = feh::UniqueBoxes(boxes, 4, index);
+    std::cout << "#boxes=" << boxes.size() << "; #unique=" << unique.size() << "\n";
+    CHECK_EQ(unique.size(), 3);
+    CHECK_EQ(index.size(), boxes.size());
+    std::vector<int> expected_index{0, 0, 0, 1, 1, 2};
+    for (int i = 0; i < boxes.size(); ++i) {
+        CHECK_EQ(index[i], expected_index[i]) << "box #" << i;
+    }
+    CHECK(unique[0] == cv::Rect(12, 20, 28, 40));
+    CHECK(unique[1] == cv::Rect(100, 52, 20, 20));
+    CHECK(unique[2] == cv::Rect(16, 20, 28, 40));
+    // each hypothesis maps to a box whose corners are within half a cell of its own
+    for (int i = 0; i < boxes.size(); ++i) {
+        const cv::Rect &box = boxes[i], &sent = unique[index[i]];
+        CHECK_LE(std::abs(box.x - sent.x), 2);
+        CHECK_LE(std::abs(box.y - sent.y), 2);
+        CHECK_LE(std::abs(box.br().x - sent.br().x), 2);
+        CHECK_LE(std::abs(box.br().y - sent.br().y), 2);
+    }
+
+    // a unit cell only merges exact duplicates
+    unique = feh::UniqueBoxes(boxes, 1, index);
+    CHECK_EQ(unique.size(), 5);
+    expected_index = {0, 0, 1, 2, 3, 4};
+    for (int i = 0; i < boxes.size(); ++i) {
+        CHECK_EQ(index[i], expected_index[i]) << "box #" << i;
+        CHECK(unique[index[i]] == boxes[i]) << "box #" << i;
+    }
+
+    // nothing to send
+    unique = feh::UniqueBoxes({}, 4, index);
+    CHECK(unique.empty());
+    CHECK(index.empty());
+    std::cout << "passed\n";
+}
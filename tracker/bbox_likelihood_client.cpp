@@ -0,0 +1,198 @@
+#include "bbox_likelihood_client.h"
+
+// stl
+#include <algorithm>
+
+// 3rd party
+#include "glog/logging.h"
+
+// own
+#include "message_utils.h"
+
+namespace feh {
+
+namespace {
+// polling interval of the receiver, bounds the time to shut down
+constexpr int kReceiveTimeoutMs = 50;
+}
+
+BBoxLikelihoodClient::BBoxLikelihoodClient(uint32_t tracker_id):
+    tracker_id_(tracker_id),
+    running_(true) {
+    port_.subscribe("likelihood", &BBoxLikelihoodHandler::Handle, &handler_);
+    receiver_ = std::thread(&BBoxLikelihoodClient::Receive, this);
+}
+
+BBoxLikelihoodClient::~BBoxLikelihoodClient() {
+    running_ = false;
+    receiver_.join();
+}
+
+std::future<std::vector<float>> BBoxLikelihoodClient::Request(const vlslam_pb::BoundingBoxList &bboxlist) {
+    std::future<std::vector<float>> future;
+    {
+        // queued before publishing, such that the reply always finds its promise
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_.emplace_back();
+        future = pending_.back().get_future();
+    }
+    std::vector<uint8_t> send_data(bboxlist.ByteSize());
+    bboxlist.SerializeToArray(send_data.data(), send_data.size());
+    port_.publish("bbox", send_data.data(), send_data.size());
+    return future;
+}
+
+int BBoxLikelihoodClient::pending() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pending_.size();
+}
+
+void BBoxLikelihoodClient::Receive() {
+    while (running_) {
+        // the handler is invoked on this thread
+        int status = port_.handleTimeout(kReceiveTimeoutMs);
+        if (status < 0) {
+            LOG(ERROR) << "failed to receive likelihood messages";
+            break;
+        }
+        if (status == 0 || handler_.tracker_id_ != tracker_id_) continue;
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (pending_.empty()) {
+            LOG(WARNING) << "unexpected likelihood message for tracker #" << tracker_id_;
+            continue;
+        }
+        pending_.front().set_value(handler_.scores_);
+        pending_.pop_front();
+    }
+}
+
+BBoxLikelihoodBatcher::BBoxLikelihoodBatcher(ShmRingPtr request_ring, ShmRingPtr reply_ring):
+    request_ring_(request_ring),
+    reply_ring_(reply_ring),
+    running_(true) {
+    CHECK_EQ(bool(request_ring_), bool(reply_ring_)) << "shared memory transport needs both rings";
+    if (!reply_ring_) port_.subscribe("likelihood_batch", &BBoxLikelihoodBatcher::Handle, this);
+    receiver_ = std::thread(&BBoxLikelihoodBatcher::Receive, this);
+}
+
+BBoxLikelihoodBatcher::~BBoxLikelihoodBatcher() {
+    running_ = false;
+    receiver_.join();
+}
+
+std::future<std::vector<float>> BBoxLikelihoodBatcher::Add(uint32_t tracker_id,
+                                                           const std::vector<vlslam_pb::BoundingBox> &bboxes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // replies are demultiplexed by tracker id
+    CHECK(std::none_of(queued_.begin(), queued_.end(),
+                       [tracker_id](const Request &request) { return request.tracker_id == tracker_id; }))
+        << "tracker#" << tracker_id << " queued twice on the same batch";
+    for (int i = 0; i < bboxes.size(); ++i) {
+        vlslam_pb::BoundingBox *bbox = batch_.add_bounding_boxes();
+        *bbox = bboxes[i];
+        bbox->set_tracker_id(tracker_id);
+        bbox->set_particle_id(i);
+    }
+    queued_.push_back({tracker_id, int(bboxes.size()), std::promise<std::vector<float>>()});
+    return queued_.back().promise.get_future();
+}
+
+void BBoxLikelihoodBatcher::Flush(const std::string &description, const cv::Mat &image) {
+    vlslam_pb::BoundingBoxList batch;
+    std::vector<Request> requests;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (queued_.empty()) return;
+        batch.Swap(&batch_);
+        requests.swap(queued_);
+    }
+    batch.set_description(description);
+    if (request_ring_) {
+        // written in place, never wait for a stalled detector to free a slot
+        uint8_t *slot = request_ring_->Reserve(0);
+        size_t size = slot ? WriteFrameMessage(image, &batch, slot, request_ring_->slot_size()) : 0;
+        if (size == 0) {
+            LOG(WARNING) << "CNN batch dropped, " << (slot ? "frame exceeds the slot" : "request ring full");
+            for (auto &request : requests) request.promise.set_value({});
+            return;
+        }
+        {
+            // in flight before committing, such that the reply always finds its batch
+            std::lock_guard<std::mutex> lock(mutex_);
+            in_flight_.push_back(std::move(requests));
+        }
+        request_ring_->Commit(size);
+    } else {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            in_flight_.push_back(std::move(requests));
+        }
+        std::vector<uint8_t> send_data(batch.ByteSize());
+        batch.SerializeToArray(send_data.data(), send_data.size());
+        port_.publish("bbox_batch", send_data.data(), send_data.size());
+    }
+    LOG(INFO) << "CNN batch with " << batch.bounding_boxes_size() << " boxes sent";
+}
+
+void BBoxLikelihoodBatcher::Receive() {
+    while (running_) {
+        if (reply_ring_) {
+            size_t size;
+            const uint8_t *data = reply_ring_->Acquire(&size, kReceiveTimeoutMs);
+            if (!data) continue;
+            // parsed in place
+            vlslam_pb::BoundingBoxList bboxlist;
+            bool ok = bboxlist.ParseFromArray(data, size);
+            reply_ring_->Release();
+            if (!ok) {
+                // still answers its batch, with no scores
+                LOG(WARNING) << "malformed likelihood batch";
+                bboxlist.Clear();
+            }
+            Dispatch(bboxlist);
+        } else if (port_.handleTimeout(kReceiveTimeoutMs) < 0) {
+            LOG(ERROR) << "failed to receive likelihood messages";
+            break;
+        }
+    }
+}
+
+void BBoxLikelihoodBatcher::Handle(const lcm::ReceiveBuffer *rawbuf, const std::string &channel) {
+    vlslam_pb::BoundingBoxList bboxlist;
+    bboxlist.ParseFromArray(rawbuf->data, rawbuf->data_size);
+    Dispatch(bboxlist);
+}
+
+void BBoxLikelihoodBatcher::Dispatch(const vlslam_pb::BoundingBoxList &bboxlist) {
+    std::vector<Request> requests;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (in_flight_.empty()) {
+            LOG(WARNING) << "unexpected likelihood batch";
+            return;
+        }
+        requests = std::move(in_flight_.front());
+        in_flight_.pop_front();
+    }
+    std::unordered_map<uint32_t, int> index;
+    std::vector<std::vector<float>> scores(requests.size());
+    std::vector<int> filled(requests.size(), 0);
+    for (int k = 0; k < requests.size(); ++k) {
+        index[requests[k].tracker_id] = k;
+        scores[k].resize(requests[k].size);
+    }
+    for (const auto &bbox : bboxlist.bounding_boxes()) {
+        auto it = index.find(bbox.tracker_id());
+        if (it == index.end() || bbox.scores_size() == 0) continue;
+        int k = it->second;
+        if (bbox.particle_id() < 0 || bbox.particle_id() >= scores[k].size()) continue;
+        scores[k][bbox.particle_id()] = bbox.scores(0);
+        ++filled[k];
+    }
+    for (int k = 0; k < requests.size(); ++k) {
+        if (filled[k] != requests[k].size) scores[k].clear();
+        requests[k].promise.set_value(std::move(scores[k]));
+    }
+}
+
+}   // namespace feh
@@ -0,0 +1,113 @@
+//
+// Asynchronous bounding box scoring by the detector process.
+//
+#pragma once
+// stl
+#include <atomic>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// 3rd party
+#include "lcm/lcm-cpp.hpp"
+#include "opencv2/core/core.hpp"
+
+// own
+#include "vlslam.pb.h"
+#include "lcm_msg_handlers.h"
+#include "shm_ring.h"
+
+namespace feh {
+
+/// \brief: Publishes bounding box hypotheses on the "bbox" channel and receives their scores
+/// from the "likelihood" channel on a background thread, such that the caller only blocks when
+/// it needs the scores, and for as long as it is willing to wait.
+/// The detector answers the requests of a tracker in order, thus the n-th reply addressed to
+/// this tracker fulfills the n-th request. Replies to requests whose futures were abandoned,
+/// e.g., after a deadline, are dropped without confusing later requests.
+class BBoxLikelihoodClient {
+public:
+    /// \param tracker_id: replies are matched by the tracker id in the first 4 characters
+    /// of the description.
+    explicit BBoxLikelihoodClient(uint32_t tracker_id);
+    ~BBoxLikelihoodClient();
+    BBoxLikelihoodClient(const BBoxLikelihoodClient &) = delete;
+    BBoxLikelihoodClient &operator=(const BBoxLikelihoodClient &) = delete;
+
+    bool good() const { return port_.good(); }
+    /// \brief: Publish the hypotheses, the future holds one score per bounding box.
+    std::future<std::vector<float>> Request(const vlslam_pb::BoundingBoxList &bboxlist);
+    /// \brief: Number of requests not answered yet.
+    int pending() const;
+
+private:
+    void Receive();
+
+    lcm::LCM port_;
+    BBoxLikelihoodHandler handler_;
+    uint32_t tracker_id_;
+    mutable std::mutex mutex_;
+    std::deque<std::promise<std::vector<float>>> pending_;
+    std::atomic<bool> running_;
+    std::thread receiver_;
+};
+
+typedef std::shared_ptr<BBoxLikelihoodClient> BBoxLikelihoodClientPtr;
+
+/// \brief: Gathers the hypotheses of all the trackers of a scene into one request per frame,
+/// published on the "bbox_batch" channel, such that the detector runs a single batched pass.
+/// Boxes carry tracker & particle ids, and the reply on the "likelihood_batch" channel is
+/// demultiplexed by the same ids. As with BBoxLikelihoodClient, the n-th reply answers the
+/// n-th flushed batch.
+/// With shared memory rings, the decoded frame and the batch are written in place into the
+/// request ring instead, see WriteFrameMessage, and the reply is parsed in place from the
+/// reply ring, such that the detector neither reads the image from disk nor decodes it.
+class BBoxLikelihoodBatcher {
+public:
+    /// \param request_ring, reply_ring: shared memory transport, LCM if null.
+    explicit BBoxLikelihoodBatcher(ShmRingPtr request_ring=nullptr, ShmRingPtr reply_ring=nullptr);
+    ~BBoxLikelihoodBatcher();
+    BBoxLikelihoodBatcher(const BBoxLikelihoodBatcher &) = delete;
+    BBoxLikelihoodBatcher &operator=(const BBoxLikelihoodBatcher &) = delete;
+
+    bool good() const { return (request_ring_ && reply_ring_) || port_.good(); }
+    /// \brief: Queue the hypotheses of a tracker on the current batch, particle ids are the
+    /// indices of the boxes. The future holds one score per box, or is empty if the reply
+    /// misses any of them. A tracker is queued at most once per batch.
+    std::future<std::vector<float>> Add(uint32_t tracker_id,
+                                        const std::vector<vlslam_pb::BoundingBox> &bboxes);
+    /// \brief: Publish the current batch as one message, nothing is sent if it is empty.
+    /// If the request ring is full, the batch is dropped and its futures hold no scores.
+    /// \param description: full path of the image to operate on.
+    /// \param image: the image itself, only sent through shared memory.
+    void Flush(const std::string &description, const cv::Mat &image=cv::Mat());
+
+private:
+    struct Request {
+        uint32_t tracker_id;
+        int size;
+        std::promise<std::vector<float>> promise;
+    };
+    void Receive();
+    void Handle(const lcm::ReceiveBuffer *rawbuf, const std::string &channel);
+    /// \brief: Fulfill the requests of the oldest batch in flight.
+    void Dispatch(const vlslam_pb::BoundingBoxList &bboxlist);
+
+    lcm::LCM port_;
+    ShmRingPtr request_ring_, reply_ring_;
+    std::mutex mutex_;
+    vlslam_pb::BoundingBoxList batch_;  // hypotheses gathered since the last flush
+    std::vector<Request> queued_;   // requests of the current batch
+    std::deque<std::vector<Request>> in_flight_;    // flushed batches waiting for a reply
+    std::atomic<bool> running_;
+    std::thread receiver_;
+};
+
+typedef std::shared_ptr<BBoxLikelihoodBatcher> BBoxLikelihoodBatcherPtr;
+
+}   // namespace feh
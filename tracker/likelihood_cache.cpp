@@ -0,0 +1,58 @@
+#include "likelihood_cache.h"
+
+// stl
+#include <cmath>
+
+// 3rd party
+#include "glog/logging.h"
+
+namespace feh {
+
+void LikelihoodCache::Reset(const std::vector<Vec4f> &bin_size) {
+    entries_.clear();
+    hits_ = 0;
+    misses_ = 0;
+    bin_size_ = bin_size;
+    azimuth_bins_.resize(bin_size_.size());
+    for (int level = 0; level < bin_size_.size(); ++level) {
+        CHECK(bin_size_[level].minCoeff() > 0) << "bin size must be positive";
+        azimuth_bins_[level] = std::max(1, (int)std::round(2 * M_PI / bin_size_[level](3)));
+        bin_size_[level](3) = 2 * M_PI / azimuth_bins_[level];
+    }
+}
+
+LikelihoodCache::Key LikelihoodCache::Quantize(int shape_id, int level, const Vec4f &v, Vec4f *center) const {
+    CHECK_LT(level, bin_size_.size());
+    const Vec4f &size = bin_size_[level];
+    Key key{shape_id, level, {0, 0, 0, 0}};
+    for (int i = 0; i < 3; ++i) {
+        key.bin[i] = std::floor(v(i) / size(i));
+    }
+    // azimuth wraps around
+    int n = azimuth_bins_[level];
+    key.bin[3] = ((int)std::floor(v(3) / size(3)) % n + n) % n;
+    if (center) {
+        for (int i = 0; i < 4; ++i) (*center)(i) = (key.bin[i] + 0.5f) * size(i);
+    }
+    return key;
+}
+
+bool LikelihoodCache::Find(const Key &key, Score &score) const {
+    auto it = entries_.find(key);
+    if (it == entries_.end()) return false;
+    score = it->second;
+    return true;
+}
+
+void LikelihoodCache::Insert(const Key &key, const Score &score) {
+    // concurrent misses of the same bin compute the same score, the first insertion wins
+    entries_.insert({key, score});
+}
+
+size_t LikelihoodCache::KeyHash::operator()(const Key &key) const {
+    size_t h = std::hash<int>()(key.shape_id) * 31 + std::hash<int>()(key.level);
+    for (int b : key.bin) h = h * 1000003 ^ std::hash<int>()(b);
+    return h;
+}
+
+}   // namespace feh
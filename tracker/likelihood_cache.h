@@ -0,0 +1,68 @@
+//
+// Memoization of likelihood evaluation within a frame.
+//
+#pragma once
+// stl
+#include <array>
+#include <atomic>
+#include <vector>
+
+// 3rd party
+#include "tbb/concurrent_unordered_map.h"
+
+// own
+#include "alias.h"
+
+namespace feh {
+
+/// \brief: Per frame cache of one dimensional search scores keyed by (shape id, level,
+/// quantized state). Poses are snapped to the center of their bin before scoring, such
+/// that the cached score does not depend on which particle reaches the bin first and
+/// results stay independent of the number of likelihood workers.
+/// Lookup and insertion are thread-safe, the rest is not.
+class LikelihoodCache {
+public:
+    // [match_ratio, average_match_distance, tl_x, tl_y, br_x, br_y], see Tracker::OneDimSearchScore
+    typedef std::array<float, 6> Score;
+    struct Key {
+        int shape_id;
+        int level;
+        std::array<int, 4> bin;
+        bool operator==(const Key &other) const {
+            return shape_id == other.shape_id && level == other.level && bin == other.bin;
+        }
+    };
+
+    LikelihoodCache(): hits_(0), misses_(0) {}
+
+    /// \brief: Drop all the entries and statistics, and set the bin size of each level.
+    /// \param bin_size: bin size of (x, y, log-depth, azimuth) per level.
+    void Reset(const std::vector<Vec4f> &bin_size);
+    /// \brief: Key of the bin containing the state, state is (x, y, log-depth, azimuth).
+    /// \param center: center of the bin, i.e., the pose to be scored.
+    Key Quantize(int shape_id, int level, const Vec4f &v, Vec4f *center) const;
+    /// \brief: Return true and fill the score if the bin has been scored.
+    bool Find(const Key &key, Score &score) const;
+    void Insert(const Key &key, const Score &score);
+    /// \brief: Count lookups for the hit rate, a hit is a pose which is not rendered.
+    void Record(int hits, int misses) {
+        hits_ += hits;
+        misses_ += misses;
+    }
+
+    struct KeyHash {
+        size_t operator()(const Key &key) const;
+    };
+
+    int hits() const { return hits_; }
+    int misses() const { return misses_; }
+    float hit_rate() const { return hits_ / (hits_ + misses_ + eps); }
+
+private:
+    tbb::concurrent_unordered_map<Key, Score, KeyHash> entries_;
+    std::vector<Vec4f> bin_size_;
+    std::vector<int> azimuth_bins_;   // bins tile the circle
+    std::atomic<int> hits_, misses_;
+};
+
+}   // namespace feh
@@ -0,0 +1,322 @@
+#include "mesh_simplification.h"
+
+// stl
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <queue>
+
+// 3rd party
+#include "Eigen/LU"
+#include "Eigen/StdVector"
+#include "glog/logging.h"
+#include "opencv2/imgproc/imgproc.hpp"
+
+// own
+#include "renderer.h"
+
+namespace feh {
+
+namespace {
+// weight of the planes perpendicular to boundary edges relative to face planes
+constexpr double kBoundaryWeight = 1000;
+
+struct Collapse {
+    double cost;
+    int v0, v1;     // v1 is merged into v0
+    int version0, version1;
+    Vec3d target;
+    bool operator>(const Collapse &other) const { return cost > other.cost; }
+};
+
+/// \brief: Edge collapse simplifier, faces are kept in place and marked dead when collapsed,
+/// vertices merged away are marked removed. Stale collapses in the queue are detected by
+/// per-vertex version counters.
+class EdgeCollapser {
+public:
+    EdgeCollapser(const MatXf &V, const MatXi &F);
+    void Run(int target_faces);
+    void Output(MatXf &V_out, MatXi &F_out) const;
+
+private:
+    Collapse Evaluate(int v0, int v1) const;
+    /// \brief: Reject collapses which change topology (link condition) or flip faces.
+    bool IsValid(const Collapse &collapse) const;
+    void Apply(const Collapse &collapse);
+    void PushEdges(int v);
+    std::vector<int> Neighbors(int v) const;
+    bool HasVertex(int f, int v) const {
+        return faces_[f][0] == v || faces_[f][1] == v || faces_[f][2] == v;
+    }
+    Vec3d FaceNormal(int f, int moved, const Vec3d &target) const;
+
+    std::vector<Vec3d> pos_;
+    std::vector<Mat4d, Eigen::aligned_allocator<Mat4d>> quadrics_;
+    std::vector<std::array<int, 3>> faces_;
+    std::vector<bool> face_alive_;
+    std::vector<bool> removed_;
+    std::vector<int> version_;
+    std::vector<std::vector<int>> vertex_faces_;
+    int num_alive_faces_;
+    std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> queue_;
+};
+
+EdgeCollapser::EdgeCollapser(const MatXf &V, const MatXi &F):
+    pos_(V.rows()),
+    quadrics_(V.rows(), Mat4d::Zero()),
+    faces_(F.rows()),
+    face_alive_(F.rows(), false),
+    removed_(V.rows(), false),
+    version_(V.rows(), 0),
+    vertex_faces_(V.rows()),
+    num_alive_faces_(0) {
+    for (int i = 0; i < V.rows(); ++i) {
+        pos_[i] = V.row(i).transpose().cast<double>();
+    }
+    // face quadrics weighted by area
+    std::vector<Vec3d> normals(F.rows(), Vec3d::Zero());
+    for (int f = 0; f < F.rows(); ++f) {
+        std::array<int, 3> face{F(f, 0), F(f, 1), F(f, 2)};
+        faces_[f] = face;
+        if (face[0] == face[1] || face[1] == face[2] || face[0] == face[2]) continue;
+        Vec3d n = (pos_[face[1]] - pos_[face[0]]).cross(pos_[face[2]] - pos_[face[0]]);
+        double area2 = n.norm();
+        face_alive_[f] = true;
+        ++num_alive_faces_;
+        for (int v : face) vertex_faces_[v].push_back(f);
+        if (area2 == 0) continue;
+        n /= area2;
+        normals[f] = n;
+        Vec4d plane(n(0), n(1), n(2), -n.dot(pos_[face[0]]));
+        Mat4d K = 0.5 * area2 * plane * plane.transpose();
+        for (int v : face) quadrics_[v] += K;
+    }
+    // edges with the faces they belong to, boundary edges belong to a single face
+    std::vector<std::array<int, 3>> edges;  // (min vertex, max vertex, face)
+    for (int f = 0; f < F.rows(); ++f) {
+        if (!face_alive_[f]) continue;
+        for (int k = 0; k < 3; ++k) {
+            int a = faces_[f][k], b = faces_[f][(k + 1) % 3];
+            edges.push_back({std::min(a, b), std::max(a, b), f});
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+    for (int i = 0; i < edges.size(); ) {
+        int j = i;
+        while (j < edges.size() && edges[j][0] == edges[i][0] && edges[j][1] == edges[i][1]) ++j;
+        int a = edges[i][0], b = edges[i][1];
+        if (j - i == 1) {
+            // plane through the boundary edge, perpendicular to its face
+            Vec3d e = pos_[b] - pos_[a];
+            Vec3d n = e.cross(normals[edges[i][2]]);
+            if (n.norm() > 0) {
+                n.normalize();
+                Vec4d plane(n(0), n(1), n(2), -n.dot(pos_[a]));
+                Mat4d K = kBoundaryWeight * e.squaredNorm() * plane * plane.transpose();
+                quadrics_[a] += K;
+                quadrics_[b] += K;
+            }
+        }
+        queue_.push(Evaluate(a, b));
+        i = j;
+    }
+}
+
+Collapse EdgeCollapser::Evaluate(int v0, int v1) const {
+    Mat4d Q = quadrics_[v0] + quadrics_[v1];
+    const Vec3d &p0 = pos_[v0];
+    const Vec3d &p1 = pos_[v1];
+    std::vector<Vec3d> candidates{p0, p1, 0.5 * (p0 + p1)};
+    Eigen::FullPivLU<Mat3d> lu(Q.topLeftCorner<3, 3>());
+    if (lu.isInvertible()) {
+        Vec3d x = lu.solve(-Q.topRightCorner<3, 1>());
+        // keep the optimal position local to the edge
+        if ((x - candidates[2]).norm() <= (p1 - p0).norm()) candidates.push_back(x);
+    }
+    Collapse collapse;
+    collapse.cost = std::numeric_limits<double>::max();
+    for (const auto &x : candidates) {
+        Vec4d h(x(0), x(1), x(2), 1);
+        double cost = h.dot(Q * h);
+        if (cost < collapse.cost) {
+            collapse.cost = cost;
+            collapse.target = x;
+        }
+    }
+    collapse.v0 = v0;
+    collapse.v1 = v1;
+    collapse.version0 = version_[v0];
+    collapse.version1 = version_[v1];
+    return collapse;
+}
+
+std::vector<int> EdgeCollapser::Neighbors(int v) const {
+    std::vector<int> neighbors;
+    for (int f : vertex_faces_[v]) {
+        if (!face_alive_[f]) continue;
+        for (int u : faces_[f]) {
+            if (u != v) neighbors.push_back(u);
+        }
+    }
+    std::sort(neighbors.begin(), neighbors.end());
+    neighbors.erase(std::unique(neighbors.begin(), neighbors.end()), neighbors.end());
+    return neighbors;
+}
+
+Vec3d EdgeCollapser::FaceNormal(int f, int moved, const Vec3d &target) const {
+    Vec3d p[3];
+    for (int k = 0; k < 3; ++k) {
+        p[k] = faces_[f][k] == moved ? target : pos_[faces_[f][k]];
+    }
+    return (p[1] - p[0]).cross(p[2] - p[0]);
+}
+
+bool EdgeCollapser::IsValid(const Collapse &collapse) const {
+    int v0 = collapse.v0, v1 = collapse.v1;
+    // link condition: the common neighbors are exactly the opposite vertices of the shared faces
+    int shared_faces(0);
+    for (int f : vertex_faces_[v0]) {
+        if (face_alive_[f] && HasVertex(f, v1)) ++shared_faces;
+    }
+    if (shared_faces == 0) return false;
+    std::vector<int> n0 = Neighbors(v0), n1 = Neighbors(v1), common;
+    std::set_intersection(n0.begin(), n0.end(), n1.begin(), n1.end(), std::back_inserter(common));
+    if (common.size() != shared_faces) return false;
+
+    // faces which survive the collapse must not flip or degenerate
+    for (int v : {v0, v1}) {
+        for (int f : vertex_faces_[v]) {
+            if (!face_alive_[f] || (HasVertex(f, v0) && HasVertex(f, v1))) continue;
+            Vec3d n_old = FaceNormal(f, -1, collapse.target);
+            Vec3d n_new = FaceNormal(f, v, collapse.target);
+            if (n_new.squaredNorm() == 0 || n_new.dot(n_old) <= 0) return false;
+        }
+    }
+    return true;
+}
+
+void EdgeCollapser::Apply(const Collapse &collapse) {
+    int v0 = collapse.v0, v1 = collapse.v1;
+    pos_[v0] = collapse.target;
+    quadrics_[v0] += quadrics_[v1];
+    removed_[v1] = true;
+    for (int f : vertex_faces_[v1]) {
+        if (!face_alive_[f]) continue;
+        if (HasVertex(f, v0)) {
+            face_alive_[f] = false;
+            --num_alive_faces_;
+        } else {
+            for (int &u : faces_[f]) {
+                if (u == v1) u = v0;
+            }
+            vertex_faces_[v0].push_back(f);
+        }
+    }
+    vertex_faces_[v1].clear();
+    auto &incident = vertex_faces_[v0];
+    incident.erase(std::remove_if(incident.begin(), incident.end(),
+                                  [this](int f) { return !face_alive_[f]; }),
+                   incident.end());
+    ++version_[v0];
+    PushEdges(v0);
+}
+
+void EdgeCollapser::PushEdges(int v) {
+    for (int u : Neighbors(v)) {
+        queue_.push(Evaluate(v, u));
+    }
+}
+
+void EdgeCollapser::Run(int target_faces) {
+    while (num_alive_faces_ > target_faces && !queue_.empty()) {
+        Collapse collapse = queue_.top();
+        queue_.pop();
+        if (removed_[collapse.v0] || removed_[collapse.v1]
+            || version_[collapse.v0] != collapse.version0
+            || version_[collapse.v1] != collapse.version1) continue;
+        // rejected collapses are evaluated again once their neighborhood changes
+        if (!IsValid(collapse)) continue;
+        Apply(collapse);
+    }
+}
+
+void EdgeCollapser::Output(MatXf &V_out, MatXi &F_out) const {
+    std::vector<int> index(pos_.size(), -1);
+    int num_vertices(0);
+    for (int f = 0; f < faces_.size(); ++f) {
+        if (!face_alive_[f]) continue;
+        for (int v : faces_[f]) {
+            if (index[v] < 0) index[v] = num_vertices++;
+        }
+    }
+    V_out.resize(num_vertices, 3);
+    for (int v = 0; v < pos_.size(); ++v) {
+        if (index[v] >= 0) V_out.row(index[v]) = pos_[v].cast<float>().transpose();
+    }
+    F_out.resize(num_alive_faces_, 3);
+    int k(0);
+    for (int f = 0; f < faces_.size(); ++f) {
+        if (!face_alive_[f]) continue;
+        F_out.row(k++) << index[faces_[f][0]], index[faces_[f][1]], index[faces_[f][2]];
+    }
+}
+}   // namespace
+
+
+void SimplifyMesh(const MatXf &V, const MatXi &F, int target_faces,
+                  MatXf &V_out, MatXi &F_out) {
+    CHECK_EQ(V.cols(), 3);
+    CHECK_EQ(F.cols(), 3);
+    if (F.rows() <= target_faces) {
+        V_out = V;
+        F_out = F;
+        return;
+    }
+    EdgeCollapser collapser(V, F);
+    collapser.Run(target_faces);
+    collapser.Output(V_out, F_out);
+    LOG(INFO) << "mesh simplified from " << F.rows() << " to " << F_out.rows() << " faces";
+}
+
+
+float SilhouetteError(const MatXf &V, const MatXi &F,
+                      const MatXf &V_lod, const MatXi &F_lod,
+                      int rows, int cols, const float *intrinsics,
+                      float z_near, float z_far, float depth, int num_views) {
+    Renderer reference(rows, cols, RenderBackend::SOFTWARE);
+    Renderer simplified(rows, cols, RenderBackend::SOFTWARE);
+    reference.SetMesh(V, F);
+    simplified.SetMesh(V_lod, F_lod);
+    for (Renderer *render : {&reference, &simplified}) {
+        render->SetCamera(z_near, z_far, intrinsics);
+        render->SetCamera(Eigen::Matrix<float, 4, 4, Eigen::ColMajor>::Identity());
+    }
+
+    cv::Mat reference_mask(rows, cols, CV_8UC1), simplified_mask(rows, cols, CV_8UC1);
+    cv::Mat object, eroded;
+    float max_error(0);
+    for (float elevation : {-0.5f, 0.0f, 0.5f}) {
+        for (int i = 0; i < num_views; ++i) {
+            Eigen::Matrix<float, 4, 4, Eigen::ColMajor> model;
+            model.setIdentity();
+            model.block<3, 3>(0, 0) = (Eigen::AngleAxisf(elevation, Eigen::Vector3f::UnitX())
+                * Eigen::AngleAxisf(2 * M_PI * i / num_views, Eigen::Vector3f::UnitY())).toRotationMatrix();
+            model(2, 3) = depth;
+            reference.RenderMask(model, reference_mask);
+            simplified.RenderMask(model, simplified_mask);
+
+            int discrepancy = cv::countNonZero(reference_mask != simplified_mask);
+            // boundary length: object pixels with at least one background neighbor
+            object = reference_mask == 0;
+            cv::erode(object, eroded, cv::getStructuringElement(cv::MORPH_CROSS, cv::Size(3, 3)));
+            int boundary = cv::countNonZero(object) - cv::countNonZero(eroded);
+            max_error = std::max(max_error, discrepancy / (boundary + eps));
+        }
+    }
+    return max_error;
+}
+
+}   // namespace feh
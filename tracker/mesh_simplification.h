@@ -0,0 +1,32 @@
+//
+// Level of detail of meshes for inference on coarse pyramid levels.
+//
+#pragma once
+// stl
+#include <vector>
+
+// own
+#include "alias.h"
+
+namespace feh {
+
+/// \brief: Quadric error metric simplification (Garland & Heckbert) by edge collapse.
+/// Open boundaries are preserved by penalizing planes perpendicular to boundary edges,
+/// collapses which flip faces or change topology are rejected.
+/// \param V, F: input mesh, vertices and faces are rows.
+/// \param target_faces: stop once the number of faces drops to this number.
+/// \param V_out, F_out: simplified mesh, unreferenced vertices are removed.
+void SimplifyMesh(const MatXf &V, const MatXi &F, int target_faces,
+                  MatXf &V_out, MatXi &F_out);
+
+/// \brief: Silhouette discrepancy between a mesh and its simplification, measured as
+/// the area of the symmetric difference of the two masks divided by the length of the
+/// reference silhouette boundary, i.e., the average boundary displacement in pixels.
+/// Masks are rendered with the software rasterizer from num_views azimuths at three
+/// elevations with the object at the given depth, the maximum over views is returned.
+float SilhouetteError(const MatXf &V, const MatXi &F,
+                      const MatXf &V_lod, const MatXi &F_lod,
+                      int rows, int cols, const float *intrinsics,
+                      float z_near, float z_far, float depth, int num_views=8);
+
+}   // namespace feh
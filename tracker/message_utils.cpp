@@ -64,4 +64,46 @@ std::vector<Vec2> KeypointsFromBox(const vlslam_pb::NewBox &box, int rows, int c
   return out;
 }
 
+size_t FrameMessageSize(const cv::Mat &image, size_t payload_size) {
+  return sizeof(FrameHeader) + image.rows * image.cols * image.elemSize() + payload_size;
+}
+
+size_t WriteFrameMessage(const cv::Mat &image, const google::protobuf::MessageLite *message,
+                         uint8_t *slot, size_t capacity) {
+  size_t payload_size = message ? message->ByteSize() : 0;
+  size_t size = FrameMessageSize(image, payload_size);
+  if (size > capacity) return 0;
+  FrameHeader *header = reinterpret_cast<FrameHeader *>(slot);
+  header->rows = image.rows;
+  header->cols = image.cols;
+  header->type = image.type();
+  header->step = image.cols * image.elemSize();
+  header->payload_size = payload_size;
+  // rows are packed, such that the reader gets a continuous image
+  cv::Mat pixels(image.rows, image.cols, image.type(), slot + sizeof(FrameHeader), header->step);
+  image.copyTo(pixels);
+  if (message) message->SerializeToArray(slot + size - payload_size, payload_size);
+  return size;
+}
+
+bool ReadFrameMessage(const uint8_t *slot, size_t size, cv::Mat &image,
+                      const uint8_t **payload, size_t *payload_size) {
+  if (size < sizeof(FrameHeader)) return false;
+  // written by another process, every field is checked before the pixels are viewed
+  const FrameHeader *header = reinterpret_cast<const FrameHeader *>(slot);
+  if (header->rows < 0 || header->cols < 0) return false;
+  if (header->type < 0 || header->type != CV_MAT_TYPE(header->type)
+      || CV_MAT_DEPTH(header->type) > CV_64F) return false;
+  if (header->step < (uint64_t)header->cols * CV_ELEM_SIZE(header->type)) return false;
+  // no overflow: rows & step are below 2^32
+  uint64_t image_size = (uint64_t)header->rows * header->step;
+  if (header->payload_size > size - sizeof(FrameHeader)
+      || image_size != size - sizeof(FrameHeader) - header->payload_size) return false;
+  image = cv::Mat(header->rows, header->cols, header->type,
+                  const_cast<uint8_t *>(slot) + sizeof(FrameHeader), header->step);
+  *payload = slot + sizeof(FrameHeader) + image_size;
+  *payload_size = header->payload_size;
+  return true;
+}
+
 }
@@ -20,5 +20,25 @@ cv::Mat DrawBoxList(const cv::Mat &image, const vlslam_pb::NewBoxList &boxlist);
 
 std::vector<Vec2> KeypointsFromBox(const vlslam_pb::NewBox &box, int rows=500, int cols=960);
 
+/// \brief: Frame message in a shared memory slot: this header, the pixels (rows x step bytes),
+/// then a serialized protobuf message, e.g., the hypotheses to score on the frame.
+struct FrameHeader {
+    int32_t rows, cols, type;   // type of cv::Mat
+    uint32_t step;
+    uint64_t payload_size;
+};
+/// \brief: Size of the frame message of the given image and payload.
+size_t FrameMessageSize(const cv::Mat &image, size_t payload_size);
+/// \brief: Write the image and the message in place into a slot.
+/// \param message: null for none.
+/// \return: number of bytes written, 0 if the slot is too small.
+size_t WriteFrameMessage(const cv::Mat &image, const google::protobuf::MessageLite *message,
+                         uint8_t *slot, size_t capacity);
+/// \brief: Views into a frame message, the image header refers to the pixels in the slot.
+/// \return: false if the message is malformed, i.e., the header does not describe a valid
+/// image whose pixels & payload exactly fill the message.
+bool ReadFrameMessage(const uint8_t *slot, size_t size, cv::Mat &image,
+                      const uint8_t **payload, size_t *payload_size);
+
 } // namespace feh
 
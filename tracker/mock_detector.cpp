@@ -0,0 +1,241 @@
+#include "mock_detector.h"
+
+// stl
+#include <algorithm>
+#include <cmath>
+
+// 3rd party
+#include "glog/logging.h"
+#include "zmqpp/zmqpp.hpp"
+#include "opencv2/core/core.hpp"
+
+// own
+#include "utils.h"
+#include "philox.h"
+#include "message_utils.h"
+#include "shm_ring.h"
+
+namespace feh {
+
+namespace {
+// polling interval of the servers, bounds the time to stop
+constexpr int kReceiveTimeoutMs = 50;
+// independent random streams of the same seed
+enum Stream : uint64_t {
+    kScoreStream = 0,
+    kLatencyStream = 1,
+    kDetectionStream = 2
+};
+
+uint64_t StreamKey(uint64_t seed, Stream stream) {
+    return seed + (uint64_t(stream) << 48);
+}
+}   // namespace
+
+MockDetector::MockDetector(const Json::Value &config):
+    config_(config),
+    seed_(config.get("seed", 0).asUInt64()),
+    latency_us_(config.get("latency_ms", 0).asFloat() * 1000),
+    jitter_us_(config.get("jitter_ms", 0).asFloat() * 1000),
+    score_min_(0),
+    score_max_(1),
+    num_detections_(config.get("num_detections", 1).asInt()),
+    rows_(500),
+    cols_(960),
+    running_(false),
+    requests_(0),
+    lcm_requests_(0) {
+    if (config.isMember("score_range")) {
+        score_min_ = config["score_range"][0].asFloat();
+        score_max_ = config["score_range"][1].asFloat();
+    }
+    CHECK_LE(score_min_, score_max_);
+    if (config.isMember("camera_config")) {
+        auto cam_cfg = LoadJson(config["camera_config"].asString());
+        rows_ = cam_cfg["rows"].asInt();
+        cols_ = cam_cfg["cols"].asInt();
+    }
+}
+
+MockDetector::~MockDetector() {
+    Stop();
+}
+
+void MockDetector::Start() {
+    CHECK(!running_) << "already serving";
+    running_ = true;
+    if (config_.get("lcm", true).asBool()) {
+        CHECK(port_.good()) << "failed to setup LCM port";
+        threads_.emplace_back(&MockDetector::ServeLCM, this);
+    }
+    if (config_.get("port", 0).asInt() > 0) {
+        threads_.emplace_back(&MockDetector::ServeZMQ, this);
+    }
+    std::string shm_batch = config_.get("shm_batch", "").asString();
+    if (!shm_batch.empty()) {
+        threads_.emplace_back(&MockDetector::ServeShm, this, shm_batch, false);
+    }
+    std::string shm_detection = config_.get("shm_detection", "").asString();
+    if (!shm_detection.empty()) {
+        threads_.emplace_back(&MockDetector::ServeShm, this, shm_detection, true);
+    }
+}
+
+void MockDetector::Stop() {
+    running_ = false;
+    for (auto &thread : threads_) thread.join();
+    threads_.clear();
+}
+
+float MockDetector::Score(const vlslam_pb::BoundingBox &bbox) const {
+    // keyed by the pixel coordinates, such that identical hypotheses get identical scores
+    Philox::Block counter{uint32_t(std::lround(bbox.top_left_x())),
+                          uint32_t(std::lround(bbox.top_left_y())),
+                          uint32_t(std::lround(bbox.bottom_right_x())),
+                          uint32_t(std::lround(bbox.bottom_right_y()))};
+    float u = Philox::ToUniform(Philox::Generate(StreamKey(seed_, kScoreStream), counter)[0]);
+    return score_min_ + (score_max_ - score_min_) * u;
+}
+
+vlslam_pb::BoundingBoxList MockDetector::ScoreBoxes(const vlslam_pb::BoundingBoxList &request) const {
+    vlslam_pb::BoundingBoxList reply(request);
+    for (auto &bbox : *reply.mutable_bounding_boxes()) {
+        bbox.add_scores(Score(bbox));
+    }
+    return reply;
+}
+
+vlslam_pb::NewBoxList MockDetector::Detect(uint64_t frame, int rows, int cols) const {
+    vlslam_pb::NewBoxList boxlist;
+    for (int i = 0; i < num_detections_; ++i) {
+        Philox rng(StreamKey(seed_, kDetectionStream), frame, frame >> 32, i);
+        float width = cols * (0.2 + 0.3 * rng.Uniform());
+        float height = rows * (0.3 + 0.4 * rng.Uniform());
+        float x0 = (cols - width) * rng.Uniform();
+        float y0 = (rows - height) * rng.Uniform();
+        auto box = boxlist.add_boxes();
+        box->set_top_left_x(x0);
+        box->set_top_left_y(y0);
+        box->set_bottom_right_x(x0 + width);
+        box->set_bottom_right_y(y0 + height);
+        box->set_scores(score_min_ + (score_max_ - score_min_) * rng.Uniform());
+        box->set_label(0);
+        box->set_class_name("chair");
+        // corners of a cuboid seen from the front: the near face spans the box,
+        // the far face is shrunk towards the center, then the center itself
+        float cx = x0 + 0.5 * width, cy = y0 + 0.5 * height;
+        for (int ix = 0; ix < 2; ++ix)
+            for (int iy = 0; iy < 2; ++iy)
+                for (int iz = 0; iz < 2; ++iz) {
+                    float shrink = iz ? 0.8 : 1.0;
+                    box->add_keypoints((cx + (ix ? 0.5 : -0.5) * width * shrink) / cols);
+                    box->add_keypoints((cy + (iy ? 0.5 : -0.5) * height * shrink) / rows);
+                }
+        box->add_keypoints(cx / cols);
+        box->add_keypoints(cy / rows);
+    }
+    return boxlist;
+}
+
+int MockDetector::LatencyUs(uint64_t request) const {
+    Philox rng(StreamKey(seed_, kLatencyStream), request, request >> 32);
+    int latency = latency_us_ + std::lround(jitter_us_ * (2 * rng.Uniform() - 1));
+    return std::max(latency, 0);
+}
+
+void MockDetector::Delay(uint64_t request, std::chrono::steady_clock::time_point start) const {
+    std::this_thread::sleep_until(start + std::chrono::microseconds(LatencyUs(request)));
+}
+
+void MockDetector::ServeLCM() {
+    port_.subscribe("bbox", &MockDetector::HandleLCM, this);
+    port_.subscribe("bbox_batch", &MockDetector::HandleLCM, this);
+    while (running_) {
+        if (port_.handleTimeout(kReceiveTimeoutMs) < 0) {
+            LOG(ERROR) << "failed to receive hypotheses";
+            break;
+        }
+    }
+}
+
+void MockDetector::HandleLCM(const lcm::ReceiveBuffer *rawbuf, const std::string &channel) {
+    auto start = std::chrono::steady_clock::now();
+    vlslam_pb::BoundingBoxList request;
+    if (!request.ParseFromArray(rawbuf->data, rawbuf->data_size)) {
+        LOG(WARNING) << "malformed message on " << channel;
+        return;
+    }
+    // the description, i.e., tracker id & image path, and the ids of the batch are kept
+    vlslam_pb::BoundingBoxList reply = ScoreBoxes(request);
+    Delay(lcm_requests_++, start);
+    std::vector<uint8_t> send_data(reply.ByteSize());
+    reply.SerializeToArray(send_data.data(), send_data.size());
+    port_.publish(channel == "bbox" ? "likelihood" : "likelihood_batch", send_data.data(), send_data.size());
+    ++requests_;
+}
+
+void MockDetector::ServeZMQ() {
+    zmqpp::context context;
+    zmqpp::socket socket(context, zmqpp::socket_type::reply);
+    socket.set(zmqpp::socket_option::receive_timeout, kReceiveTimeoutMs);
+    socket.bind("tcp://*:" + std::to_string(config_["port"].asInt()));
+    for (uint64_t n = 0; running_; ) {
+        zmqpp::message msg;
+        if (!socket.receive(msg)) continue;
+        auto start = std::chrono::steady_clock::now();
+        if (msg.parts() != 1 || msg.size(0) != size_t(rows_ * cols_ * 3)) {
+            LOG(WARNING) << "unexpected frame of " << (msg.parts() ? msg.size(0) : 0) << " bytes";
+        }
+        vlslam_pb::NewBoxList boxlist = Detect(n, rows_, cols_);
+        Delay(n++, start);
+        std::string reply;
+        boxlist.SerializeToString(&reply);
+        socket.send(reply);
+        ++requests_;
+    }
+}
+
+void MockDetector::ServeShm(const std::string &name, bool detection) {
+    // the rings are created by the client
+    ShmRingPtr request_ring, reply_ring;
+    while (running_ && !(request_ring && reply_ring)) {
+        if (!request_ring) request_ring = ShmRing::Open(name + "_request");
+        if (!reply_ring) reply_ring = ShmRing::Open(name + "_reply");
+        std::this_thread::sleep_for(std::chrono::milliseconds(kReceiveTimeoutMs));
+    }
+    for (uint64_t n = 0; running_; ) {
+        size_t size;
+        const uint8_t *data = request_ring->Acquire(&size, kReceiveTimeoutMs);
+        if (!data) continue;
+        auto start = std::chrono::steady_clock::now();
+        cv::Mat image;
+        const uint8_t *payload;
+        size_t payload_size;
+        std::string reply;
+        if (!ReadFrameMessage(data, size, image, &payload, &payload_size)) {
+            LOG(WARNING) << "malformed frame message on " << name;
+        } else if (detection) {
+            Detect(n, image.rows, image.cols).SerializeToString(&reply);
+        } else {
+            vlslam_pb::BoundingBoxList request;
+            if (!request.ParseFromArray(payload, payload_size)) {
+                LOG(WARNING) << "malformed box list on " << name;
+                request.Clear();
+            }
+            // a malformed request is still answered, the client matches replies in order
+            ScoreBoxes(request).SerializeToString(&reply);
+        }
+        // the frame is held in place while it is "processed"
+        Delay(n++, start);
+        request_ring->Release();
+        uint8_t *slot = nullptr;
+        while (running_ && !(slot = reply_ring->Reserve(kReceiveTimeoutMs))) {}
+        if (!slot) break;
+        CHECK_LE(reply.size(), reply_ring->slot_size()) << "reply exceeds the slot of " << name;
+        std::copy(reply.begin(), reply.end(), slot);
+        reply_ring->Commit(reply.size());
+        ++requests_;
+    }
+}
+
+}   // namespace feh
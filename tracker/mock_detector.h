@@ -0,0 +1,77 @@
+//
+// Deterministic stand-in for the detector process, for benchmarking the transports.
+//
+#pragma once
+// stl
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 3rd party
+#include "json/json.h"
+#include "lcm/lcm-cpp.hpp"
+
+// own
+#include "vlslam.pb.h"
+
+namespace feh {
+
+/// \brief: Speaks the protocols of the detector without running a CNN:
+/// - LCM "bbox" -> "likelihood": the per-tracker hypotheses, description echoed.
+/// - LCM "bbox_batch" -> "likelihood_batch": the scene-wide batch, tracker & particle ids kept.
+/// - ZMQ REQ/REP: raw pixels in, NewBoxList out.
+/// - Shared memory rings: frame messages with an optional box list, see WriteFrameMessage.
+/// Scores are a pure function of the box and the seed, and the latency of the n-th request
+/// of a transport is a pure function of n and the seed, such that runs are reproducible.
+/// Each transport is served on its own thread, requests of a transport are served in order.
+class MockDetector {
+public:
+    explicit MockDetector(const Json::Value &config);
+    ~MockDetector();
+    MockDetector(const MockDetector &) = delete;
+    MockDetector &operator=(const MockDetector &) = delete;
+
+    /// \brief: Serve the transports enabled in the configuration.
+    void Start();
+    /// \brief: Stop serving and join the threads.
+    void Stop();
+
+    /// \brief: Score of a hypothesis, in [score_min, score_max).
+    float Score(const vlslam_pb::BoundingBox &bbox) const;
+    /// \brief: Copy of the request with one score appended to each box.
+    vlslam_pb::BoundingBoxList ScoreBoxes(const vlslam_pb::BoundingBoxList &request) const;
+    /// \brief: Detections of the n-th frame, with 9 keypoints each, normalized by the image
+    /// size and ordered as GenerateControlPoints, such that Initialize can be run on them.
+    vlslam_pb::NewBoxList Detect(uint64_t frame, int rows, int cols) const;
+    /// \brief: Simulated processing time of the n-th request.
+    int LatencyUs(uint64_t request) const;
+
+    /// \brief: Number of requests served over all the transports.
+    uint64_t requests() const { return requests_; }
+
+private:
+    void ServeLCM();
+    void HandleLCM(const lcm::ReceiveBuffer *rawbuf, const std::string &channel);
+    void ServeZMQ();
+    /// \param detection: NewBoxList replies as the ZMQ protocol, scored box lists otherwise.
+    void ServeShm(const std::string &name, bool detection);
+    /// \brief: Sleep the remainder of the latency of the n-th request received at start.
+    void Delay(uint64_t request, std::chrono::steady_clock::time_point start) const;
+
+    Json::Value config_;
+    uint64_t seed_;
+    int latency_us_, jitter_us_;
+    float score_min_, score_max_;
+    int num_detections_;
+    int rows_, cols_;   // image size of the ZMQ protocol, which only carries pixels
+    std::atomic<bool> running_;
+    std::atomic<uint64_t> requests_;
+    lcm::LCM port_;
+    uint64_t lcm_requests_;     // served on the LCM thread only
+    std::vector<std::thread> threads_;
+};
+
+}   // namespace feh
@@ -4,6 +4,10 @@
 #include "oned_search.h"
 #include "bresenham.h"
 
+// stl
+#include <cmath>
+#include <cstring>
+
 // 3rd party
 #include "opencv2/imgproc/imgproc.hpp"
 #include "opencv2/highgui/highgui.hpp"
@@ -397,5 +401,127 @@ void OneDimSearch::Parallel(const std::vector<EdgePixel> &edgelist,
 }
 
 
+namespace {
+float MatchDistance(const EdgePixel &e) { return e.depth; }
+float MatchDistance(const PackedEdgePixel &e) { return e.Depth(); }
+
+template <typename EdgePixelT>
+void ReduceEdgelistImpl(const std::vector<EdgePixelT> &edgelist, int rows, int cols,
+                        std::array<float, 6> &score_and_corner) {
+    float total_dist(0);
+    int matches(0);
+    float tl_x(10000), tl_y(10000), br_x(0), br_y(0);
+    for (const auto &edgepixel : edgelist) {
+        float dist = MatchDistance(edgepixel);
+        if (dist >= 0) {
+            total_dist += dist;
+            ++matches;
+        }
+        tl_x = std::min<float>(tl_x, edgepixel.x);
+        tl_y = std::min<float>(tl_y, edgepixel.y);
+        br_x = std::max<float>(br_x, edgepixel.x);
+        br_y = std::max<float>(br_y, edgepixel.y);
+    }
+    score_and_corner[0] = matches / (edgelist.size() + eps);
+    score_and_corner[1] = total_dist / (matches + eps);
+    if (edgelist.empty()) {
+        std::fill(score_and_corner.begin() + 2, score_and_corner.end(), 0);
+    } else {
+        score_and_corner[2] = std::max(0.0f, tl_x);
+        score_and_corner[3] = std::max(0.0f, tl_y);
+        score_and_corner[4] = std::min(cols - 1.0f, br_x);
+        score_and_corner[5] = std::min(rows - 1.0f, br_y);
+    }
+}
+}   // namespace
+
+void ReduceEdgelist(const std::vector<EdgePixel> &edgelist, int rows, int cols,
+                    std::array<float, 6> &score_and_corner) {
+    ReduceEdgelistImpl(edgelist, rows, cols, score_and_corner);
+}
+
+void ReduceEdgelist(const std::vector<PackedEdgePixel> &edgelist, int rows, int cols,
+                    std::array<float, 6> &score_and_corner) {
+    ReduceEdgelistImpl(edgelist, rows, cols, score_and_corner);
+}
+
+
+constexpr float PackedEdgePixel::kDirScale;
+
+uint16_t FloatToHalf(float value) {
+    uint32_t f;
+    memcpy(&f, &value, sizeof(f));
+    uint32_t sign = (f >> 16) & 0x8000;
+    uint32_t mantissa = f & 0x7fffff;
+    int exponent = int((f >> 23) & 0xff);
+    if (exponent == 0xff) {
+        // inf & nan
+        return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+    }
+    exponent = exponent - 127 + 15;
+    if (exponent >= 31) {
+        // overflow
+        return sign | 0x7c00;
+    }
+    if (exponent <= 0) {
+        // subnormal or zero
+        if (exponent < -10) return sign;
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        uint32_t h = mantissa >> shift;
+        uint32_t rem = mantissa & ((1u << shift) - 1);
+        uint32_t half = 1u << (shift - 1);
+        if (rem > half || (rem == half && (h & 1))) ++h;
+        return sign | h;
+    }
+    uint32_t h = sign | (exponent << 10) | (mantissa >> 13);
+    uint32_t rem = mantissa & 0x1fff;
+    // carry might propagate into the exponent, which is the correct rounding
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) ++h;
+    return h;
+}
+
+float HalfToFloat(uint16_t value) {
+    uint32_t sign = uint32_t(value & 0x8000) << 16;
+    uint32_t exponent = (value >> 10) & 0x1f;
+    uint32_t mantissa = value & 0x3ff;
+    if (exponent == 0) {
+        float out = std::ldexp(float(mantissa), -24);
+        return sign ? -out : out;
+    }
+    uint32_t f;
+    if (exponent == 31) {
+        f = sign | 0x7f800000 | (mantissa << 13);
+    } else {
+        f = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    }
+    float out;
+    memcpy(&out, &f, sizeof(f));
+    return out;
+}
+
+PackedEdgePixel PackedEdgePixel::Pack(const EdgePixel &e) {
+    PackedEdgePixel p;
+    p.x = int16_t(e.x);
+    p.y = int16_t(e.y);
+    p.dir = uint16_t(std::round(std::min<float>(std::max<float>(e.dir + M_PI, 0), 2 * M_PI) / kDirScale));
+    p.depth = FloatToHalf(e.depth);
+    return p;
+}
+
+void PackEdgelist(const std::vector<EdgePixel> &edgelist, std::vector<PackedEdgePixel> &packed) {
+    packed.resize(edgelist.size());
+    for (int i = 0; i < edgelist.size(); ++i) {
+        packed[i] = PackedEdgePixel::Pack(edgelist[i]);
+    }
+}
+
+void UnpackEdgelist(const std::vector<PackedEdgePixel> &packed, std::vector<EdgePixel> &edgelist) {
+    edgelist.resize(packed.size());
+    for (int i = 0; i < packed.size(); ++i) {
+        edgelist[i] = packed[i].Unpack();
+    }
+}
+
 }   // feh
 
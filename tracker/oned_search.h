@@ -4,7 +4,9 @@
 #pragma once
 // stl
 #include <vector>
+#include <array>
 #include <iostream>
+#include <cstdint>
 
 // 3rd party
 #include "opencv2/core/core.hpp"
@@ -24,6 +26,44 @@ struct EdgePixel {
 static EdgePixel InvalidEdgePixel() {
     return {-1, -1, -1, -1};
 }
+
+/// \brief: Conversion between single and IEEE half precision floats (round to nearest even).
+uint16_t FloatToHalf(float value);
+float HalfToFloat(uint16_t value);
+
+/// \brief: Compact edge pixel of 8 bytes in which edge lists leave the device:
+/// pixel coordinates as int16, direction in [-pi, pi] quantized to 16 bits and
+/// depth (or matching distance) as half float.
+/// Layout MUST be consistent with pack_edgepixel() in shaders/edgelist.comp,
+/// shaders/oned.comp and shaders/oned_batch.comp.
+struct PackedEdgePixel {
+    int16_t x, y;
+    uint16_t dir;
+    uint16_t depth;
+    static const int DIM = 2;   // number of 32-bit words
+
+    float Dir() const { return dir * kDirScale - M_PI; }
+    float Depth() const { return HalfToFloat(depth); }
+
+    static PackedEdgePixel Pack(const EdgePixel &e);
+    EdgePixel Unpack() const { return {float(x), float(y), Dir(), Depth()}; }
+
+    static constexpr float kDirScale = 2 * M_PI / 65535;
+};
+
+void PackEdgelist(const std::vector<EdgePixel> &edgelist, std::vector<PackedEdgePixel> &packed);
+void UnpackEdgelist(const std::vector<PackedEdgePixel> &packed, std::vector<EdgePixel> &edgelist);
+
+/// \brief: Reduce edge list produced by one dimensional search, where the last
+/// field of each edge pixel is the matching distance (negative if not matched).
+/// Host counterpart of shaders/oned_reduce.comp.
+/// \param rows, cols: image size used to clamp the bounding box.
+/// \param score_and_corner: [matching ratio, average matching distance, tl_x, tl_y, br_x, br_y]
+void ReduceEdgelist(const std::vector<EdgePixel> &edgelist, int rows, int cols,
+                    std::array<float, 6> &score_and_corner);
+void ReduceEdgelist(const std::vector<PackedEdgePixel> &edgelist, int rows, int cols,
+                    std::array<float, 6> &score_and_corner);
+
 struct OneDimSearchMatch {
     OneDimSearchMatch():
         dist_(-1),
@@ -1,6 +1,7 @@
 //
 // Created by feixh on 10/25/17.
 //
+#pragma once
 // stl
 #include <vector>
 #include <memory>
@@ -9,6 +10,8 @@
 #include <fstream>
 #include <string>
 #include <unordered_map>
+#include <limits>
+#include <numeric>
 #include "time.h"
 #include "math.h"
 
@@ -16,13 +19,212 @@
 #include "glog/logging.h"
 #include "mpreal.h"
 #include <Eigen/Dense>
+#include "tbb/parallel_for.h"
 
 
 namespace feh {
 
 static const mpfr::mpreal kParticleMaxWeight = 1e10;
+static const double kParticleMaxLogWeight = std::log(1e10);    // log of kParticleMaxWeight
 
-template <typename T, int DIM=4>
+/// \brief: Weights kept in log space as plain doubles, normalized by log-sum-exp.
+/// Particles stay trivially copyable and no heap allocation happens per weight update.
+struct LogWeightPolicy {
+    typedef double WeightType;  // log of the (un-normalized) weight
+
+    static WeightType FromLog(double log_w) {
+        // an overflowing weight is clamped as in MPFRWeightPolicy
+        return log_w == std::numeric_limits<double>::infinity() ? kParticleMaxLogWeight : log_w;
+    }
+    static WeightType Zero() { return -std::numeric_limits<double>::infinity(); }
+
+    template <typename Iterator>
+    static void Normalize(Iterator first, Iterator last) {
+        double max_log_w = Zero();
+        for (auto it = first; it != last; ++it) max_log_w = std::max(max_log_w, it->w());
+        CHECK(!std::isnan(max_log_w));
+        CHECK(!std::isinf(max_log_w)) << "all the weights are zero";
+        double w(0);
+        for (auto it = first; it != last; ++it) w += std::exp(it->w() - max_log_w);
+        double log_sum = max_log_w + std::log(w);
+        for (auto it = first; it != last; ++it) it->set_nw(std::exp(it->w() - log_sum));
+    }
+};
+
+/// \brief: Weights in arbitrary precision, kept to validate the log space weights against.
+struct MPFRWeightPolicy {
+    typedef mpfr::mpreal WeightType;    // (un-normalized) weight
+
+    static WeightType FromLog(double log_w) {
+        WeightType w = mpfr::exp(log_w);
+        // FIXME: need to use best rounding method
+        if (mpfr::isinf(w)) w = kParticleMaxWeight;
+        return w;
+    }
+    static WeightType Zero() { return 0; }
+
+    template <typename Iterator>
+    static void Normalize(Iterator first, Iterator last) {
+        WeightType w = std::accumulate(first, last, WeightType(0),
+                                       [](WeightType const &x, decltype(*first) p) {
+                                           return x + p.w();
+                                       });
+        CHECK(!mpfr::isinf(w));
+        CHECK(!mpfr::isnan(w));
+        CHECK_GT(w, 0);
+        for (auto it = first; it != last; ++it) it->set_nw((it->w() / w).toDouble());
+    }
+};
+
+#ifdef FEH_PARTICLE_USE_MPFR
+typedef MPFRWeightPolicy DefaultWeightPolicy;
+#else
+typedef LogWeightPolicy DefaultWeightPolicy;
+#endif
+
+enum class ResamplingScheme : int {
+    SYSTEMATIC = 0,
+    STRATIFIED,
+    RESIDUAL,
+    MULTINOMIAL
+};
+
+inline ResamplingScheme ResamplingSchemeFromString(const std::string &name) {
+    if (name == "systematic") return ResamplingScheme::SYSTEMATIC;
+    if (name == "stratified") return ResamplingScheme::STRATIFIED;
+    if (name == "residual") return ResamplingScheme::RESIDUAL;
+    if (name == "multinomial") return ResamplingScheme::MULTINOMIAL;
+    LOG(FATAL) << "unknown resampling scheme " << name;
+    return ResamplingScheme::SYSTEMATIC;
+}
+
+/// \brief: Inclusive prefix sum of the weights. Large sets are summed in fixed blocks in
+/// parallel, such that the result does not depend on the number of threads.
+inline void CumulativeSum(const std::vector<double> &w, std::vector<double> &cdf) {
+    static const int kBlockSize = 4096;
+    int n = w.size();
+    cdf.resize(n);
+    if (n < 8 * kBlockSize) {
+        std::partial_sum(w.begin(), w.end(), cdf.begin());
+        return;
+    }
+    int num_blocks = (n + kBlockSize - 1) / kBlockSize;
+    std::vector<double> offsets(num_blocks + 1, 0);
+    // prefix sums within the blocks
+    tbb::parallel_for(0, num_blocks, [&](int b) {
+        int first = b * kBlockSize, last = std::min(n, first + kBlockSize);
+        std::partial_sum(w.begin() + first, w.begin() + last, cdf.begin() + first);
+        offsets[b + 1] = cdf[last - 1];
+    });
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+    tbb::parallel_for(1, num_blocks, [&](int b) {
+        int first = b * kBlockSize, last = std::min(n, first + kBlockSize);
+        for (int i = first; i < last; ++i) cdf[i] += offsets[b];
+    });
+}
+
+/// \brief: Number of copies of each particle given ascending positions in [0, 1)
+/// on the cumulative normalized weights.
+inline std::vector<int> CountsFromPositions(const std::vector<double> &cdf,
+                                            const std::vector<double> &positions) {
+    std::vector<int> counts(cdf.size(), 0);
+    // particles after the last one with positive weight are never drawn,
+    // even if the total weight is rounded below a position
+    int last = cdf.size() - 1;
+    while (last > 0 && cdf[last] == cdf[last - 1]) --last;
+    int i = 0;
+    for (double u : positions) {
+        while (i < last && cdf[i] <= u) ++i;
+        ++counts[i];
+    }
+    return counts;
+}
+
+/// \brief: Copies of each particle for systematic resampling with offset u in [0, 1).
+inline std::vector<int> SystematicCounts(const std::vector<double> &nw, int n, double u) {
+    std::vector<double> cdf, positions(n);
+    CumulativeSum(nw, cdf);
+    for (int j = 0; j < n; ++j) positions[j] = (j + u) / n;
+    return CountsFromPositions(cdf, positions);
+}
+
+/// \brief: Copies of each particle when drawing n particles from the normalized weights nw.
+/// See Douc et al., "Comparison of resampling schemes for particle filtering".
+template <typename Generator>
+std::vector<int> ResamplingCounts(const std::vector<double> &nw, int n,
+                                  ResamplingScheme scheme, Generator &generator) {
+    std::uniform_real_distribution<double> uniform(0, 1);
+    if (scheme == ResamplingScheme::SYSTEMATIC) {
+        return SystematicCounts(nw, n, uniform(generator));
+    }
+    std::vector<double> cdf, positions(n);
+    if (scheme == ResamplingScheme::STRATIFIED) {
+        CumulativeSum(nw, cdf);
+        for (int j = 0; j < n; ++j) positions[j] = (j + uniform(generator)) / n;
+        return CountsFromPositions(cdf, positions);
+    }
+
+    std::vector<double> w(nw);
+    std::vector<int> counts(nw.size(), 0);
+    if (scheme == ResamplingScheme::RESIDUAL) {
+        // deterministic copies, the rest is drawn from the residual weights
+        int num_copies(0);
+        for (int i = 0; i < w.size(); ++i) {
+            counts[i] = std::floor(n * nw[i]);
+            w[i] = n * nw[i] - counts[i];
+            num_copies += counts[i];
+        }
+        CHECK_LE(num_copies, n);
+        n -= num_copies;
+        if (n == 0) return counts;
+        double sum = std::accumulate(w.begin(), w.end(), 0.0);
+        for (double &x : w) x /= sum;
+    } else {
+        CHECK(scheme == ResamplingScheme::MULTINOMIAL) << "unknown resampling scheme";
+    }
+    // multinomial: ascending uniforms from normalized exponential spacings
+    positions.resize(n);
+    double sum(0);
+    for (int j = 0; j < n; ++j) {
+        sum += -std::log(1 - uniform(generator));
+        positions[j] = sum;
+    }
+    sum += -std::log(1 - uniform(generator));
+    for (double &u : positions) u /= sum;
+    CumulativeSum(w, cdf);
+    std::vector<int> drawn = CountsFromPositions(cdf, positions);
+    for (int i = 0; i < counts.size(); ++i) counts[i] += drawn[i];
+    return counts;
+}
+
+/// \brief: Source particle of each of the sum(counts) resampled particles. Drawn particles
+/// keep their slot and the extra copies fill the slots of dropped particles in order, then
+/// the slots beyond the current size. Thus sources are either kept in place or located
+/// beyond the output, and particles can be replicated in place.
+inline std::vector<int> ReplicationSources(const std::vector<int> &counts) {
+    int size = counts.size();
+    int n = std::accumulate(counts.begin(), counts.end(), 0);
+    std::vector<int> sources(n, -1);
+    std::vector<int> free_slots;
+    for (int i = 0; i < std::min(size, n); ++i) {
+        if (counts[i] > 0) {
+            sources[i] = i;
+        } else {
+            free_slots.push_back(i);
+        }
+    }
+    for (int i = size; i < n; ++i) free_slots.push_back(i);
+    int k = 0;
+    for (int i = 0; i < size; ++i) {
+        // the first copy stays in place, unless the slot is beyond the output
+        for (int c = (i < n ? 1 : 0); c < counts[i]; ++c) {
+            sources[free_slots[k++]] = i;
+        }
+    }
+    return sources;
+}
+
+template <typename T, int DIM=4, typename WeightPolicy=DefaultWeightPolicy>
 class Particle {
 public:
 
@@ -32,10 +234,12 @@ public:
         isvalid_(true)
     {}
 
+    typedef typename WeightPolicy::WeightType WeightType;
+
     Particle(const Eigen::Matrix<T, DIM, 1> &v, int sid=0, double log_w=0):
         v_(v),
         log_w_(log_w),
-        w_(mpfr::exp(log_w_)),
+        w_(WeightPolicy::FromLog(log_w_)),
         nw_(std::numeric_limits<double>::quiet_NaN()),
         isvalid_(true),
         shape_id_(sid)
@@ -48,21 +252,21 @@ public:
 
     void set_log_w(double log_w) {
         log_w_ = log_w;
-        w_ = mpfr::exp(log_w_);
-        // FIXME: need to use best rounding method
-        if (mpfr::isinf(w_)) w_ = kParticleMaxWeight;
+        w_ = WeightPolicy::FromLog(log_w_);
         nw_ = std::numeric_limits<double>::quiet_NaN();
     }
     double log_w() const { return log_w_; }
     void set_zero_w() {
-        w_ = 0;
+        w_ = WeightPolicy::Zero();
         nw_ = std::numeric_limits<double>::quiet_NaN();
     }
 
     const Eigen::Matrix<T, DIM, 1> &v() const { return v_; }
     Eigen::Matrix<T, DIM, 1> &v() { return v_; }
     T v(int i) const { return v_(i); }
-    const mpfr::mpreal &w() const { return w_; }
+    /// \brief: Un-normalized weight in the representation of the weight policy,
+    /// only to be compared against each other.
+    const WeightType &w() const { return w_; }
     void Perturbate(Eigen::Matrix<T, DIM, 1> const &perturbation) { v_ = v_ + perturbation; }
     double nw() const {
         CHECK(!std::isnan(nw_)) << "\033[91mnormalized weight is nan!!!\033[0m";
@@ -85,16 +289,16 @@ private:
     Eigen::Matrix<T, DIM, 1> v_;           // state vector
     double log_w_;  // log weight
     double edge_log_likelihood_;
-    mpfr::mpreal w_;    // (un-normalized) weight
+    WeightType w_;  // (un-normalized) weight, see WeightPolicy
     double nw_;     // normalized weight
     bool isvalid_;  // auxiliary status
     int shape_id_;  // discrete random variable
 };
 
-template <typename T, int DIM = 4>
-class Particles: public std::vector<Particle<T, DIM>> {
+template <typename T, int DIM = 4, typename WeightPolicy=DefaultWeightPolicy>
+class Particles: public std::vector<Particle<T, DIM, WeightPolicy>> {
 public:
-    typedef Particle<T, DIM> ParticleType;
+    typedef Particle<T, DIM, WeightPolicy> ParticleType;
     typedef Eigen::Matrix<T, DIM, 1> StateType;
 
 public:
@@ -113,9 +317,15 @@ public:
     Eigen::Matrix<T, DIM, 1> Mode();
 
     bool Normalize();
-    bool SystematicResampling();
-    bool ResidualResampling();
-    bool MultinomialResampling();
+    /// \brief: Effective sample size 1 / sum(nw^2) of the normalized weights.
+    double EffectiveSampleSize();
+    /// \brief: Replace the particles by draws proportional to their weights.
+    template <typename Generator>
+    bool Resample(ResamplingScheme scheme, Generator &generator);
+    bool SystematicResampling() { return Resample(ResamplingScheme::SYSTEMATIC, *generator_); }
+    bool StratifiedResampling() { return Resample(ResamplingScheme::STRATIFIED, *generator_); }
+    bool ResidualResampling() { return Resample(ResamplingScheme::RESIDUAL, *generator_); }
+    bool MultinomialResampling() { return Resample(ResamplingScheme::MULTINOMIAL, *generator_); }
     int Subsample(int required_num_particles);
 
     // io
@@ -130,8 +340,8 @@ private:
     bool is_normalized_ = false;
 };
 
-template <typename T, int DIM>
-int Particles<T, DIM>::MostProbableIndex() {
+template <typename T, int DIM, typename WeightPolicy>
+int Particles<T, DIM, WeightPolicy>::MostProbableIndex() {
     // compute marginal distribution over indices
     Normalize();
     std::unordered_map<int, double> prob;
@@ -158,8 +368,8 @@ int Particles<T, DIM>::MostProbableIndex() {
 
 
 // mean conditioned on index
-template <typename T, int DIM>
-Eigen::Matrix<T, DIM, 1> Particles<T, DIM>::Mean(int index) {
+template <typename T, int DIM, typename WeightPolicy>
+Eigen::Matrix<T, DIM, 1> Particles<T, DIM, WeightPolicy>::Mean(int index) {
     Normalize();
     Eigen::Matrix<T, DIM, 1> out;
     double total_w(0);
@@ -173,8 +383,8 @@ Eigen::Matrix<T, DIM, 1> Particles<T, DIM>::Mean(int index) {
     return out / total_w;
 }
 
-template <typename T, int DIM>
-Eigen::Matrix<T, DIM, DIM> Particles<T, DIM>::Covariance() {
+template <typename T, int DIM, typename WeightPolicy>
+Eigen::Matrix<T, DIM, DIM> Particles<T, DIM, WeightPolicy>::Covariance() {
     Eigen::Matrix<T, DIM, 1> mean = Mean();
     Eigen::Matrix<T, DIM, DIM> cov;
     cov.setZero();
@@ -185,10 +395,10 @@ Eigen::Matrix<T, DIM, DIM> Particles<T, DIM>::Covariance() {
     return cov;
 }
 
-template <typename T, int DIM>
-Eigen::Matrix<T, DIM, 1> Particles<T, DIM>::Mode() {
+template <typename T, int DIM, typename WeightPolicy>
+Eigen::Matrix<T, DIM, 1> Particles<T, DIM, WeightPolicy>::Mode() {
     Eigen::Matrix<T, DIM, 1> out;
-    mpfr::mpreal max_w(0);
+    typename ParticleType::WeightType max_w = WeightPolicy::Zero();
     for (auto it = this->begin(); it != this->end(); ++it) {
         if (it->w() > max_w) {
             max_w = it->w();
@@ -198,85 +408,37 @@ Eigen::Matrix<T, DIM, 1> Particles<T, DIM>::Mode() {
     return out;
 }
 
-template <typename T, int DIM>
-bool Particles<T, DIM>::Normalize() {
+template <typename T, int DIM, typename WeightPolicy>
+bool Particles<T, DIM, WeightPolicy>::Normalize() {
 //    if (is_normalized_) return;
-    mpfr::mpreal w(0);
-    w = std::accumulate(this->begin(), this->end(), mpfr::mpreal(0),
-                        [](mpfr::mpreal const &x, ParticleType const &p) {
-                            return x + p.w();
-                        });
-//    for (auto it = this->begin(); it != this->end(); ++it) {
-//        std::cout << it->log_w() << ";;;" << it->w() << "\n";
-//        CHECK(!mpfr::isinf(it->w())) << "inf w";
-//        CHECK(!mpfr::isnan(it->w())) << "nan w";
-//    }
-//    std::cout << "weight sum=" << w << "\n";
-    CHECK(!mpfr::isinf(w));
-    CHECK(!mpfr::isnan(w));
-    CHECK_GT(w, 0);
-    for (auto it = this->begin(); it != this->end(); ++it) {
-        double nw((it->w() / w).toDouble());
-        it->set_nw(nw);
-    }
+    WeightPolicy::Normalize(this->begin(), this->end());
 //    is_normalized_ = true;
     return true;
 }
 
-template <typename T, int DIM>
-bool Particles<T, DIM>::SystematicResampling() {
+template <typename T, int DIM, typename WeightPolicy>
+double Particles<T, DIM, WeightPolicy>::EffectiveSampleSize() {
+    Normalize();
+    double sum(0);
+    for (auto it = this->begin(); it != this->end(); ++it) sum += it->nw() * it->nw();
+    return 1.0 / sum;
+}
+
+template <typename T, int DIM, typename WeightPolicy>
+template <typename Generator>
+bool Particles<T, DIM, WeightPolicy>::Resample(ResamplingScheme scheme, Generator &generator) {
     for (int i = 0; i < this->size(); ++i) {
         if (!this->at(i).IsValid()) this->at(i).set_zero_w();
     }
     Normalize();
     int n(this->size());
-    std::uniform_real_distribution<double> dist(0, 1.0f/n);
-    double u1 = dist(*generator_);
-    double uj = u1, inc = 1.0/n;
-
-    double sum1(0), sum2;
-    std::vector<int> counter(n, 0);
-    for (int i = 0, j = 0; i < n; ++i) {
-        sum2 = sum1 + this->at(i).nw();
-//        std::cout << "i=" << i << " ;;; (" << sum1 << "," << sum2 << ")\n";
-        if (std::isnan(sum2)) LOG(FATAL) << "got nan value";
-        // check the interval between sum1 and sum2
-        // where sum1 = sum of w up to index (i-1)
-        // and sum2 = sum of w up to index i
-        while (j < n && uj >= sum1 && uj <= sum2) {
-            // every time we increase a counter by one
-            // we also increases j by one, thus sum of all counters
-            // should always equal to j, i.e., when j == n, we have
-            // sum of all counters equal to n too.
-            ++counter[i];
-            ++j;
-            uj += inc;
-        }
-        if (j < n && uj < sum1) {
-            LOG(FATAL) << "something went wrong";
-        }
-
-        if (j < n && uj > sum2) {
-            sum1 = sum2;
-        }
-        if (j >= n) break;
-    }
-//    std::cout << "uj=" << uj << std::endl;
+    std::vector<double> nw(n);
+    for (int i = 0; i < n; ++i) nw[i] = this->at(i).nw();
 
-    // debug
-    int total_count(0);
-    std::vector<ParticleType> original(this->begin(), this->end());
-    for (int i = 0, j = 0; i < n; ++i) {
-        for (int k = 0; k < counter[i]; ++k, ++j) {
-            this->at(j) = original[i];
-        }
-        total_count += counter[i];
-    }
-//    CHECK_EQ(total_count, n);
-    if (total_count < n) {
-        LOG(WARNING) << "inconsitent particle number after resampling:"
-                     << "need " << n << " got " << total_count << "\n";
-        Print();
+    // sources are kept in place or dropped, so no copy of the particles is needed
+    std::vector<int> sources = ReplicationSources(ResamplingCounts(nw, n, scheme, generator));
+    for (int j = 0; j < n; ++j) {
+        if (sources[j] != j) this->at(j) = this->at(sources[j]);
     }
 
     for (auto it = this->begin(); it != this->end(); ++it) {
@@ -287,16 +449,8 @@ bool Particles<T, DIM>::SystematicResampling() {
     return true;
 }
 
-//template <typename T>
-//bool Particle<T>::ResidualResampling(Particles &particles)
-//{}
-//
-//template <typename T>
-//bool Particle<T>::MultinomialResampling(Particles &particles)
-//{}
-
-template <typename T, int DIM>
-void Particles<T, DIM>::WriteToFile(const std::string &filename) const {
+template <typename T, int DIM, typename WeightPolicy>
+void Particles<T, DIM, WeightPolicy>::WriteToFile(const std::string &filename) const {
     std::ofstream out(filename, std::ios::out);
     CHECK(out.is_open()) << "failed to open file " << filename << "\n";
     for (auto it = this->begin(); it != this->end(); ++it) {
@@ -305,8 +459,8 @@ void Particles<T, DIM>::WriteToFile(const std::string &filename) const {
     out.close();
 }
 
-template <typename T, int DIM>
-void Particles<T, DIM>::Print() const {
+template <typename T, int DIM, typename WeightPolicy>
+void Particles<T, DIM, WeightPolicy>::Print() const {
     std::cout << "====================\n====================\n====================\n";
     std::cout << "= Particles\n";
     std::cout << "====================\n====================\n====================\n";
@@ -316,8 +470,8 @@ void Particles<T, DIM>::Print() const {
     std::cout << "\n";
 }
 
-template <typename T, int DIM>
-void Particles<T, DIM>::PrintSummary() const {
+template <typename T, int DIM, typename WeightPolicy>
+void Particles<T, DIM, WeightPolicy>::PrintSummary() const {
     // count particles of each label
     std::unordered_map<int, int> index_counter;
     std::unordered_map<int, double> index_marginal;
@@ -349,8 +503,8 @@ void Particles<T, DIM>::PrintSummary() const {
 
 };
 
-template <typename T, int DIM>
-int Particles<T, DIM>::Subsample(int required_num_particles) {
+template <typename T, int DIM, typename WeightPolicy>
+int Particles<T, DIM, WeightPolicy>::Subsample(int required_num_particles) {
     if (this->size() <= required_num_particles) return this->size();
 //    std::random_shuffle(this->begin(), this->end());
     std::sort(this->begin(), this->end(), [](const ParticleType &p1, const ParticleType &p2) {
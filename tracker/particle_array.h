@@ -0,0 +1,628 @@
+//
+// Structure-of-arrays particle container.
+//
+#pragma once
+// stl
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <numeric>
+#include <type_traits>
+
+// own
+#include "particle.h"
+
+namespace feh {
+
+/// \brief: Proxy to one particle of a ParticleArray, provides the interface of Particle
+/// such that per particle code works on both containers. Copies of the proxy refer to
+/// the same particle, i.e., constness is shallow as for pointers.
+template <typename Array>
+class ParticleRef {
+public:
+    typedef typename std::remove_const<Array>::type ArrayType;
+    typedef typename ArrayType::ParticleType ParticleType;
+    typedef typename ArrayType::StateType StateType;
+    typedef typename ArrayType::WeightType WeightType;
+    typedef typename ArrayType::ScalarType ScalarType;
+    // state of a single particle is strided since columns of the array are contiguous
+    typedef Eigen::Map<typename std::conditional<std::is_const<Array>::value, const StateType, StateType>::type,
+                       0, Eigen::InnerStride<>> StateMap;
+
+    ParticleRef(Array *array, int i): array_(array), i_(i) {}
+
+    /// \brief: Copy out the particle.
+    operator ParticleType() const {
+        ParticleType p(v(), shape_id(), log_w());
+        p.set_edge_log_likelihood(edge_log_likelihood());
+        if (w() == WeightPolicyType::Zero()) p.set_zero_w();
+        if (!std::isnan(array_->nw_[i_])) p.set_nw(array_->nw_[i_]);
+        if (!IsValid()) p.MakeInvalid();
+        return p;
+    }
+
+    void set_edge_log_likelihood(double ll) const { array_->edge_log_likelihood_[i_] = ll; }
+    double edge_log_likelihood() const { return array_->edge_log_likelihood_[i_]; }
+
+    void set_log_w(double log_w) const {
+        array_->log_w_[i_] = log_w;
+        array_->w_[i_] = WeightPolicyType::FromLog(log_w);
+        array_->nw_[i_] = std::numeric_limits<double>::quiet_NaN();
+    }
+    double log_w() const { return array_->log_w_[i_]; }
+    void set_zero_w() const {
+        array_->w_[i_] = WeightPolicyType::Zero();
+        array_->nw_[i_] = std::numeric_limits<double>::quiet_NaN();
+    }
+
+    StateMap v() const { return StateMap(&array_->state_[i_], Eigen::InnerStride<>(array_->capacity_)); }
+    ScalarType v(int i) const { return array_->state_[i * array_->capacity_ + i_]; }
+    const WeightType &w() const { return array_->w_[i_]; }
+    void Perturbate(const StateType &perturbation) const { v() += perturbation; }
+    double nw() const {
+        CHECK(!std::isnan(array_->nw_[i_])) << "\033[91mnormalized weight is nan!!!\033[0m";
+        return array_->nw_[i_];
+    }
+    void set_nw(double nw) const { array_->nw_[i_] = nw; }
+    bool IsNormalized() const { return std::isnan(array_->nw_[i_]); }
+
+    bool IsValid() const { return array_->valid_[i_]; }
+    void MakeInvalid() const { array_->valid_[i_] = false; }
+    void MakeValid() const { array_->valid_[i_] = true; }
+
+    int shape_id() const { return array_->shape_id_[i_]; }
+    void set_shape_id(int sid) const { array_->shape_id_[i_] = sid; }
+
+private:
+    typedef typename ArrayType::WeightPolicyType WeightPolicyType;
+    Array *array_;
+    int i_;
+};
+
+template <typename Array>
+class ParticleIterator {
+public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef ParticleRef<Array> value_type;
+    typedef ParticleRef<Array> reference;
+    typedef std::ptrdiff_t difference_type;
+    // operator-> goes through a temporary proxy
+    struct pointer {
+        ParticleRef<Array> ref;
+        const ParticleRef<Array> *operator->() const { return &ref; }
+    };
+
+    ParticleIterator(Array *array, int i): array_(array), i_(i) {}
+    reference operator*() const { return {array_, i_}; }
+    pointer operator->() const { return {**this}; }
+    ParticleIterator &operator++() { ++i_; return *this; }
+    ParticleIterator operator++(int) { ParticleIterator it(*this); ++i_; return it; }
+    bool operator==(const ParticleIterator &other) const { return i_ == other.i_ && array_ == other.array_; }
+    bool operator!=(const ParticleIterator &other) const { return !(*this == other); }
+
+private:
+    Array *array_;
+    int i_;
+};
+
+/// \brief: Particles stored as structure of arrays: one contiguous column per state
+/// dimension, plus contiguous weights, shape ids and validity flags. Whole-ensemble
+/// operations (proposal, prior, moments, normalization) are vectorized kernels over
+/// the columns, while ParticleRef keeps the per particle interface of Particles.
+template <typename T, int DIM=4, typename WeightPolicy=DefaultWeightPolicy>
+class ParticleArray {
+public:
+    typedef T ScalarType;
+    typedef WeightPolicy WeightPolicyType;
+    typedef Particle<T, DIM, WeightPolicy> ParticleType;
+    typedef Eigen::Matrix<T, DIM, 1> StateType;
+    typedef typename WeightPolicy::WeightType WeightType;
+    // one row per particle
+    typedef Eigen::Matrix<T, Eigen::Dynamic, DIM, Eigen::ColMajor> StateMatrix;
+    typedef Eigen::Map<StateMatrix, 0, Eigen::OuterStride<>> StateMatrixMap;
+    typedef Eigen::Map<const StateMatrix, 0, Eigen::OuterStride<>> ConstStateMatrixMap;
+    typedef ParticleRef<ParticleArray> reference;
+    typedef ParticleRef<const ParticleArray> const_reference;
+    typedef ParticleIterator<ParticleArray> iterator;
+    typedef ParticleIterator<const ParticleArray> const_iterator;
+
+public:
+    void Initialize(std::shared_ptr<std::knuth_b> generator=nullptr) {
+        if (generator) {
+            generator_ = generator;
+        } else {
+            generator_ = std::make_shared<std::knuth_b>(time(NULL));
+        }
+    }
+    std::shared_ptr<std::knuth_b> generator() const { return generator_; }
+
+    // container interface
+    int size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    void clear() { Resize(0); }
+    void resize(int n, const ParticleType &value=ParticleType(StateType::Zero())) {
+        int old_size = size_;
+        Resize(n);
+        for (int i = old_size; i < n; ++i) Set(i, value);
+    }
+    void push_back(const ParticleType &value) {
+        Resize(size_ + 1);
+        Set(size_ - 1, value);
+    }
+    reference operator[](int i) { return {this, i}; }
+    const_reference operator[](int i) const { return {this, i}; }
+    reference at(int i) { CHECK(i >= 0 && i < size_); return {this, i}; }
+    const_reference at(int i) const { CHECK(i >= 0 && i < size_); return {this, i}; }
+    iterator begin() { return {this, 0}; }
+    iterator end() { return {this, size_}; }
+    const_iterator begin() const { return {this, 0}; }
+    const_iterator end() const { return {this, size_}; }
+
+    // kernels over the whole ensemble
+    StateMatrixMap states() {
+        return StateMatrixMap(state_.data(), size_, DIM, Eigen::OuterStride<>(capacity_));
+    }
+    ConstStateMatrixMap states() const {
+        return ConstStateMatrixMap(state_.data(), size_, DIM, Eigen::OuterStride<>(capacity_));
+    }
+    /// \brief: v_i += scale .* noise_i, noise has one row per particle.
+    void Perturbate(const StateMatrix &noise, const StateType &scale);
+    /// \brief: Out of place version of the above: the particles of src moved by scale .* noise.
+    /// Storage is reused, no allocation happens once the capacity is large enough.
+    void Perturbate(const ParticleArray &src, const StateMatrix &noise, const StateType &scale);
+    /// \brief: Wrap angles of the given state dimension to [0, 2pi), same as WarpAngle.
+    void WarpAngle(int dim);
+    /// \brief: log_w_i += delta_i, only for valid particles if valid_only is set.
+    void AddLogWeights(const Eigen::VectorXd &delta, bool valid_only=false);
+    void SetLogWeights(double log_w);
+    void MakeValid() { std::fill(valid_.begin(), valid_.end(), true); }
+    /// \brief: Log density of standard normal noise over the first dims dimensions,
+    /// up to the normalization constant.
+    static Eigen::VectorXd GaussianLogDensity(const StateMatrix &noise, int dims);
+
+    // same interface as Particles
+    int MostProbableIndex();
+    /// \brief: Weighted mean of the particles of a shape, NaN if none of them carries weight.
+    StateType Mean(int index = 0);
+
+    /// \brief: Weighted covariance of all the particles.
+    Eigen::Matrix<T, DIM, DIM> Covariance();
+    StateType Mode();
+
+    /// \return: false if no particle carries weight, the normalized weights are NaN then.
+    bool Normalize();
+    /// \brief: Effective sample size 1 / sum(nw^2) of the normalized weights,
+    /// invalid particles count as zero weight as in resampling. NaN if no valid particle carries weight.
+    double EffectiveSampleSize();
+    /// \brief: Replace the particles by draws proportional to their weights, in place.
+    /// \param num_out: number of particles after resampling, the current number if negative.
+    /// \return: false and particles untouched if no valid particle carries weight.
+    template <typename Generator>
+    bool Resample(ResamplingScheme scheme, Generator &generator, int num_out=-1);
+    bool SystematicResampling() { return Resample(ResamplingScheme::SYSTEMATIC, *generator_); }
+    bool StratifiedResampling() { return Resample(ResamplingScheme::STRATIFIED, *generator_); }
+    bool ResidualResampling() { return Resample(ResamplingScheme::RESIDUAL, *generator_); }
+    bool MultinomialResampling() { return Resample(ResamplingScheme::MULTINOMIAL, *generator_); }
+    /// \brief: Systematic resampling with the given uniform random number in [0, 1).
+    bool SystematicResampling(double u, int num_out=-1);
+    /// \brief: KLD-sampling (Fox, "Adapting the sample size in particle filters through
+    /// KLD-sampling"): number of particles such that the KL divergence between the
+    /// resampled and the true posterior is below epsilon with probability given by the
+    /// standard normal upper quantile z. The posterior is binned by bin_size per shape and
+    /// the occupied bins are counted over max_num systematic draws with offset u.
+    /// \return: number of particles within [min_num, max_num].
+    int KLDSampleSize(double u, const StateType &bin_size, double epsilon, double z,
+                      int min_num, int max_num);
+    int Subsample(int required_num_particles);
+
+    // io
+    void WriteToFile(const std::string &filename) const;
+    /// \brief: Print value of particles with normalized weights.
+    void Print() const;
+    /// \brief: Print summary information of the ensemble of particles.
+    void PrintSummary() const;
+
+private:
+    friend class ParticleRef<ParticleArray>;
+    friend class ParticleRef<const ParticleArray>;
+
+    /// \brief: Change the number of particles, state columns grow geometrically.
+    void Resize(int n);
+    void Set(int i, const ParticleType &value);
+    /// \brief: Keep the particles at the given indices, in the given order.
+    void Gather(const std::vector<int> &indices);
+    /// \brief: Zero the weights of invalid particles and normalize.
+    bool NormalizeValid();
+    /// \brief: Replace the particles by counts[i] copies of particle i, in place.
+    bool Replicate(const std::vector<int> &counts);
+    // log-sum-exp over the contiguous log weights
+    bool NormalizeWeights(LogWeightPolicy);
+    template <typename Policy>
+    bool NormalizeWeights(Policy) { Policy::Normalize(begin(), end()); return true; }
+
+    int size_ = 0;
+    int capacity_ = 0;
+    std::vector<T> state_;      // DIM columns of capacity_ entries
+    std::vector<double> log_w_;
+    std::vector<double> edge_log_likelihood_;
+    std::vector<WeightType> w_;
+    std::vector<double> nw_;
+    std::vector<int> shape_id_;
+    std::vector<uint8_t> valid_;
+
+    std::shared_ptr<std::knuth_b> generator_;
+};
+
+/// \brief: Ping-pong pair of particle sets for tentative filter updates. An update leaves the
+/// committed set untouched and writes the other buffer with out of place kernels, such that
+/// commit and rollback only flip which buffer is current instead of saving a copy of the set.
+template <typename Array>
+class ParticleBuffers {
+public:
+    void Initialize(std::shared_ptr<std::knuth_b> generator=nullptr) {
+        buffers_[0].Initialize(generator);
+        buffers_[1].Initialize(buffers_[0].generator());
+    }
+    /// \brief: The particles, during an update the ones being updated.
+    Array &current() { return buffers_[current_]; }
+    const Array &current() const { return buffers_[current_]; }
+    /// \brief: The particles before the update started.
+    const Array &committed() const { return buffers_[pending_ ? current_ ^ 1 : current_]; }
+
+    /// \brief: Start an update, the returned buffer becomes current and has to be
+    /// written from committed(), its content is stale.
+    Array &Begin() {
+        CHECK(!pending_) << "update in progress";
+        pending_ = true;
+        current_ ^= 1;
+        return current();
+    }
+    void Commit() {
+        CHECK(pending_) << "no update in progress";
+        pending_ = false;
+    }
+    /// \brief: Drop the update and restore the committed particles.
+    void Rollback() {
+        CHECK(pending_) << "no update in progress";
+        pending_ = false;
+        current_ ^= 1;
+    }
+    bool pending() const { return pending_; }
+
+private:
+    Array buffers_[2];
+    int current_ = 0;
+    bool pending_ = false;
+};
+
+template <typename T, int DIM, typename WeightPolicy>
+void ParticleArray<T, DIM, WeightPolicy>::Resize(int n) {
+    if (n > capacity_) {
+        int capacity = std::max(n, 2 * capacity_);
+        std::vector<T> state(DIM * capacity);
+        for (int d = 0; d < DIM; ++d) {
+            std::copy(state_.begin() + d * capacity_, state_.begin() + d * capacity_ + size_,
+                      state.begin() + d * capacity);
+        }
+        state_.swap(state);
+        capacity_ = capacity;
+    }
+    size_ = n;
+    log_w_.resize(n);
+    edge_log_likelihood_.resize(n);
+    w_.resize(n);
+    nw_.resize(n);
+    shape_id_.resize(n);
+    valid_.resize(n);
+}
+
+template <typename T, int DIM, typename WeightPolicy>
+void ParticleArray<T, DIM, WeightPolicy>::Set(int i, const ParticleType &value) {
+    for (int d = 0; d < DIM; ++d) state_[d * capacity_ + i] = value.v(d);
+    log_w_[i] = value.log_w();
+    edge_log_likelihood_[i] = value.edge_log_likelihood();
+    w_[i] = value.w();
+    nw_[i] = std::numeric_limits<double>::quiet_NaN();
+    shape_id_[i] = value.shape_id();
+    valid_[i] = value.IsValid();
+}
+
+template <typename T, int DIM, typename WeightPolicy>
+void ParticleArray<T, DIM, WeightPolicy>::Gather(const std::vector<int> &indices) {
+    ParticleArray<T, DIM, WeightPolicy> original(*this);
+    Resize(indices.size());
+    for (int d = 0; d < DIM; ++d) {
+        const T *src = &original.state_[d * original.capacity_];
+        T *dst = &state_[d * capacity_];
+        for (int i = 0; i < size_; ++i) dst[i] = src[indices[i]];
+    }
+    for (int i = 0; i < size_; ++i) {
+        int j = indices[i];
+        log_w_[i] = original.log_w_[j];
+        edge_log_likelihood_[i] = original.edge_log_likelihood_[j];
+        w_[i] = original.w_[j];
+        nw_[i] = original.nw_[j];
+        shape_id_[i] = original.shape_id_[j];
+        valid_[i] = original.valid_[j];
+    }
+}
+
+template <typename T, int DIM, typename WeightPolicy>
+void ParticleArray<T, DIM, WeightPolicy>::Perturbate(const StateMatrix &noise, const StateType &scale) {
+    CHECK_EQ(noise.rows(), size_);
+    states() += noise * scale.asDiagonal();
+}
+
+template <typename T, int DIM, typename WeightPolicy>
+void ParticleArray<T, DIM, WeightPolicy>::Perturbate(const ParticleArray &src,
+                                                     const StateMatrix &noise, const StateType &scale) {
+    CHECK(this != &src) << "source and destination must differ";
+    CHECK_EQ(noise.rows(), src.size_);
+    Resize(src.size_);
+    states() = src.states() + noise * scale.asDiagonal();
+    std::copy(src.log_w_.begin(), src.log_w_.end(), log_w_.begin());
+    std::copy(src.edge_log_likelihood_.begin(), src.edge_log_likelihood_.end(), edge_log_likelihood_.begin());
+    std::copy(src.w_.begin(), src.w_.end(), w_.begin());
+    std::copy(src.nw_.begin(), src.nw_.end(), nw_.begin());
+    std::copy(src.shape_id_.begin(), src.shape_id_.end(), shape_id_.begin());
+    std::copy(src.valid_.begin(), src.valid_.end(), valid_.begin());
+    generator_ = src.generator_;
+}
+
+template <typename T, int DIM, typename WeightPolicy>
+void ParticleArray<T, DIM, WeightPolicy>::WarpAngle(int dim) {
+    const T two_pi = 2 * M_PI;
+    auto angle = states().col(dim).array();
+    angle -= two_pi * (angle / two_pi).floor();
+    // rounding of tiny negative angles
+    angle = (angle >= two_pi).select(angle - two_pi, angle);
+}
+
+template <typename T, int DIM, typename WeightPolicy>
+void ParticleArray<T, DIM, WeightPolicy>::AddLogWeights(const Eigen::VectorXd &delta, bool valid_only) {
+    CHECK_EQ(delta.size(), size_);
+    Eigen::Map<Eigen::VectorXd> log_w(log_w_.data(), size_);
+    if (valid_only) {
+        Eigen::Map<const Eigen::Matrix<uint8_t, Eigen::Dynamic, 1>> valid(valid_.data(), size_);
+        log_w.array() += (valid.array() != 0).select(delta.array(), 0);
+    } else {
+        log_w += delta;
+    }
+    for (int i = 0; i < size_; ++i) w_[i] = WeightPolicy::FromLog(log_w_[i]);
+    std::fill(nw_.begin(), nw_.end(), std::numeric_limits<double>::quiet_NaN());
+}
+
+template <typename T, int DIM, typename WeightPolicy>
+void ParticleArray<T, DIM, WeightPolicy>::SetLogWeights(double log_w) {
+    std::fill(log_w_.begin(), log_w_.end(), log_w);
+    std::fill(w_.begin(), w_.end(), WeightPolicy::FromLog(log_w));
+    std::fill(nw_.begin(), nw_.end(), std::numeric_limits<double>::quiet_NaN());
+}
+
+template <typename T, int DIM, typename WeightPolicy>
+Eigen::VectorXd ParticleArray<T, DIM, WeightPolicy>::GaussianLogDensity(const StateMatrix &noise, int dims) {
+    return -0.5 * noise.leftCols(dims).rowwise().squaredNorm().template cast<double>();
+}
+
+template <typename T, int DIM, typename WeightPolicy>
+bool ParticleArray<T, DIM, WeightPolicy>::NormalizeWeights(LogWeightPolicy) {
+    Eigen::Map<const Eigen::VectorXd> log_w(w_.data(), size_);
+    Eigen::Map<Eigen::VectorXd> nw(nw_.data(), size_);
+    double max_log_w = size_ ? log_w.maxCoeff() : LogWeightPolicy::Zero();
+    if (log_w.hasNaN() || !std::isfinite(max_log_w)) {
+        // all the weights are zero, or undefined
+        nw.setConstant(std::numeric_limits<double>::quiet_NaN());
+        return false;
+    }
+    nw = (log_w.array() - max_log_w).exp();
+    nw /= nw.sum();
+    return true;
+}
+
+template <typename T, int DIM, typename WeightPolicy>
+bool ParticleArray<T, DIM, WeightPolicy>::Normalize() {
+    return NormalizeWeights(WeightPolicy());
+}
+
+template <typename T, int DIM, typename WeightPolicy>
+int ParticleArray<T, DIM, WeightPolicy>::MostProbableIndex() {
+    // compute marginal distribution over indices
+    Normalize();
+    std::unordered_map<int, double> prob;
+    for (int i = 0; i < size_; ++i) {
+        prob[shape_id_[i]] += nw_[i];
+    }
+    int most_prob_idx(-1);
+    double most_prob(0);
+    for (auto key_val : prob) {
+        if (key_val.second > most_prob) {
+            most_prob_idx = key_val.first;
+            most_prob = key_val.second;
+        }
+    }
+    return most_prob_idx;
+}
+
+// mean conditioned on index
+template <typename T, int DIM, typename WeightPolicy>
+typename ParticleArray<T, DIM, WeightPolicy>::StateType ParticleArray<T, DIM, WeightPolicy>::Mean(int index) {
+    Normalize();
+    Eigen::Matrix<T, Eigen::Dynamic, 1> w(size_);
+    for (int i = 0; i < size_; ++i) {
+        w(i) = shape_id_[i] == index ? nw_[i] : 0;
+    }
+    T total_w = w.sum();
+    if (!std::isnormal(total_w)) {
+        // no particle of the shape carries weight
+        return StateType::Constant(std::numeric_limits<T>::quiet_NaN());
+    }
+    return states().transpose() * w / total_w;
+}
+
+template <typename T, int DIM, typename WeightPolicy>
+Eigen::Matrix<T, DIM, DIM> ParticleArray<T, DIM, WeightPolicy>::Covariance() {
+    // about the mean of all the particles, which exists whatever the shapes are
+    Normalize();
+    Eigen::Matrix<T, Eigen::Dynamic, 1> w = Eigen::Map<const Eigen::VectorXd>(nw_.data(), size_).cast<T>();
+    StateType mean = states().transpose() * w;
+    StateMatrix centered = states().rowwise() - mean.transpose();
+    return centered.transpose() * w.asDiagonal() * centered;
+}
+
+template <typename T, int DIM, typename WeightPolicy>
+typename ParticleArray<T, DIM, WeightPolicy>::StateType ParticleArray<T, DIM, WeightPolicy>::Mode() {
+    StateType out;
+    WeightType max_w = WeightPolicy::Zero();
+    for (int i = 0; i < size_; ++i) {
+        if (w_[i] > max_w) {
+            max_w = w_[i];
+            out = (*this)[i].v();
+        }
+    }
+    return out;
+}
+
+template <typename T, int DIM, typename WeightPolicy>
+bool ParticleArray<T, DIM, WeightPolicy>::NormalizeValid() {
+    for (int i = 0; i < size_; ++i) {
+        if (!valid_[i]) (*this)[i].set_zero_w();
+    }
+    return Normalize();
+}
+
+template <typename T, int DIM, typename WeightPolicy>
+double ParticleArray<T, DIM, WeightPolicy>::EffectiveSampleSize() {
+    if (!NormalizeValid()) return std::numeric_limits<double>::quiet_NaN();
+    return 1.0 / Eigen::Map<const Eigen::VectorXd>(nw_.data(), size_).squaredNorm();
+}
+
+template <typename T, int DIM, typename WeightPolicy>
+template <typename Generator>
+bool ParticleArray<T, DIM, WeightPolicy>::Resample(ResamplingScheme scheme, Generator &generator, int num_out) {
+    if (!NormalizeValid()) return false;
+    return Replicate(ResamplingCounts(nw_, num_out < 0 ? size_ : num_out, scheme, generator));
+}
+
+template <typename T, int DIM, typename WeightPolicy>
+bool ParticleArray<T, DIM, WeightPolicy>::SystematicResampling(double u, int num_out) {
+    if (!NormalizeValid()) return false;
+    return Replicate(SystematicCounts(nw_, num_out < 0 ? size_ : num_out, u));
+}
+
+template <typename T, int DIM, typename WeightPolicy>
+bool ParticleArray<T, DIM, WeightPolicy>::Replicate(const std::vector<int> &counts) {
+    CHECK_EQ(counts.size(), size_);
+    std::vector<int> sources = ReplicationSources(counts);
+    int n = sources.size();
+    // sources are kept in place or located beyond the output, see ReplicationSources,
+    // grow before and shrink after copying
+    int old_size = size_;
+    if (n > old_size) Resize(n);
+    for (int d = 0; d < DIM; ++d) {
+        T *column = &state_[d * capacity_];
+        for (int j = 0; j < n; ++j) column[j] = column[sources[j]];
+    }
+    for (int j = 0; j < n; ++j) {
+        int i = sources[j];
+        if (i == j) continue;
+        edge_log_likelihood_[j] = edge_log_likelihood_[i];
+        shape_id_[j] = shape_id_[i];
+        valid_[j] = valid_[i];
+    }
+    if (n < old_size) Resize(n);
+
+    SetLogWeights(0);
+    std::fill(nw_.begin(), nw_.end(), 1.0 / n);
+    return true;
+}
+
+template <typename T, int DIM, typename WeightPolicy>
+int ParticleArray<T, DIM, WeightPolicy>::KLDSampleSize(double u, const StateType &bin_size,
+                                                       double epsilon, double z,
+                                                       int min_num, int max_num) {
+    CHECK_GT(epsilon, 0);
+    CHECK_LE(min_num, max_num);
+    NormalizeValid();
+
+    // bins occupied by the resampled particles: shape id followed by the state bin
+    std::vector<std::array<int, DIM + 1>> bins;
+    std::vector<int> counts = SystematicCounts(nw_, max_num, u);
+    for (int i = 0; i < size_; ++i) {
+        if (counts[i] == 0) continue;
+        std::array<int, DIM + 1> bin;
+        bin[0] = shape_id_[i];
+        for (int d = 0; d < DIM; ++d) {
+            bin[d + 1] = std::floor(state_[d * capacity_ + i] / bin_size(d));
+        }
+        bins.push_back(bin);
+    }
+    std::sort(bins.begin(), bins.end());
+    int k = std::unique(bins.begin(), bins.end()) - bins.begin();
+    if (k <= 1) return min_num;
+
+    // Wilson-Hilferty approximation of the chi-square quantile with k-1 degrees of freedom
+    double a = 2.0 / (9 * (k - 1));
+    double b = 1 - a + std::sqrt(a) * z;
+    double n = (k - 1) / (2 * epsilon) * b * b * b;
+    return std::max(min_num, (int)std::min<double>(max_num, std::ceil(n)));
+}
+
+template <typename T, int DIM, typename WeightPolicy>
+int ParticleArray<T, DIM, WeightPolicy>::Subsample(int required_num_particles) {
+    if (size_ <= required_num_particles) return size_;
+    std::vector<int> indices(size_);
+    std::iota(indices.begin(), indices.end(), 0);
+    std::partial_sort(indices.begin(), indices.begin() + required_num_particles, indices.end(),
+                      [this](int i, int j) { return log_w_[i] > log_w_[j]; });
+    indices.resize(required_num_particles);
+    Gather(indices);
+    return required_num_particles;
+}
+
+template <typename T, int DIM, typename WeightPolicy>
+void ParticleArray<T, DIM, WeightPolicy>::WriteToFile(const std::string &filename) const {
+    std::ofstream out(filename, std::ios::out);
+    CHECK(out.is_open()) << "failed to open file " << filename << "\n";
+    for (const auto &p : *this) {
+        out << p.v().transpose() << " " << p.nw() << "\n";
+    }
+    out.close();
+}
+
+template <typename T, int DIM, typename WeightPolicy>
+void ParticleArray<T, DIM, WeightPolicy>::Print() const {
+    std::cout << "====================\n====================\n====================\n";
+    std::cout << "= Particles\n";
+    std::cout << "====================\n====================\n====================\n";
+    for (const auto &p : *this) {
+        std::cout << p.v().transpose() << " " << p.nw() << "\n";
+    }
+    std::cout << "\n";
+}
+
+template <typename T, int DIM, typename WeightPolicy>
+void ParticleArray<T, DIM, WeightPolicy>::PrintSummary() const {
+    // count particles of each label
+    std::unordered_map<int, int> index_counter;
+    std::unordered_map<int, double> index_marginal;
+    for (int i = 0; i < size_; ++i) {
+        index_marginal[shape_id_[i]] += nw_[i];
+        index_counter[shape_id_[i]] += 1;
+    }
+
+    std::cout << "===== Particles Summary =====\n";
+    std::cout << "total particles=" << size_ << "\n";
+    std::cout << "(index, #particle)=";
+    for (auto key_val : index_counter) {
+        std::cout << "(" << key_val.first << "," << key_val.second << ")";
+    }
+    std::cout << "\n";
+
+    std::cout << "(index, marginal)=";
+    for (auto key_val : index_marginal) {
+        std::cout << "(" << key_val.first << "," << key_val.second << ")";
+    }
+    std::cout << "\n";
+}
+
+}   // namespace feh
@@ -1,6 +1,8 @@
 #include "renderer.h"
 
+#include <algorithm>
 #include <chrono>
+#include <cstring>
 #include <GL/gl.h>
 
 // GLM Mathematics
@@ -20,6 +22,9 @@
 #include "shaders/edge_detection_frag.i"
 #include "shaders/edgelist_comp.i"
 #include "shaders/oned_comp.i"
+#include "shaders/batch_mvp_vert.i"
+#include "shaders/oned_batch_comp.i"
+#include "shaders/oned_reduce_comp.i"
 
 namespace feh {
 
@@ -46,12 +51,24 @@ void main()
 
 bool Renderer::initialized_ = false;
 int Renderer::counter_ = 0;
+const int Renderer::kMaxBatchSize;
 
-Renderer::Renderer(int height, int width) : //, const std::string &name):
+// layout of the depth atlas used in batched search: kBatchGridCols x kBatchGridRows tiles
+static const int kBatchGridCols = 4;
+static const int kBatchGridRows = Renderer::kMaxBatchSize / kBatchGridCols;
+// margin of the scissor box around the region of interest, such that
+// 3x3 neighborhoods of pixels in the region are rendered
+static const int kROIMargin = 1;
+
+Renderer::Renderer(int height, int width, RenderBackend backend) : //, const std::string &name):
+        backend_(backend),
         output_with_GL_coordinate_system_(false),
         has_evidence_(false),
+        has_roi_(false),
         rows_(height),
         cols_(width),
+        roi_(0, 0, width, height),
+        scissor_(0, 0, width, height),
         window_(nullptr),
         name_("GLRender" + std::to_string(counter_++)),
         color_texture_(0),
@@ -62,8 +79,24 @@ Renderer::Renderer(int height, int width) : //, const std::string &name):
         depth_shader_(nullptr),
         edge_shader_(nullptr),
         edgelist_shader_(nullptr),
-        oned_shader_(nullptr)
+        oned_shader_(nullptr),
+        batch_depth_shader_(nullptr),
+        oned_batch_shader_(nullptr),
+        batch_fbo_(0),
+        batch_depth_texture_(0),
+        batch_model_buffer_(0),
+        batch_edgelist_buffer_(0),
+        batch_capacity_(0),
+        reduce_shader_(nullptr),
+        edgelist_capacity_(0)
 {
+    if (backend_ == RenderBackend::SOFTWARE) {
+        name_ = "SWRender" + std::to_string(counter_ - 1);
+        rasterizer_.reset(new SoftwareRasterizer(rows_, cols_));
+        LOG(INFO) << "software rasterizer initialized";
+        return;
+    }
+
     if (!initialized_) {
         glfwInit();
         initialized_ = true;
@@ -103,6 +136,10 @@ Renderer::Renderer(int height, int width) : //, const std::string &name):
     edgelist_shader_ = std::make_shared<Shader>("", "", edgelist_comp);
     oned_shader_ = std::make_shared<Shader>("", "", oned_comp);
 
+    batch_depth_shader_ = std::make_shared<Shader>(batch_mvp_vert, "", "");
+    oned_batch_shader_ = std::make_shared<Shader>("", "", oned_batch_comp);
+    reduce_shader_ = std::make_shared<Shader>("", "", oned_reduce_comp);
+
     LOG(INFO) << "shader(s) initialized";
 
     ///////////////////////////////////////////////////
@@ -123,12 +160,74 @@ Renderer::Renderer(int height, int width) : //, const std::string &name):
 
 }
 
+Renderer::Renderer(const std::shared_ptr<Renderer> &parent):
+        parent_(parent->parent_ ? parent->parent_ : parent),
+        backend_(parent->backend_),
+        output_with_GL_coordinate_system_(parent->output_with_GL_coordinate_system_),
+        has_evidence_(parent->has_evidence_),
+        has_roi_(false),
+        fx_(parent->fx_), fy_(parent->fy_), cx_(parent->cx_), cy_(parent->cy_),
+        z_near_(parent->z_near_), z_far_(parent->z_far_),
+        rows_(parent->rows_),
+        cols_(parent->cols_),
+        roi_(0, 0, parent->cols_, parent->rows_),
+        scissor_(0, 0, parent->cols_, parent->rows_),
+        num_vertices_(0),
+        num_faces_(0),
+        window_(parent->window_),
+        name_(parent->name_ + "." + std::to_string(counter_++)),
+        fbo_(parent->fbo_),
+        vao_(0), vbo_(0), ebo_(0),
+        vao_quad_(parent->vao_quad_), vbo_quad_(parent->vbo_quad_), ebo_quad_(parent->ebo_quad_),
+        color_texture_(parent->color_texture_),
+        depth_texture_(parent->depth_texture_),
+        evidence_buffer_(parent->evidence_buffer_),
+        evidence_dir_buffer_(parent->evidence_dir_buffer_),
+        score_and_corner_buffer_(parent->score_and_corner_buffer_),
+        depth_shader_(parent->depth_shader_),
+        edge_shader_(parent->edge_shader_),
+        edgelist_shader_(parent->edgelist_shader_),
+        oned_shader_(parent->oned_shader_),
+        edgelist_buffer_(parent->edgelist_buffer_),
+        edgepixel_counter_buffer_(parent->edgepixel_counter_buffer_),
+        edgepixel_match_counter_buffer_(parent->edgepixel_match_counter_buffer_),
+        batch_depth_shader_(parent->batch_depth_shader_),
+        oned_batch_shader_(parent->oned_batch_shader_),
+        batch_fbo_(0),
+        batch_depth_texture_(0),
+        batch_model_buffer_(0),
+        batch_edgelist_buffer_(0),
+        batch_capacity_(0),
+        reduce_shader_(parent->reduce_shader_),
+        edgelist_capacity_(parent->edgelist_capacity_)
+{
+    if (parent->rasterizer_) {
+        rasterizer_.reset(new SoftwareRasterizer(rows_, cols_));
+        rasterizer_->ShareEvidence(*parent->rasterizer_);
+        return;
+    }
+    // vertex array objects are not shared among contexts, but we are in the same context
+    glfwMakeContextCurrent(window_);
+    glGenVertexArrays(1, &vao_);
+    glGenBuffers(1, &vbo_);
+    glGenBuffers(1, &ebo_);
+}
+
 Renderer::~Renderer() {
+    if (rasterizer_) return;
     glfwMakeContextCurrent(window_);
+    // handles may outlive the renderer, complete their transfers while the pixel buffers exist
+    for (auto &weak : readbacks_) {
+        if (auto readback = weak.lock()) readback->Wait();
+    }
     // clean up vertex buffers
     if (vao_) glDeleteVertexArrays(1, &vao_);
     if (vbo_) glDeleteBuffers(1, &vbo_);
     if (ebo_) glDeleteBuffers(1, &ebo_);
+    // pixel buffers of asynchronous readback
+    if (!pbos_.empty()) glDeleteBuffers(pbos_.size(), &pbos_[0]);
+    // everything else is owned by the parent
+    if (parent_) return;
 
     // clean up quad buffers
     if (vao_quad_) glDeleteVertexArrays(1, &vao_quad_);
@@ -150,6 +249,12 @@ Renderer::~Renderer() {
     if (evidence_dir_buffer_) glDeleteTextures(1, &evidence_dir_buffer_);
     if (score_and_corner_buffer_) glDeleteBuffers(1, &score_and_corner_buffer_);
 
+    // clean up batched search
+    if (batch_depth_texture_) glDeleteTextures(1, &batch_depth_texture_);
+    if (batch_fbo_) glDeleteFramebuffers(1, &batch_fbo_);
+    if (batch_model_buffer_) glDeleteBuffers(1, &batch_model_buffer_);
+    if (batch_edgelist_buffer_) glDeleteBuffers(1, &batch_edgelist_buffer_);
+
     if (window_) glfwDestroyWindow(window_);
 
 }
@@ -259,13 +364,11 @@ void Renderer::InitializeFramebuffer() {
 }
 
 void Renderer::SetCamera(float z_near, float z_far, float fx, float fy, float cx, float cy) {
-    glfwMakeContextCurrent(window_);
     float intrinsics[] = {fx, fy, cx, cy};
     SetCamera(z_near, z_far, intrinsics);
 }
 
 void Renderer::SetCamera(float zNear, float zFar, const float *intrinsics) {
-    glfwMakeContextCurrent(window_);
     // store intrinsics
     fx_ = intrinsics[0];
     fy_ = intrinsics[1];
@@ -298,6 +401,13 @@ void Renderer::SetCamera(float zNear, float zFar, const float *intrinsics) {
 //    projection = glm::scale(projection, glm::vec3(1, -1, 1));
     std::cout << "projection matrix=\n" << glm::to_string(projection) << "\n";
 
+    if (rasterizer_) {
+        rasterizer_->SetProjection(zNear, zFar, glm::value_ptr(projection));
+        rasterizer_->SetView(vision_to_graphics);
+        return;
+    }
+
+    glfwMakeContextCurrent(window_);
 
     if (depth_shader_) {
         depth_shader_->Use();
@@ -309,6 +419,16 @@ void Renderer::SetCamera(float zNear, float zFar, const float *intrinsics) {
                            glm::value_ptr(projection));
     }
 
+    if (batch_depth_shader_) {
+        batch_depth_shader_->Use();
+        glUniformMatrix4fv(glGetUniformLocation(batch_depth_shader_->Program, "view"),
+                           1, GL_FALSE,
+                           vision_to_graphics.data());
+        glUniformMatrix4fv(glGetUniformLocation(batch_depth_shader_->Program, "projection"),
+                           1, GL_FALSE,
+                           glm::value_ptr(projection));
+    }
+
     if (edgelist_shader_) {
         edgelist_shader_->SafeSetUniform("z_near", zNear);
         edgelist_shader_->SafeSetUniform("z_far", zFar);
@@ -318,10 +438,14 @@ void Renderer::SetCamera(float zNear, float zFar, const float *intrinsics) {
         oned_shader_->SafeSetUniform("z_near", zNear);
         oned_shader_->SafeSetUniform("z_far", zFar);
     }
+
+    if (oned_batch_shader_) {
+        oned_batch_shader_->SafeSetUniform("z_near", zNear);
+        oned_batch_shader_->SafeSetUniform("z_far", zFar);
+    }
 }
 
 void Renderer::SetCamera(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &pose) {
-    glfwMakeContextCurrent(window_);
     // In OpenGL's view (camera) coordinate system, z is pointing toward us and y is pointing upward
     // In the conventional computer vision camera coordinate system, z is pointing forward and y is pointing to the floor.
     Eigen::Matrix<float, 4, 4, Eigen::ColMajor> vision_to_graphics;
@@ -331,15 +455,31 @@ void Renderer::SetCamera(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &pose
                         0, 0, 0, 1;
     Eigen::Matrix<float, 4, 4, Eigen::ColMajor> view = vision_to_graphics * pose;
 
+    if (rasterizer_) {
+        rasterizer_->SetView(view);
+        return;
+    }
+
+    glfwMakeContextCurrent(window_);
     if (depth_shader_) {
         depth_shader_->Use();
         glUniformMatrix4fv(glGetUniformLocation(depth_shader_->Program, "view"), 1, GL_FALSE,
                            view.data());
     }
+
+    if (batch_depth_shader_) {
+        batch_depth_shader_->Use();
+        glUniformMatrix4fv(glGetUniformLocation(batch_depth_shader_->Program, "view"), 1, GL_FALSE,
+                           view.data());
+    }
 }
 
 
 void Renderer::UploadEvidence(uint8_t *data_ptr) {
+    if (rasterizer_) {
+        rasterizer_->UploadEvidence(data_ptr);
+        return;
+    }
     glfwMakeContextCurrent(window_);
     uint32_t *uint32_array = new uint32_t[rows_ * cols_];
     for (int i = 0; i < rows_ * cols_; ++i) uint32_array[i] = data_ptr[i];
@@ -354,6 +494,10 @@ void Renderer::UploadEvidence(uint8_t *data_ptr) {
 }
 
 void Renderer::UploadEvidenceDirection(float *data_ptr) {
+    if (rasterizer_) {
+        rasterizer_->UploadEvidenceDirection(data_ptr);
+        return;
+    }
     glfwMakeContextCurrent(window_);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, evidence_dir_buffer_);
     glBufferData(GL_SHADER_STORAGE_BUFFER,
@@ -365,10 +509,64 @@ void Renderer::UploadEvidenceDirection(float *data_ptr) {
 }
 
 
+void Renderer::SetROI(const cv::Rect &roi) {
+    has_roi_ = true;
+    roi_ = roi & cv::Rect(0, 0, cols_, rows_);
+    scissor_ = cv::Rect(roi_.x - kROIMargin, roi_.y - kROIMargin,
+                        roi_.width + 2 * kROIMargin, roi_.height + 2 * kROIMargin) & cv::Rect(0, 0, cols_, rows_);
+    if (rasterizer_) rasterizer_->SetROI(roi_.x, roi_.y, roi_.width, roi_.height);
+}
+
+void Renderer::ClearROI() {
+    has_roi_ = false;
+    roi_ = scissor_ = cv::Rect(0, 0, cols_, rows_);
+    if (rasterizer_) rasterizer_->ClearROI();
+}
+
+void Renderer::BeginROI() {
+    if (!has_roi_) return;
+    // also restricts glClear
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(scissor_.x, scissor_.y, scissor_.width, scissor_.height);
+}
+
+void Renderer::EndROI() {
+    if (has_roi_) glDisable(GL_SCISSOR_TEST);
+}
+
+template <typename T>
+void Renderer::ReadPixelsInROI(GLenum format, GLenum type, T background, T *out) {
+    if (!has_roi_) {
+        glReadPixels(0, 0, cols_, rows_, format, type, out);
+        return;
+    }
+    // pixels outside of the region are not rendered, fill them with background
+    std::fill(out, out + rows_ * cols_, background);
+    if (roi_.area() == 0) return;
+    glPixelStorei(GL_PACK_ROW_LENGTH, cols_);
+    glReadPixels(roi_.x, roi_.y, roi_.width, roi_.height, format, type, out + roi_.y * cols_ + roi_.x);
+    glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+}
+
+void Renderer::DispatchInROI(const ShaderPtr &shader) {
+    // the shader is in use
+    if (has_roi_) {
+        glUniform4i(glGetUniformLocation(shader->Program, "roi"), roi_.x, roi_.y, roi_.width, roi_.height);
+        glDispatchCompute((roi_.width + 15) / 16, (roi_.height + 15) / 16, 1);
+    } else {
+        glUniform4i(glGetUniformLocation(shader->Program, "roi"), 0, 0, cols_, rows_);
+        glDispatchCompute(cols_ / 16.0, rows_ / 16.0, 1);
+    }
+}
+
 void Renderer::SetMesh(float *vertices, int num_vertices, int *faces, int num_faces) {
-    glfwMakeContextCurrent(window_);
     num_vertices_ = num_vertices;
     num_faces_ = num_faces;
+    if (rasterizer_) {
+        rasterizer_->SetMesh(vertices, num_vertices, faces, num_faces);
+        return;
+    }
+    glfwMakeContextCurrent(window_);
     glBindVertexArray(vao_);
     glBindBuffer(GL_ARRAY_BUFFER, vbo_);
     glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 3 * num_vertices, vertices, GL_STATIC_DRAW);
@@ -383,8 +581,7 @@ void Renderer::SetMesh(float *vertices, int num_vertices, int *faces, int num_fa
     glBindVertexArray(0);
 }
 
-void Renderer::RenderDepth(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model_in, float *out) {
-    glfwMakeContextCurrent(window_);
+void Renderer::DrawDepth(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model_in) {
     // Render a depth map.
     glm::vec4 color(1.0, 1.0, 1.0, 1.0);
     glDisable(GL_STENCIL_TEST);
@@ -393,40 +590,7 @@ void Renderer::RenderDepth(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &mo
     glDepthMask(GL_TRUE);
 
     glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
-    // Clear the color buffer & depth buffer
-    glClearColor(color.r, color.g, color.b, color.a);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-
-    // Setup the shader for inner region of the object
-    depth_shader_->Use();
-    // Calculate the model matrix for each object and pass it to shader before drawing
-    glUniformMatrix4fv(glGetUniformLocation(depth_shader_->Program, "model"), 1, GL_FALSE, model_in.data());
-    glBindVertexArray(vao_);
-    glDrawElements(GL_TRIANGLES, 3 * num_faces_, GL_UNSIGNED_INT, 0);
-
-    if (out) {
-        glReadPixels(0, 0, cols_, rows_, GL_DEPTH_COMPONENT, GL_FLOAT, out);
-    }
-
-    // unbind texture
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glBindVertexArray(0);
-    // unbind framebuffer ONLY AFTER copying values from graphic memory to normal memory
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-}
-
-void Renderer::RenderEdge(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model_in, uint8_t *out) {
-//    model_ = glm::make_mat4(model_in.data());
-    glfwMakeContextCurrent(window_);
-    // Render a depth map.
-    glm::vec4 color(1.0, 1.0, 1.0, 1.0);
-    glDisable(GL_STENCIL_TEST);
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_LESS);
-    glDepthMask(GL_TRUE);
-
-    // Bind to the color buffer
-    glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+    BeginROI();
     // Clear the color buffer & depth buffer
     glClearColor(color.r, color.g, color.b, color.a);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
@@ -439,6 +603,10 @@ void Renderer::RenderEdge(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &mod
     glBindVertexArray(vao_);
     // Draw
     glDrawElements(GL_TRIANGLES, 3 * num_faces_, GL_UNSIGNED_INT, 0);
+}
+
+void Renderer::DrawEdge(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model_in) {
+    DrawDepth(model_in);
 
     // apply the flip shader
     glDisable(GL_DEPTH_TEST);   // disable depth test since we are drawing anyway ...
@@ -451,89 +619,228 @@ void Renderer::RenderEdge(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &mod
 
     glBindVertexArray(vao_quad_);
     glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+}
 
-    if (out) {
-        // No need to manually flip values, since the shader handles this.
-        glReadPixels(0, 0, cols_, rows_, GL_RED, GL_UNSIGNED_BYTE, out);
-    }
+void Renderer::DrawWireframe(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model_in) {
+    glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+    DrawDepth(model_in);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+}
 
+void Renderer::EndDraw() {
     // unbind texture
     glBindTexture(GL_TEXTURE_2D, 0);
     glBindVertexArray(0);
     // unbind framebuffer ONLY AFTER copying values from graphic memory to normal memory
+    EndROI();
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
+void Renderer::RenderDepth(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model_in, float *out) {
+    if (rasterizer_) {
+        rasterizer_->RenderDepth(model_in, out);
+        return;
+    }
+    glfwMakeContextCurrent(window_);
+    DrawDepth(model_in);
+    if (out) {
+        ReadPixelsInROI(GL_DEPTH_COMPONENT, GL_FLOAT, 1.0f, out);
+    }
+    EndDraw();
+}
 
-void Renderer::RenderWireframe(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model_in, uint8_t *out) {
-//    model_ = glm::make_mat4(model_in.data());
-        glfwMakeContextCurrent(window_);
-        // Render a depth map.
-        glm::vec4 color(1.0, 1.0, 1.0, 1.0);
-        glDisable(GL_STENCIL_TEST);
-        glEnable(GL_DEPTH_TEST);
-        glDepthFunc(GL_LESS);
-        glDepthMask(GL_TRUE);
-
-        // Bind to the color buffer
-        glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
-        // Clear the color buffer & depth buffer
-        glClearColor(color.r, color.g, color.b, color.a);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-
-        // Setup the shader for inner region of the object
-        depth_shader_->Use();
-        // Calculate the model matrix for each object and pass it to shader before drawing
-        glUniformMatrix4fv(glGetUniformLocation(depth_shader_->Program, "model"), 1, GL_FALSE, model_in.data());
-        // Bind Vertex Array Object
-        glBindVertexArray(vao_);
-        // Draw
-        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-        glDrawElements(GL_TRIANGLES, 3 * num_faces_, GL_UNSIGNED_INT, 0);
-        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-
-        if (out) {
-            // No need to manually flip values, since the shader handles this.
-            glReadPixels(0, 0, cols_, rows_, GL_RED, GL_UNSIGNED_BYTE, out);
-        }
+void Renderer::RenderEdge(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model_in, uint8_t *out) {
+    if (rasterizer_) {
+        rasterizer_->RenderEdge(model_in, out);
+        return;
+    }
+    glfwMakeContextCurrent(window_);
+    DrawEdge(model_in);
+    if (out) {
+        // No need to manually flip values, since the shader handles this.
+        ReadPixelsInROI<uint8_t>(GL_RED, GL_UNSIGNED_BYTE, 0, out);
+    }
+    EndDraw();
+}
 
-        // unbind texture
-        glBindTexture(GL_TEXTURE_2D, 0);
-        glBindVertexArray(0);
-        // unbind framebuffer ONLY AFTER copying values from graphic memory to normal memory
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+void Renderer::RenderWireframe(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model_in, uint8_t *out) {
+    if (rasterizer_) {
+        rasterizer_->RenderWireframe(model_in, out);
+        return;
+    }
+    glfwMakeContextCurrent(window_);
+    DrawWireframe(model_in);
+    if (out) {
+        ReadPixelsInROI<uint8_t>(GL_RED, GL_UNSIGNED_BYTE, 255, out);
+    }
+    EndDraw();
 }
 
 void Renderer::RenderMask(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model_in, uint8_t *out) {
+    if (rasterizer_) {
+        rasterizer_->RenderMask(model_in, out);
+        return;
+    }
     glfwMakeContextCurrent(window_);
-    // Render a depth map.
-    glm::vec4 color(1.0, 1.0, 1.0, 1.0);
-    glDisable(GL_STENCIL_TEST);
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_LESS);
-    glDepthMask(GL_TRUE);
+    // the color buffer is cleared to white and the object is drawn in black
+    DrawDepth(model_in);
+    if (out) {
+        ReadPixelsInROI<uint8_t>(GL_RED, GL_UNSIGNED_BYTE, 255, out);
+    }
+    EndDraw();
+}
 
-    glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
-    // Clear the color buffer & depth buffer
-    glClearColor(color.r, color.g, color.b, color.a);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+////////////////////////////////////////////////////////////////////////////////
+// Asynchronous readback
+////////////////////////////////////////////////////////////////////////////////
+RenderReadbackPtr Renderer::RenderDepthAsync(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model_in, float *out) {
+    if (rasterizer_) {
+        rasterizer_->RenderDepth(model_in, out);
+        return std::make_shared<RenderReadback>();
+    }
+    glfwMakeContextCurrent(window_);
+    DrawDepth(model_in);
+    auto readback = StartReadback(GL_DEPTH_COMPONENT, GL_FLOAT, 1.0f, out);
+    EndDraw();
+    return readback;
+}
 
-    // Setup the shader for inner region of the object
-    depth_shader_->Use();
-    // Calculate the model matrix for each object and pass it to shader before drawing
-    glUniformMatrix4fv(glGetUniformLocation(depth_shader_->Program, "model"), 1, GL_FALSE, model_in.data());
-    glBindVertexArray(vao_);
-    glDrawElements(GL_TRIANGLES, 3 * num_faces_, GL_UNSIGNED_INT, 0);
+RenderReadbackPtr Renderer::RenderEdgeAsync(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model_in, uint8_t *out) {
+    if (rasterizer_) {
+        rasterizer_->RenderEdge(model_in, out);
+        return std::make_shared<RenderReadback>();
+    }
+    glfwMakeContextCurrent(window_);
+    DrawEdge(model_in);
+    auto readback = StartReadback<uint8_t>(GL_RED, GL_UNSIGNED_BYTE, 0, out);
+    EndDraw();
+    return readback;
+}
 
-    if (out) {
-        glReadPixels(0, 0, cols_, rows_, GL_RED, GL_UNSIGNED_BYTE, out);
+RenderReadbackPtr Renderer::RenderWireframeAsync(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model_in, uint8_t *out) {
+    if (rasterizer_) {
+        rasterizer_->RenderWireframe(model_in, out);
+        return std::make_shared<RenderReadback>();
     }
+    glfwMakeContextCurrent(window_);
+    DrawWireframe(model_in);
+    auto readback = StartReadback<uint8_t>(GL_RED, GL_UNSIGNED_BYTE, 255, out);
+    EndDraw();
+    return readback;
+}
 
-    // unbind texture
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glBindVertexArray(0);
-    // unbind framebuffer ONLY AFTER copying values from graphic memory to normal memory
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+RenderReadbackPtr Renderer::RenderMaskAsync(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model_in, uint8_t *out) {
+    if (rasterizer_) {
+        rasterizer_->RenderMask(model_in, out);
+        return std::make_shared<RenderReadback>();
+    }
+    glfwMakeContextCurrent(window_);
+    DrawDepth(model_in);
+    auto readback = StartReadback<uint8_t>(GL_RED, GL_UNSIGNED_BYTE, 255, out);
+    EndDraw();
+    return readback;
+}
+
+template <typename T>
+RenderReadbackPtr Renderer::StartReadback(GLenum format, GLenum type, T background, T *out) {
+    CHECK(out) << "null output of asynchronous readback";
+    // pixel buffer objects are recycled, all of them can hold a full float image
+    GLuint pbo;
+    if (free_pbos_.empty()) {
+        glGenBuffers(1, &pbo);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, rows_ * cols_ * sizeof(float), NULL, GL_STREAM_READ);
+        pbos_.push_back(pbo);
+    } else {
+        pbo = free_pbos_.back();
+        free_pbos_.pop_back();
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+    }
+
+    // same layout as the output, pixels outside of the region of interest are not read
+    glPixelStorei(GL_PACK_ROW_LENGTH, cols_);
+    glReadPixels(roi_.x, roi_.y, roi_.width, roi_.height, format, type,
+                 (void *)((roi_.y * cols_ + roi_.x) * sizeof(T)));
+    glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    auto readback = std::make_shared<RenderReadback>();
+    readbacks_.erase(std::remove_if(readbacks_.begin(), readbacks_.end(),
+                                    [](const std::weak_ptr<RenderReadback> &weak) {
+                                        auto r = weak.lock();
+                                        return !r || r->done_;
+                                    }),
+                     readbacks_.end());
+    readbacks_.push_back(readback);
+    readback->renderer_ = this;
+    readback->pbo_ = pbo;
+    readback->fence_ = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // the transfer has to start before we block on the fence
+    glFlush();
+    readback->done_ = false;
+    cv::Rect roi(roi_);
+    int rows(rows_), cols(cols_);
+    bool has_roi(has_roi_);
+    readback->copy_ = [out, background, roi, rows, cols, has_roi](const void *ptr) {
+        if (has_roi) std::fill(out, out + rows * cols, background);
+        for (int i = roi.y; i < roi.y + roi.height; ++i) {
+            memcpy(out + i * cols + roi.x, (const T *)ptr + i * cols + roi.x, roi.width * sizeof(T));
+        }
+    };
+    return readback;
+}
+
+RenderReadback::RenderReadback():
+    renderer_(nullptr),
+    pbo_(0),
+    fence_(0),
+    done_(true)
+{}
+
+RenderReadback::~RenderReadback() {
+    // return the pixel buffer to the renderer
+    Wait();
+}
+
+bool RenderReadback::Ready() {
+    if (done_) return true;
+    renderer_->Use();
+    GLenum status = glClientWaitSync(fence_, 0, 0);
+    return status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+}
+
+void RenderReadback::Wait() {
+    if (done_) return;
+    renderer_->Use();
+    GLenum status;
+    do {
+        // 1 ms per round
+        status = glClientWaitSync(fence_, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+    } while (status == GL_TIMEOUT_EXPIRED);
+    CHECK_NE(status, GL_WAIT_FAILED) << "failed to wait for readback";
+    glDeleteSync(fence_);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo_);
+    const void *ptr = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                                       renderer_->rows() * renderer_->cols() * sizeof(float),
+                                       GL_MAP_READ_BIT);
+    CHECK(ptr) << "failed to map pixel buffer";
+    copy_(ptr);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    renderer_->free_pbos_.push_back(pbo_);
+    done_ = true;
+
+    for (auto &callback : callbacks_) callback();
+    callbacks_.clear();
+}
+
+void RenderReadback::Then(std::function<void()> callback) {
+    if (done_) {
+        callback();
+    } else {
+        callbacks_.push_back(callback);
+    }
 }
 
 
@@ -566,26 +873,33 @@ void Renderer::InitializeForLikelihood() {
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
     LOG(INFO) << "evidence direction buffer created";
 
-    // buffer for output scores and bounding box corners
+    // buffer for output scores and bounding box corners, 6 floats per pose of a batch
     glGenBuffers(1, &score_and_corner_buffer_);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, score_and_corner_buffer_);
     glBufferData(GL_SHADER_STORAGE_BUFFER,
-                 6 * sizeof(float),
+                 kMaxBatchSize * 6 * sizeof(float),
                  NULL,
                  GL_DYNAMIC_READ);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
     LOG(INFO) << "score and corner buffer created";
 
     // for edge list with direction
-    int max_num_edge_pixels(0.1 * cols_ * rows_ * EdgePixel::DIM);
-    std::vector<float> edgepixels(max_num_edge_pixels, 0);
+    edgelist_capacity_ = 0.1 * cols_ * rows_;
+    reduce_shader_->Use();
+    glUniform2i(glGetUniformLocation(reduce_shader_->Program, "size"), cols_, rows_);
+    // edge pixels are packed on the device, see PackedEdgePixel
+    std::vector<PackedEdgePixel> edgepixels(edgelist_capacity_);
     glGenBuffers(1, &edgelist_buffer_);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, edgelist_buffer_);
     glBufferData(GL_SHADER_STORAGE_BUFFER,
-                 max_num_edge_pixels * sizeof(float),
+                 edgelist_capacity_ * sizeof(PackedEdgePixel),
                  &edgepixels[0],
                  GL_DYNAMIC_READ);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);  // unbind
+    edgelist_shader_->Use();
+    edgelist_shader_->SafeSetUniform("capacity", edgelist_capacity_);
+    oned_shader_->Use();
+    oned_shader_->SafeSetUniform("capacity", edgelist_capacity_);
 
     // the edgepixel counter buffer is used by both edgelist shader and likelihood shader
     glGenBuffers(1, &edgepixel_counter_buffer_);
@@ -609,6 +923,22 @@ void Renderer::InitializeForLikelihood() {
 /// ////////////////////////////////////////////////////////
 /// ////////////////////////////////////////////////////////
 void Renderer::ComputeEdgePixels(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model_in, std::vector<EdgePixel> &edgelist) {
+    if (rasterizer_) {
+        rasterizer_->ComputeEdgePixels(model_in, edgelist);
+        return;
+    }
+    std::vector<PackedEdgePixel> packed;
+    ComputeEdgePixels(model_in, packed);
+    UnpackEdgelist(packed, edgelist);
+}
+
+void Renderer::ComputeEdgePixels(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model_in, std::vector<PackedEdgePixel> &edgelist) {
+    if (rasterizer_) {
+        std::vector<EdgePixel> unpacked;
+        rasterizer_->ComputeEdgePixels(model_in, unpacked);
+        PackEdgelist(unpacked, edgelist);
+        return;
+    }
     glfwMakeContextCurrent(window_);
     // Render a depth map.
     glDisable(GL_STENCIL_TEST);
@@ -617,6 +947,7 @@ void Renderer::ComputeEdgePixels(const Eigen::Matrix<float, 4, 4, Eigen::ColMajo
     glDepthMask(GL_TRUE);
 
     glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+    BeginROI();
     // Clear the color buffer & depth buffer
     glClearColor(1.0f, 1.0f, 1.0f, 1.0f);   // r, g, b, a; range 0 -- 1
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
@@ -645,29 +976,16 @@ void Renderer::ComputeEdgePixels(const Eigen::Matrix<float, 4, 4, Eigen::ColMajo
     glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
     glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 1, edgepixel_counter_buffer_);
 
-    glDispatchCompute(cols_ / 16.0, rows_ / 16.0, 1);
-    glMemoryBarrier(GL_SHADER_STORAGE_BUFFER);
-
-    // read out edgepixel list
-    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, edgepixel_counter_buffer_);
-    glGetBufferSubData(GL_ATOMIC_COUNTER_BUFFER,
-                       0,
-                       sizeof(int),
-                       (void *)&edgepixel_counter);
-    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+    DispatchInROI(edgelist_shader_);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_ATOMIC_COUNTER_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
 
-    edgelist.resize(edgepixel_counter);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, edgelist_buffer_);
-    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER,
-                       0,
-                       edgepixel_counter * EdgePixel::DIM * sizeof(float),
-                       (void *)&edgelist[0]);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    ReadEdgelist(edgelist);
 
     // unbind texture
     glBindTexture(GL_TEXTURE_2D, 0);
     glBindVertexArray(0);
     // unbind framebuffer ONLY AFTER copying values from graphic memory to normal memory
+    EndROI();
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
@@ -681,13 +999,70 @@ void Renderer::ComputeEdgePixels(const Eigen::Matrix<float, 4, 4, Eigen::ColMajo
 ////////////////////////////////////////////////////////////////////////////////
 void Renderer::OneDimSearch(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model_in,
                             std::vector<EdgePixel> &edgelist) {
+    if (rasterizer_) {
+        rasterizer_->OneDimSearch(model_in, edgelist);
+        return;
+    }
+    std::vector<PackedEdgePixel> packed;
+    OneDimSearch(model_in, packed);
+    UnpackEdgelist(packed, edgelist);
+}
+
+void Renderer::OneDimSearch(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model_in,
+                            std::vector<PackedEdgePixel> &edgelist) {
+    if (rasterizer_) {
+        std::vector<EdgePixel> unpacked;
+        rasterizer_->OneDimSearch(model_in, unpacked);
+        PackEdgelist(unpacked, edgelist);
+        return;
+    }
     glfwMakeContextCurrent(window_);
+    RenderAndSearch(model_in);
+    ReadEdgelist(edgelist);
+}
+
+void Renderer::ReadEdgelist(std::vector<PackedEdgePixel> &edgelist) {
+    int edgepixel_counter(0);
+    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, edgepixel_counter_buffer_);
+    glGetBufferSubData(GL_ATOMIC_COUNTER_BUFFER,
+                       0,
+                       sizeof(int),
+                       (void *)&edgepixel_counter);
+    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+
+    // the counter keeps increasing beyond capacity
+    edgelist.resize(std::min(edgepixel_counter, edgelist_capacity_));
+    if (edgelist.empty()) return;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, edgelist_buffer_);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER,
+                       0,
+                       edgelist.size() * sizeof(PackedEdgePixel),
+                       (void *)&edgelist[0]);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void Renderer::OneDimSearch(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model_in,
+                            std::array<float, 6> &score_and_corner) {
+    if (rasterizer_) {
+        std::vector<EdgePixel> edgelist;
+        rasterizer_->OneDimSearch(model_in, edgelist);
+        ReduceEdgelist(edgelist, rows_, cols_, score_and_corner);
+        return;
+    }
+    glfwMakeContextCurrent(window_);
+    RenderAndSearch(model_in);
+    // the atomic counter holds the number of edge pixels
+    ReduceOnDevice(edgelist_buffer_, edgepixel_counter_buffer_, 0, edgelist_capacity_, 1, &score_and_corner[0]);
+}
+
+void Renderer::RenderAndSearch(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model_in) {
     glDisable(GL_STENCIL_TEST);
     glEnable(GL_DEPTH_TEST);
     glDepthFunc(GL_LESS);
     glDepthMask(GL_TRUE);
 
     glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+    BeginROI();
     glClearColor(1.0f, 1.0f, 1.0f, 1.0f);   // r, g, b, a; range 0 -- 1
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
@@ -700,6 +1075,11 @@ void Renderer::OneDimSearch(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &m
 
     // we got the depth image in color_texture_
     // now need to extract edge pixels and search directions from it
+    // For one dimensional search, we need the following:
+    // 1) evidence texture
+    // 2) predicted edge list
+    // 3) edge pixel counter
+    // 4) matched edge pixel counter
     oned_shader_->Use();
     oned_shader_->SafeSetUniform("this_texture", 0);
     glActiveTexture(GL_TEXTURE0);
@@ -721,57 +1101,232 @@ void Renderer::OneDimSearch(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &m
     glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
     glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 1, edgepixel_match_counter_buffer_);
 
-    glDispatchCompute(cols_ / 16.0, rows_ / 16.0, 1);
-    glMemoryBarrier(GL_SHADER_STORAGE_BUFFER);
+    DispatchInROI(oned_shader_);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_ATOMIC_COUNTER_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
 
+    // unbind texture
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindVertexArray(0);
+    EndROI();
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
 
-//    // Second Pass -- compute matching ratio and average matching distance
-//    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, edgelist_buffer_);
-//    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, evidence_buffer_);
-//    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, evidence_dir_buffer_);
-//    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, score_and_corner_buffer_);
-//    glDispatchCompute(1, 1, 1);
-////    glMemoryBarrier(GL_SHADER_STORAGE_BUFFER);
-//    glBindBuffer(GL_SHADER_STORAGE_BUFFER, score_and_corner_buffer_);
-//    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER,
-//                       0,
-//                       sizeof(float) * 6,
-//                       (void *)&out[0]);
+void Renderer::ReduceOnDevice(GLuint edgelist_buffer, GLuint counter_buffer,
+                              int header, int capacity, int num_poses, float *out) {
+    // one work group per pose
+    reduce_shader_->Use();
+    reduce_shader_->SafeSetUniform("header", header);
+    reduce_shader_->SafeSetUniform("capacity", capacity);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, edgelist_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, score_and_corner_buffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, counter_buffer);
+    glDispatchCompute(num_poses, 1, 1);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    // only 6 floats per pose leave the device
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, score_and_corner_buffer_);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER,
+                       0,
+                       num_poses * 6 * sizeof(float),
+                       (void *)out);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
 
-    // For one dimensional search, we need the following:
-    // 1) evidence texture
-    // 2) predicted edge list (already bound)
-    // 3) edge pixel counter (already bound)
-    // 4) matched edge pixel counter
+void Renderer::InitializeForBatch() {
+    if (parent_) {
+        // share the depth atlas and batch buffers of the parent
+        if (parent_->batch_fbo_ == 0) parent_->InitializeForBatch();
+        batch_fbo_ = parent_->batch_fbo_;
+        batch_depth_texture_ = parent_->batch_depth_texture_;
+        batch_model_buffer_ = parent_->batch_model_buffer_;
+        batch_edgelist_buffer_ = parent_->batch_edgelist_buffer_;
+        batch_capacity_ = parent_->batch_capacity_;
+        return;
+    }
+    glfwMakeContextCurrent(window_);
+    int atlas_cols = kBatchGridCols * cols_;
+    int atlas_rows = kBatchGridRows * rows_;
+    GLint max_texture_size;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+    CHECK_LE(std::max(atlas_cols, atlas_rows), max_texture_size) << "depth atlas too large";
+
+    // depth-only framebuffer holding the atlas
+    glGenFramebuffers(1, &batch_fbo_);
+    glBindFramebuffer(GL_FRAMEBUFFER, batch_fbo_);
+    glGenTextures(1, &batch_depth_texture_);
+    glBindTexture(GL_TEXTURE_2D, batch_depth_texture_);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, atlas_cols, atlas_rows, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, batch_depth_texture_, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        LOG(FATAL) << "ERROR::FRAMEBUFFER:: Batch framebuffer is not complete!";
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
+    // model matrices, std430 layout of mat4 is the same as column major Eigen matrices
+    glGenBuffers(1, &batch_model_buffer_);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, batch_model_buffer_);
+    glBufferData(GL_SHADER_STORAGE_BUFFER,
+                 kMaxBatchSize * 16 * sizeof(float),
+                 NULL,
+                 GL_DYNAMIC_DRAW);
 
-    // read out edgepixel list
-    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, edgepixel_counter_buffer_);
-    glGetBufferSubData(GL_ATOMIC_COUNTER_BUFFER,
-                       0,
-                       sizeof(int),
-                       (void *)&edgepixel_counter);
-    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+    // per-pose counters followed by per-pose edge lists, same capacity as edgelist_buffer_
+    batch_capacity_ = 0.1 * cols_ * rows_;
+    glGenBuffers(1, &batch_edgelist_buffer_);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, batch_edgelist_buffer_);
+    glBufferData(GL_SHADER_STORAGE_BUFFER,
+                 kMaxBatchSize * (sizeof(uint32_t) + batch_capacity_ * sizeof(PackedEdgePixel)),
+                 NULL,
+                 GL_DYNAMIC_READ);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
-    edgelist.resize(edgepixel_counter);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, edgelist_buffer_);
-    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER,
-                       0,
-                       edgepixel_counter * EdgePixel::DIM * sizeof(float),
-                       (void *)&edgelist[0]);
+    batch_depth_shader_->Use();
+    glUniform2i(glGetUniformLocation(batch_depth_shader_->Program, "grid"), kBatchGridCols, kBatchGridRows);
+    oned_batch_shader_->Use();
+    glUniform2i(glGetUniformLocation(oned_batch_shader_->Program, "grid"), kBatchGridCols, kBatchGridRows);
+    oned_batch_shader_->SafeSetUniform("capacity", batch_capacity_);
+    LOG(INFO) << "batch buffers created";
+}
+
+void Renderer::OneDimSearchBatch(const Mat4fColMajorList &models,
+                                 std::vector<std::vector<EdgePixel>> &edgelists) {
+    edgelists.resize(models.size());
+    if (rasterizer_) {
+        for (int i = 0; i < models.size(); ++i) {
+            rasterizer_->OneDimSearch(models[i], edgelists[i]);
+        }
+        return;
+    }
+    std::vector<std::vector<PackedEdgePixel>> packed;
+    OneDimSearchBatch(models, packed);
+    for (int i = 0; i < models.size(); ++i) {
+        UnpackEdgelist(packed[i], edgelists[i]);
+    }
+}
+
+void Renderer::OneDimSearchBatch(const Mat4fColMajorList &models,
+                                 std::vector<std::vector<PackedEdgePixel>> &edgelists) {
+    edgelists.resize(models.size());
+    if (rasterizer_) {
+        std::vector<EdgePixel> unpacked;
+        for (int i = 0; i < models.size(); ++i) {
+            rasterizer_->OneDimSearch(models[i], unpacked);
+            PackEdgelist(unpacked, edgelists[i]);
+        }
+        return;
+    }
+    glfwMakeContextCurrent(window_);
+    if (batch_fbo_ == 0) InitializeForBatch();
+
+    const size_t header_size = kMaxBatchSize * sizeof(uint32_t);
+    const size_t slice_size = batch_capacity_ * sizeof(PackedEdgePixel);
+    for (int start = 0; start < models.size(); start += kMaxBatchSize) {
+        int batch_size = std::min<int>(kMaxBatchSize, models.size() - start);
+        RenderAndSearchBatch(&models[start], batch_size);
+
+        // read out counters and edge lists with a single mapping
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, batch_edgelist_buffer_);
+        const uint8_t *ptr = (const uint8_t *)glMapBufferRange(GL_SHADER_STORAGE_BUFFER,
+                                                                0,
+                                                                header_size + batch_size * slice_size,
+                                                                GL_MAP_READ_BIT);
+        CHECK(ptr) << "failed to map batch edge list buffer";
+        const uint32_t *batch_counts = (const uint32_t *)ptr;
+        for (int i = 0; i < batch_size; ++i) {
+            auto &edgelist = edgelists[start + i];
+            // counters keep increasing beyond capacity
+            edgelist.resize(std::min<int>(batch_counts[i], batch_capacity_));
+            if (edgelist.empty()) continue;
+            memcpy(&edgelist[0], ptr + header_size + i * slice_size, edgelist.size() * sizeof(PackedEdgePixel));
+        }
+        glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+}
+
+void Renderer::OneDimSearchBatch(const Mat4fColMajorList &models,
+                                 std::vector<std::array<float, 6>> &score_and_corners) {
+    score_and_corners.resize(models.size());
+    if (rasterizer_) {
+        std::vector<EdgePixel> edgelist;
+        for (int i = 0; i < models.size(); ++i) {
+            rasterizer_->OneDimSearch(models[i], edgelist);
+            ReduceEdgelist(edgelist, rows_, cols_, score_and_corners[i]);
+        }
+        return;
+    }
+    glfwMakeContextCurrent(window_);
+    if (batch_fbo_ == 0) InitializeForBatch();
+
+    for (int start = 0; start < models.size(); start += kMaxBatchSize) {
+        int batch_size = std::min<int>(kMaxBatchSize, models.size() - start);
+        RenderAndSearchBatch(&models[start], batch_size);
+        // counters are stored in front of the edge lists, i.e., a header of kMaxBatchSize words
+        ReduceOnDevice(batch_edgelist_buffer_, batch_edgelist_buffer_, kMaxBatchSize, batch_capacity_,
+                       batch_size, &score_and_corners[start][0]);
+    }
+}
+
+void Renderer::RenderAndSearchBatch(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> *models, int batch_size) {
+    // upload model matrices & reset counters
+    std::vector<uint32_t> counts(kMaxBatchSize, 0);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, batch_model_buffer_);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, batch_size * 16 * sizeof(float), models[0].data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, batch_edgelist_buffer_);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, kMaxBatchSize * sizeof(uint32_t), &counts[0]);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
+    // render all the poses into the depth atlas with one instanced draw
+    glDisable(GL_STENCIL_TEST);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+    glBindFramebuffer(GL_FRAMEBUFFER, batch_fbo_);
+    glViewport(0, 0, kBatchGridCols * cols_, kBatchGridRows * rows_);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    for (int i = 0; i < 4; ++i) glEnable(GL_CLIP_DISTANCE0 + i);
+
+    batch_depth_shader_->Use();
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, batch_model_buffer_);
+    glBindVertexArray(vao_);
+    glDrawElementsInstanced(GL_TRIANGLES, 3 * num_faces_, GL_UNSIGNED_INT, 0, batch_size);
+
+    for (int i = 0; i < 4; ++i) glDisable(GL_CLIP_DISTANCE0 + i);
+    glViewport(0, 0, cols_, rows_);
+    glDisable(GL_DEPTH_TEST);
+
+    // search on all the tiles with one dispatch, z is the pose index
+    oned_batch_shader_->Use();
+    oned_batch_shader_->SafeSetUniform("this_texture", 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, batch_depth_texture_);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, batch_edgelist_buffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, evidence_buffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, evidence_dir_buffer_);
+
+    glDispatchCompute(cols_ / 16, rows_ / 16, batch_size);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
     // unbind texture
     glBindTexture(GL_TEXTURE_2D, 0);
     glBindVertexArray(0);
-    // unbind framebuffer ONLY AFTER copying values from graphic memory to normal memory
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
 }
 
 void Renderer::SetOneDimSearch(int search_line_length,
                                int intensity_thresh,
                                float direction_thresh) {
+    if (rasterizer_) {
+        rasterizer_->SetOneDimSearch(search_line_length, intensity_thresh, direction_thresh);
+        return;
+    }
 
     if (oned_shader_ == nullptr) return;
     if (search_line_length >= 0) {
@@ -783,12 +1338,33 @@ void Renderer::SetOneDimSearch(int search_line_length,
     if (direction_thresh >= 0) {
         oned_shader_->SafeSetUniform("direction_thresh", direction_thresh);
     }
+
+    if (oned_batch_shader_ == nullptr) return;
+    if (search_line_length >= 0) {
+        oned_batch_shader_->SafeSetUniform("search_line_length", search_line_length);
+    }
+    if (intensity_thresh >= 0) {
+        oned_batch_shader_->SafeSetUniform("intensity_thresh", intensity_thresh);
+    }
+    if (direction_thresh >= 0) {
+        oned_batch_shader_->SafeSetUniform("direction_thresh", direction_thresh);
+    }
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
 // UTILITY FUNCTIONS FOR THE RENDERER
 ////////////////////////////////////////////////////////////////////////////////
+RenderBackend RenderBackendFromString(const std::string &name) {
+    if (name == "opengl") {
+        return RenderBackend::OPENGL;
+    } else if (name == "software") {
+        return RenderBackend::SOFTWARE;
+    } else {
+        LOG(FATAL) << "unknown render backend: " << name;
+    }
+}
+
 void PrintGLVersionInfo() {
     const GLubyte *renderer = glGetString(GL_RENDERER);
     const GLubyte *vendor = glGetString(GL_VENDOR);
@@ -809,6 +1385,84 @@ void CheckCurrentFramebufferId() {
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+// GROUP OF RENDERERS
+////////////////////////////////////////////////////////////////////////////////
+RendererGroup::RendererGroup(int rows, int cols, RenderBackend backend):
+        rows_(rows),
+        cols_(cols),
+        backend_(backend),
+        z_near_(0.05f),
+        z_far_(5.0f),
+        has_camera_(false),
+        search_line_length_(-1),
+        intensity_thresh_(-1),
+        direction_thresh_(-1)
+{}
+
+void RendererGroup::SetCamera(float z_near, float z_far, float fx, float fy, float cx, float cy) {
+    z_near_ = z_near;
+    z_far_ = z_far;
+    intrinsics_ = {fx, fy, cx, cy};
+    has_camera_ = true;
+    for (auto r : members_) {
+        r->SetCamera(z_near_, z_far_, &intrinsics_[0]);
+    }
+}
+
+void RendererGroup::SetCamera(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &pose) {
+    if (members_.empty()) return;
+    if (backend_ == RenderBackend::SOFTWARE) {
+        // each rasterizer has its own view
+        for (auto r : members_) r->SetCamera(pose);
+    } else {
+        // uniforms of the shared shaders
+        members_.front()->SetCamera(pose);
+    }
+}
+
+void RendererGroup::SetOneDimSearch(int search_line_length, int intensity_thresh, float direction_thresh) {
+    search_line_length_ = search_line_length;
+    intensity_thresh_ = intensity_thresh;
+    direction_thresh_ = direction_thresh;
+    for (auto r : members_) {
+        r->SetOneDimSearch(search_line_length_, intensity_thresh_, direction_thresh_);
+    }
+}
+
+RendererPtr RendererGroup::AddMesh(const Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> &vertices,
+                                   const Eigen::Matrix<int, Eigen::Dynamic, 3, Eigen::RowMajor> &faces) {
+    RendererPtr r;
+    if (members_.empty()) {
+        r = std::make_shared<Renderer>(rows_, cols_, backend_);
+    } else {
+        r = std::make_shared<Renderer>(members_.front());
+    }
+    if (has_camera_) r->SetCamera(z_near_, z_far_, &intrinsics_[0]);
+    r->SetOneDimSearch(search_line_length_, intensity_thresh_, direction_thresh_);
+    r->SetMesh(vertices, faces);
+    members_.push_back(r);
+    return r;
+}
+
+void RendererGroup::UploadEvidence(uint8_t *data_ptr) {
+    CHECK(!members_.empty()) << "empty renderer group";
+    members_.front()->UploadEvidence(data_ptr);
+}
+
+void RendererGroup::UploadEvidenceDirection(float *data_ptr) {
+    CHECK(!members_.empty()) << "empty renderer group";
+    members_.front()->UploadEvidenceDirection(data_ptr);
+}
+
+void RendererGroup::SetROI(const cv::Rect &roi) {
+    for (auto r : members_) r->SetROI(roi);
+}
+
+void RendererGroup::ClearROI() {
+    for (auto r : members_) r->ClearROI();
+}
+
 }   // namespace feh
 
 
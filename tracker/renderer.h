@@ -6,6 +6,7 @@
 #include <memory>
 #include <array>
 #include <unordered_map>
+#include <functional>
 
 // gl
 #include "glad/glad.h"
@@ -17,6 +18,7 @@
 #include "shader.h"
 #include "alias.h"
 #include "oned_search.h"
+#include "software_rasterizer.h"
 
 namespace feh {
 
@@ -37,12 +39,63 @@ T LinearizeDepth(T zb, T z_near, T z_far) {
         (z_far + z_near - (2 * zb - 1) * (z_far - z_near));
 }
 
+/// \brief: Backend which does the actual rendering work.
+/// OPENGL: GL 4.3 context on a hidden GLFW window.
+/// SOFTWARE: headless CPU rasterizer, no window or GL context required.
+enum class RenderBackend : int {
+    OPENGL = 0,
+    SOFTWARE
+};
+/// \brief: Parse backend from its name ("opengl" or "software").
+RenderBackend RenderBackendFromString(const std::string &name);
+
+class Renderer;
+
+/// \brief: Handle of an asynchronous readback started by Renderer::Render*Async.
+/// Pixels are transferred into a pixel buffer object guarded by a fence sync,
+/// such that the CPU does not stall until the results are collected.
+/// NOTE: The output buffer must outlive the handle. A renderer completes its outstanding
+/// readbacks when destroyed, such that handles never refer to a destroyed renderer.
+class RenderReadback {
+public:
+    /// \brief: A completed readback, used by the software backend.
+    RenderReadback();
+    /// \brief: Wait for the readback if not collected yet.
+    ~RenderReadback();
+    /// \brief: Whether the transfer has completed, never blocks.
+    bool Ready();
+    /// \brief: Block until the transfer has completed and copy the pixels into the output buffer.
+    void Wait();
+    /// \brief: Register a function called once the pixels are in the output buffer,
+    /// immediately if they already are.
+    void Then(std::function<void()> callback);
+
+private:
+    friend class Renderer;
+    Renderer *renderer_;
+    GLuint pbo_;
+    GLsync fence_;
+    bool done_;
+    std::function<void(const void *)> copy_;    // copy from mapped pixel buffer to output buffer
+    std::vector<std::function<void()>> callbacks_;
+};
+typedef std::shared_ptr<RenderReadback> RenderReadbackPtr;
+
 ////////////////////////////////////////////////////////////////////////////////
 // THE RENDERER
 ////////////////////////////////////////////////////////////////////////////////
 class Renderer {
 public:
-    Renderer(int maxHeight, int maxWidth); //, const std::string &name);
+    /// \brief: Maximal number of poses rendered and searched together in OneDimSearchBatch.
+    /// MUST be consistent with shaders/oned_batch.comp
+    static const int kMaxBatchSize = 16;
+
+    Renderer(int maxHeight, int maxWidth, RenderBackend backend=RenderBackend::OPENGL); //, const std::string &name);
+    /// \brief: Create a renderer sharing the context, shaders, framebuffers, evidence and
+    /// edge list buffers with the parent; only the mesh (vertex array) is owned.
+    /// Camera and one dimensional search parameters are shared as well, i.e., setting them
+    /// on any renderer affects the whole family. See RendererGroup.
+    explicit Renderer(const std::shared_ptr<Renderer> &parent);
     ~Renderer();
 
     /// \brief: Set camera model.
@@ -74,6 +127,16 @@ public:
                          int intensity_thresh=-1,
                          float direction_thresh=-1);
 
+    /// \brief: Restrict rendering, search and readback to the region of interest (clamped to the image),
+    /// e.g., the predicted bounding box of the object plus margin of the search line.
+    /// Pixels outside of the region are background in all the outputs and no edge pixels are
+    /// extracted there. Fill rate, dispatch size and readback scale with the area of the region.
+    /// NOTE: OneDimSearchBatch ignores the region of interest.
+    void SetROI(const cv::Rect &roi);
+    /// \brief: Use the whole image.
+    void ClearROI();
+    const cv::Rect &roi() const { return roi_; }
+
     /// \brief: Render the boundary of an object given object pose using Stencil Buffer.
     /// \param model: object pose
     /// \param out: pointer to output depth image
@@ -107,11 +170,41 @@ public:
     }
 
 
+    /// \brief: Asynchronous versions of RenderDepth, RenderEdge, RenderWireframe and RenderMask.
+    /// Rendering is issued and pixels are read into a pixel buffer object without blocking,
+    /// the output buffer is filled once the returned handle is waited on.
+    RenderReadbackPtr RenderDepthAsync(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model, float *out);
+    RenderReadbackPtr RenderEdgeAsync(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model, uint8_t *out);
+    RenderReadbackPtr RenderWireframeAsync(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model, uint8_t *out);
+    RenderReadbackPtr RenderMaskAsync(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model, uint8_t *out);
+
     /// \brief: Compute edge pixels with search direction.
     /// \param model: object pose
     /// \param edgelist: list of edge pixels with search direction
     void ComputeEdgePixels(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model, std::vector<EdgePixel> &edgelist);
     void OneDimSearch(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model, std::vector<EdgePixel> &edgelist);
+    /// \brief: Same as above, but edge lists are kept in the packed format in which they
+    /// are read back from the device, i.e., half of the bandwidth and no unpacking.
+    void ComputeEdgePixels(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model, std::vector<PackedEdgePixel> &edgelist);
+    void OneDimSearch(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model, std::vector<PackedEdgePixel> &edgelist);
+    /// \brief: One dimensional search followed by reduction of the edge list on the device,
+    /// such that the edge list never leaves the device.
+    /// \param model: object pose
+    /// \param score_and_corner: [matching ratio, average matching distance, tl_x, tl_y, br_x, br_y],
+    /// same as ReduceEdgelist on the output of OneDimSearch.
+    void OneDimSearch(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model, std::array<float, 6> &score_and_corner);
+    /// \brief: Batched version of OneDimSearch. Up to kMaxBatchSize poses are rendered
+    /// with instancing into tiles of a depth atlas and searched with a single dispatch
+    /// and a single readback.
+    /// \param models: object poses
+    /// \param edgelists: edgelists[i] is the edge list of models[i]
+    void OneDimSearchBatch(const Mat4fColMajorList &models,
+                           std::vector<std::vector<EdgePixel>> &edgelists);
+    void OneDimSearchBatch(const Mat4fColMajorList &models,
+                           std::vector<std::vector<PackedEdgePixel>> &edgelists);
+    /// \brief: Batched version of OneDimSearch with reduction on the device.
+    void OneDimSearchBatch(const Mat4fColMajorList &models,
+                           std::vector<std::array<float, 6>> &score_and_corners);
 
     void RenderWireframe(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model,
                          uint8_t *out);
@@ -131,7 +224,7 @@ public:
     /// \brief Upload direction of evidence to OpenGL texture.
     void UploadEvidenceDirection(float *data_ptr);
 
-    void Use() { glfwMakeContextCurrent(window_); }
+    void Use() { if (window_) glfwMakeContextCurrent(window_); }
 
 
     // accessors
@@ -147,6 +240,7 @@ public:
     int rows() const { return rows_; }
     const std::string &id() const { return name_; }
     const std::string &name() const { return name_; }
+    RenderBackend backend() const { return backend_; }
 
 private:
     /// \brief Depth texture is mapped to the Quadrilateral (Quad) such that flipping/linearization/edge detection, etc.,
@@ -154,18 +248,58 @@ private:
     void InitializeQuadrilateral();
     void InitializeFramebuffer();
     void InitializeForLikelihood();
+    /// \brief: Allocate depth atlas and buffers for batched search, done on first use.
+    void InitializeForBatch();
+    /// \brief: Render depth and run one dimensional search, results are left in
+    /// edgelist_buffer_ and edgepixel_counter_buffer_.
+    void RenderAndSearch(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model);
+    /// \brief: Batched version of RenderAndSearch, results are left in batch_edgelist_buffer_.
+    void RenderAndSearchBatch(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> *models, int batch_size);
+    /// \brief: Read back the packed edge list left in edgelist_buffer_ by the last dispatch.
+    void ReadEdgelist(std::vector<PackedEdgePixel> &edgelist);
+    /// \brief: Reduce edge lists of num_poses poses on the device and read back 6 floats per pose.
+    /// \param header: offset (in 32-bit words) of the first edge list in edgelist_buffer.
+    /// \param capacity: maximal number of edge pixels per pose.
+    void ReduceOnDevice(GLuint edgelist_buffer, GLuint counter_buffer,
+                        int header, int capacity, int num_poses, float *out);
+    /// \brief: Draw passes leaving the results in the framebuffer, finished by EndDraw.
+    /// Mask is the color buffer of DrawDepth.
+    void DrawDepth(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model);
+    void DrawEdge(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model);
+    void DrawWireframe(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model);
+    void EndDraw();
+    /// \brief: Read pixels of the bound framebuffer into a pixel buffer object.
+    template <typename T>
+    RenderReadbackPtr StartReadback(GLenum format, GLenum type, T background, T *out);
+    /// \brief: Enable/disable scissor test for the region of interest.
+    void BeginROI();
+    void EndROI();
+    /// \brief: Read pixels in the region of interest into a full image, background elsewhere.
+    template <typename T>
+    void ReadPixelsInROI(GLenum format, GLenum type, T background, T *out);
+    /// \brief: Dispatch the compute shader in use (local size 16x16) over the region of interest.
+    void DispatchInROI(const ShaderPtr &shader);
 
 private:
+    friend class RenderReadback;
     static bool initialized_;
     static int counter_;
+    // owner of the shared context & buffers, null if this renderer owns them
+    std::shared_ptr<Renderer> parent_;
+    RenderBackend backend_;
+    // non-null iff backend_ == RenderBackend::SOFTWARE, all the work is delegated to it
+    std::unique_ptr<SoftwareRasterizer> rasterizer_;
     bool output_with_GL_coordinate_system_;
     bool has_evidence_;
+    bool has_roi_;
     float fx_, fy_, cx_, cy_;
     float z_near_, z_far_;
 
 private:
 //private:
     int rows_, cols_;
+    cv::Rect roi_;      // region of interest, the whole image if not set
+    cv::Rect scissor_;  // region of interest with margin
     int num_vertices_, num_faces_;
 
     GLFWwindow *window_;
@@ -196,10 +330,69 @@ private:
     GLuint edgelist_buffer_;
     GLuint edgepixel_counter_buffer_;
     GLuint edgepixel_match_counter_buffer_; // counter of matched edge pixels
+
+    // batched one dimensional search
+    ShaderPtr batch_depth_shader_;  // instanced depth rendering into the atlas
+    ShaderPtr oned_batch_shader_;
+    GLuint batch_fbo_, batch_depth_texture_;    // depth atlas
+    GLuint batch_model_buffer_;     // model matrices of the batch
+    GLuint batch_edgelist_buffer_;  // per-pose counters followed by per-pose edge lists
+    int batch_capacity_;    // maximal number of edge pixels per pose
+
+    ShaderPtr reduce_shader_;   // reduction of edge lists into scores and bounding box corners
+    int edgelist_capacity_;     // maximal number of edge pixels in edgelist_buffer_
+
+    // asynchronous readback
+    std::vector<GLuint> pbos_;      // all the pixel buffer objects
+    std::vector<GLuint> free_pbos_; // pixel buffer objects not in use
+    std::vector<std::weak_ptr<RenderReadback>> readbacks_;  // possibly outstanding readbacks
 };
 
 typedef std::shared_ptr<Renderer> RendererPtr;
 
+////////////////////////////////////////////////////////////////////////////////
+// GROUP OF RENDERERS
+////////////////////////////////////////////////////////////////////////////////
+/// \brief: A bank of renderers of the same image size and camera, one per shape.
+/// All the members share one context, one set of shaders & framebuffers and one
+/// pair of evidence buffers. Each member owns only the vertex array of its mesh.
+/// Evidence is uploaded once for the whole group.
+class RendererGroup {
+public:
+    RendererGroup(int rows, int cols, RenderBackend backend=RenderBackend::OPENGL);
+    /// \brief: Set camera model of all the members, including those added later.
+    void SetCamera(float z_near, float z_far, float fx, float fy, float cx, float cy);
+    /// \brief: Set current camera pose of all the members.
+    void SetCamera(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &pose);
+    /// \brief: Set parameters of one dimensional search of all the members, including those added later.
+    void SetOneDimSearch(int search_line_length, int intensity_thresh, float direction_thresh);
+    /// \brief: Add a member rendering the given mesh.
+    /// \return: the new member.
+    RendererPtr AddMesh(const Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> &vertices,
+                        const Eigen::Matrix<int, Eigen::Dynamic, 3, Eigen::RowMajor> &faces);
+    void UploadEvidence(uint8_t *data_ptr);
+    void UploadEvidenceDirection(float *data_ptr);
+    /// \brief: Set/clear region of interest of all the members.
+    void SetROI(const cv::Rect &roi);
+    void ClearROI();
+
+    const std::vector<RendererPtr> &members() const { return members_; }
+    int size() const { return members_.size(); }
+    int rows() const { return rows_; }
+    int cols() const { return cols_; }
+
+private:
+    int rows_, cols_;
+    RenderBackend backend_;
+    std::vector<RendererPtr> members_;  // the first member owns the context
+    float z_near_, z_far_;
+    std::array<float, 4> intrinsics_;
+    bool has_camera_;
+    int search_line_length_, intensity_thresh_;
+    float direction_thresh_;
+};
+typedef std::shared_ptr<RendererGroup> RendererGroupPtr;
+
 
 
 
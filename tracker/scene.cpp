@@ -12,6 +12,7 @@
 
 // own
 #include "tracker_utils.h"
+#include "message_utils.h"
 
 namespace feh {
 
@@ -22,6 +23,8 @@ std::vector<std::array<uint8_t, 3>> Scene::random_color_ = GenerateRandomColorMa
 Scene::Scene() :
     frame_counter_(0),
     initial_pose_set_(false),
+    CNN_batcher_(nullptr),
+    CNN_deadline_ms_(0),
     timer_("Scene") {
     valid_categories_.insert("chair");
     valid_categories_.insert("car");
@@ -44,6 +47,27 @@ void Scene::Initialize(const std::string &config_file, const Json::Value &more_c
     rows_        = cam_cfg["rows"].asInt();
     cols_        = cam_cfg["cols"].asInt();
 
+    // SETUP SCENE-WIDE BATCHING OF CNN HYPOTHESES
+    auto batching_cfg = config_["CNN_batching"];
+    if (batching_cfg.get("enabled", false).asBool()) {
+        ShmRingPtr request_ring, reply_ring;
+        if (batching_cfg.get("transport", "lcm").asString() == "shm") {
+            // frames are sent along with the hypotheses, replies only carry scores
+            std::string name = batching_cfg.get("shm_name", "/visma_cnn").asString();
+            int num_slots = batching_cfg.get("shm_slots", 2).asInt();
+            size_t max_payload = batching_cfg.get("shm_max_payload_mb", 4).asInt() << 20;
+            request_ring = ShmRing::Create(name + "_request", num_slots, sizeof(FrameHeader) + rows_ * cols_ * 3 + max_payload);
+            reply_ring = ShmRing::Create(name + "_reply", num_slots, max_payload);
+            if (!request_ring || !reply_ring) {
+                LOG(WARNING) << "shared memory transport unavailable, fall back to LCM";
+                request_ring = reply_ring = nullptr;
+            }
+        }
+        CNN_batcher_ = std::make_shared<BBoxLikelihoodBatcher>(request_ring, reply_ring);
+        CHECK(CNN_batcher_->good()) << "failed to setup LCM port";
+        CNN_deadline_ms_ = batching_cfg.get("deadline_ms", 0).asInt();
+    }
+
     // ALLOCATE BUFFERS
     mask_ = cv::Mat(rows_, cols_, CV_8UC1);
     zbuffer_ = cv::Mat(rows_, cols_, CV_32FC1);
@@ -66,18 +90,33 @@ void Scene::SetInitCameraToWorld(const SE3 &gwc0) {
 
 void Scene::Build2DView() {
     display_ = image_.clone();
+    // queue rendering of the boundaries of all the trackers, collected when overlaid
+    bool show_mean_boundary = config_["visualization"]["show_mean_boundary"].asBool();
+    std::vector<cv::Mat> predictions(trackers_.size());
+    std::vector<RenderReadbackPtr> readbacks(trackers_.size());
+    if (show_mean_boundary) {
+        int k = 0;
+        for (TrackerPtr tracker : trackers_) {
+            if (tracker->status() != TrackerStatus::OUT_OF_VIEW) {
+                readbacks[k] = tracker->RenderAsync(predictions[k], 0);
+            }
+            ++k;
+        }
+    }
     // list all the trackers
+    int k = -1;
     for (TrackerPtr tracker : trackers_) {
+        ++k;
         if (tracker->status() == TrackerStatus::OUT_OF_VIEW) continue;
 //        if (config_["visualization"]["show_mean_boundary"].asBool()) {
 //            cv::Mat boundary = tracker->RenderAtCurrentEstimate(tracker->renderer0_ptr());
 //            OverlayMaskOnImage(boundary, display_, false);
 //        }
 
-        if (config_["visualization"]["show_mean_boundary"].asBool()) {
-            auto prediction = tracker->Render(0);
+        if (show_mean_boundary) {
+            readbacks[k]->Wait();
             auto rc = random_color_[tracker->id()+1];
-            OverlayMaskOnImage(prediction, display_, false, &rc[0]); //kColorMap.at(tracker->class_name()));
+            OverlayMaskOnImage(predictions[k], display_, false, &rc[0]); //kColorMap.at(tracker->class_name()));
         }
 
         if (config_["visualization"]["show_projections"].asBool()) {
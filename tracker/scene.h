@@ -69,6 +69,9 @@ private:
     bool initial_pose_set_;
     std::unordered_set<std::string> valid_categories_;
     std::list<TrackerPtr> trackers_;
+    // one CNN request per frame for the hypotheses of all the trackers, null if not batched
+    BBoxLikelihoodBatcherPtr CNN_batcher_;
+    int CNN_deadline_ms_;   // wait at most this long for the batch reply, 0 to wait forever
     Json::Value config_;
     Json::Value log_;
     Timer timer_;
@@ -184,6 +184,17 @@ void Scene::Update(const cv::Mat &evidence,
         input_bboxlist_.CopyFrom(category_bboxlist);
     }
 
+    // SCORE HYPOTHESES OF ALL THE TRACKERS IN ONE CNN PASS
+    if (CNN_batcher_) {
+        timer_.Tick("CNN likelihood");
+        for (TrackerPtr tracker : trackers_) tracker->RequestCNNLikelihood(*CNN_batcher_);
+        CNN_batcher_->Flush(imagepath, img);
+        auto deadline = std::chrono::steady_clock::now()
+            + (CNN_deadline_ms_ > 0 ? std::chrono::milliseconds(CNN_deadline_ms_) : std::chrono::hours(24));
+        for (TrackerPtr tracker : trackers_) tracker->ApplyCNNLikelihood(deadline);
+        timer_.Tock("CNN likelihood");
+    }
+
     // LOG RESULTS
     UpdateLog();
 
@@ -219,26 +230,37 @@ void Scene::Update(const cv::Mat &evidence,
 void Scene::UpdateSegMask() {
     zbuffer_.setTo(0);
     segmask_.setTo(-1);
+    // queue depth rendering of all the trackers first, such that rendering overlaps with merging
+    std::vector<TrackerPtr> rendered;
+    std::vector<cv::Mat> depths;
+    std::vector<RenderReadbackPtr> readbacks;
     for (auto tracker : trackers_) {
         if (tracker->CentroidInCurrentView()(2) < 30)
         {
-            cv::Mat depth = tracker->RenderDepth();
-            auto op = [this, tracker, &depth](const tbb::blocked_range<int> &range) {
-                for (int i = range.begin(); i < range.end(); ++i) {
-                    for (int j = 0; j < depth.cols; ++j) {
-                        float val(depth.at<float>(i, j));
-                        if (val > 0) {
-                            // only on foreground
-                            float zbuf_val(this->zbuffer_.at<float>(i, j));
-                            if (zbuf_val == 0 || val < zbuf_val) {
-                                this->zbuffer_.at<float>(i, j) = val;
-                                this->segmask_.at<int32_t>(i, j) = tracker->id();
-                            }
+            depths.push_back(cv::Mat());
+            readbacks.push_back(tracker->RenderDepthAsync(depths.back()));
+            rendered.push_back(tracker);
+        }
+    }
+    for (int k = 0; k < rendered.size(); ++k) {
+        auto tracker = rendered[k];
+        const cv::Mat &depth = depths[k];
+        readbacks[k]->Wait();
+        auto op = [this, tracker, &depth](const tbb::blocked_range<int> &range) {
+            for (int i = range.begin(); i < range.end(); ++i) {
+                for (int j = 0; j < depth.cols; ++j) {
+                    float val(depth.at<float>(i, j));
+                    if (val > 0) {
+                        // only on foreground
+                        float zbuf_val(this->zbuffer_.at<float>(i, j));
+                        if (zbuf_val == 0 || val < zbuf_val) {
+                            this->zbuffer_.at<float>(i, j) = val;
+                            this->segmask_.at<int32_t>(i, j) = tracker->id();
                         }
                     }
-                }};
-            tbb::parallel_for(tbb::blocked_range<int>(0, depth.rows), op);
-        }
+                }
+            }};
+        tbb::parallel_for(tbb::blocked_range<int>(0, depth.rows), op);
     }
 
     // Update visibility information for each tracker
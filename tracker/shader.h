@@ -2,9 +2,139 @@
 
 #include <memory>
 #include <type_traits>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <fstream>
+#include <sstream>
+#include <cstdint>
+#include <cstdio>
 
 namespace feh {
 
+/// \brief: Cache of linked program binaries, keyed by driver and shader sources.
+/// Binaries are kept in memory such that renderers created later in the process
+/// (e.g., when the scene spawns new trackers) skip compilation and linking, and
+/// optionally on disk such that the next run skips them as well.
+/// Each Shader still owns its program object, since uniforms are per program.
+/// The on-disk cache is enabled by defining FEH_SHADER_CACHE_DIR or by SetDirectory.
+class ShaderCache {
+public:
+    static ShaderCache &Instance() {
+        static ShaderCache cache;
+        return cache;
+    }
+
+    /// \brief: Set directory of the on-disk cache, empty string disables it.
+    /// The directory must exist.
+    void SetDirectory(const std::string &directory) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        directory_ = directory;
+    }
+
+    /// \brief: Key of the given sources for the driver of the current context.
+    static uint64_t Key(const std::string &sources) {
+        std::string driver;
+        for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+            const GLubyte *str = glGetString(name);
+            if (str) driver += (const char *)str;
+            driver += '\n';
+        }
+        // 64-bit FNV-1a, stable across runs and standard libraries
+        uint64_t hash = 14695981039346656037ull;
+        for (const std::string &str : {driver, sources}) {
+            for (unsigned char c : str) {
+                hash ^= c;
+                hash *= 1099511628211ull;
+            }
+        }
+        return hash;
+    }
+
+    /// \brief: Look up a program binary, first in memory then on disk.
+    bool Load(uint64_t key, GLenum &format, std::vector<uint8_t> &binary) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(key);
+        if (it != entries_.end()) {
+            format = it->second.format;
+            binary = it->second.binary;
+            return true;
+        }
+        if (directory_.empty()) return false;
+        std::ifstream in(Path(key), std::ios::binary);
+        if (!in.is_open()) return false;
+        uint32_t magic(0), stored_format(0), size(0);
+        uint64_t stored_key(0);
+        in.read((char *)&magic, sizeof(magic));
+        in.read((char *)&stored_key, sizeof(stored_key));
+        in.read((char *)&stored_format, sizeof(stored_format));
+        in.read((char *)&size, sizeof(size));
+        if (!in || magic != kMagic || stored_key != key || size == 0) return false;
+        binary.resize(size);
+        in.read((char *)&binary[0], size);
+        if (!in) return false;
+        format = stored_format;
+        entries_[key] = {format, binary};
+        return true;
+    }
+
+    /// \brief: Store a program binary in memory and, if enabled, on disk.
+    void Store(uint64_t key, GLenum format, const std::vector<uint8_t> &binary) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_[key] = {format, binary};
+        if (directory_.empty()) return;
+        // write to a temporary file first such that concurrent processes never read partial files
+        std::string path = Path(key);
+        std::string tmp_path = path + ".tmp";
+        std::ofstream out(tmp_path, std::ios::binary);
+        if (!out.is_open()) {
+            LOG(WARNING) << "failed to write shader cache to " << tmp_path;
+            return;
+        }
+        uint32_t magic(kMagic), stored_format(format), size(binary.size());
+        out.write((const char *)&magic, sizeof(magic));
+        out.write((const char *)&key, sizeof(key));
+        out.write((const char *)&stored_format, sizeof(stored_format));
+        out.write((const char *)&size, sizeof(size));
+        out.write((const char *)&binary[0], size);
+        out.close();
+        if (!out || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+            LOG(WARNING) << "failed to write shader cache to " << path;
+            std::remove(tmp_path.c_str());
+        }
+    }
+
+    /// \brief: Drop a binary which the driver refused to load.
+    void Erase(uint64_t key) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_.erase(key);
+        if (!directory_.empty()) std::remove(Path(key).c_str());
+    }
+
+private:
+    ShaderCache() {
+#ifdef FEH_SHADER_CACHE_DIR
+        directory_ = FEH_SHADER_CACHE_DIR;
+#endif
+    }
+
+    std::string Path(uint64_t key) const {
+        std::stringstream ss;
+        ss << directory_ << "/" << std::hex << key << ".bin";
+        return ss.str();
+    }
+
+    struct Entry {
+        GLenum format;
+        std::vector<uint8_t> binary;
+    };
+    static const uint32_t kMagic = 0x53484546;  // "FEHS"
+    std::mutex mutex_;
+    std::string directory_;
+    std::unordered_map<uint64_t, Entry> entries_;
+};
+
 class Shader {
 public:
     GLuint Program;
@@ -34,6 +164,25 @@ public:
         // Shader Program
         this->Program = glCreateProgram();
 
+        // 1. Try the program binary cache, fall back to compilation if the driver refuses the binary
+        GLint num_binary_formats(0);
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_binary_formats);
+        bool use_cache = num_binary_formats > 0;
+        uint64_t key(0);
+        if (use_cache) {
+            key = ShaderCache::Key(name_);
+            GLenum format;
+            std::vector<uint8_t> binary;
+            if (ShaderCache::Instance().Load(key, format, binary)) {
+                glProgramBinary(this->Program, format, &binary[0], binary.size());
+                GLint success;
+                glGetProgramiv(this->Program, GL_LINK_STATUS, &success);
+                if (success) return;
+                LOG(INFO) << "stale program binary in shader cache; recompiling";
+                ShaderCache::Instance().Erase(key);
+            }
+        }
+
         // 2. Compile shaders
         GLuint vertex(0), fragment(0), compute(0);
         GLint success;
@@ -83,6 +232,7 @@ public:
 
 
         // Link
+        if (use_cache) glProgramParameteri(this->Program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
         glLinkProgram(this->Program);
         glGetProgramiv(this->Program, GL_LINK_STATUS, &success);
         if (!success) {
@@ -95,6 +245,16 @@ public:
         if (has_fs) glDeleteShader(fragment);
         if (has_cs) glDeleteShader(compute);
 
+        if (use_cache) {
+            GLint length(0);
+            glGetProgramiv(this->Program, GL_PROGRAM_BINARY_LENGTH, &length);
+            if (length > 0) {
+                GLenum format;
+                std::vector<uint8_t> binary(length);
+                glGetProgramBinary(this->Program, length, NULL, &format, &binary[0]);
+                ShaderCache::Instance().Store(key, format, binary);
+            }
+        }
     }
 
     // Uses the current shader
@@ -0,0 +1,25 @@
+// Instanced model-view-projection vertex shader for batched rendering.
+// Each instance is rendered into its own tile of an atlas of grid.x by grid.y tiles,
+// the tile of instance i is (i % grid.x, i / grid.x).
+#version 430 core
+layout (location = 0) in vec3 position;
+layout(std430, binding=4) buffer ModelLayout {
+    mat4 models[];
+};
+uniform mat4 view;
+uniform mat4 projection;
+uniform ivec2 grid;
+void main()
+{
+    vec4 p = projection * view * models[gl_InstanceID] * vec4(position, 1.0f);
+    // clip against the frustum of the tile, otherwise primitives leak into neighboring tiles
+    gl_ClipDistance[0] = p.w + p.x;
+    gl_ClipDistance[1] = p.w - p.x;
+    gl_ClipDistance[2] = p.w + p.y;
+    gl_ClipDistance[3] = p.w - p.y;
+    // map normalized device coordinates [-1, 1] of the tile into the atlas
+    vec2 scale = 1.0 / vec2(grid);
+    vec2 tile = vec2(gl_InstanceID % grid.x, gl_InstanceID / grid.x);
+    vec2 offset = (2 * tile + 1) * scale - 1;
+    gl_Position = vec4(p.xy * scale + offset * p.w, p.z, p.w);
+}
@@ -6,7 +6,7 @@ static const std::string edgelist_comp = R"(
 
 layout(local_size_x = 16, local_size_y = 16) in;
 layout(std430, binding=0) buffer EdgeListLayout {
-    float edgelist[];
+    uint edgelist[];
 };
 // reference on atomic counter:
 // https://www.khronos.org/opengl/wiki/Atomic_Counter
@@ -15,9 +15,22 @@ layout(binding=1) uniform atomic_uint edgepixel_counter;
 uniform sampler2D this_texture;
 uniform float z_near = 0.05;
 uniform float z_far = 5.0;
+// region of interest (x, y, width, height), the dispatch is offset by (x, y)
+uniform ivec4 roi = ivec4(0, 0, 65536, 65536);
+// maximal number of edge pixels in edgelist[], overflowing pixels are counted but dropped
+uniform int capacity;
 
 const float threshold = 0.1;
 
+// pack edge pixel into two 32-bit words, MUST be consistent with feh::PackedEdgePixel:
+// int16 x & y, direction in [-pi, pi] quantized to 16 bits, depth (or distance) as half float
+const float PI = 3.14159265358979;
+void pack_edgepixel(uint index, ivec2 pos, float dir, float depth) {
+    uint q = uint(round(clamp(dir + PI, 0.0, 2 * PI) * (65535.0 / (2 * PI))));
+    edgelist[index + 0] = (uint(pos.x) & 0xFFFFu) | (uint(pos.y) << 16);
+    edgelist[index + 1] = q | (packHalf2x16(vec2(depth, 0)) << 16);
+}
+
 // convert normalized depth to actual depth
 // reference:
 // https://www.opengl.org/discussion_boards/showthread.php/145308-Depth-Buffer-How-do-I-get-the-pixel-s-Z-coord
@@ -43,34 +56,21 @@ void compute_edge_info(ivec2 pos) {
     if (value[4] != -1 && delta >= threshold) {
         // fill in edgelist
         uint current_index = atomicCounterIncrement(edgepixel_counter);
-        // TODO: need to check range of edgelist buffer
-        edgelist[current_index*4 + 0] = float(pos.x);
-        edgelist[current_index*4 + 1] = float(pos.y);
+        if (current_index >= uint(capacity)) return;
         float dy = -(3*value[0]  - 3*value[2] + 10*value[3] - 10*value[5] + 3*value[6] - 3*value[8]);
         float dx = -(3*value[0]  + 10*value[1] + 3*value[2] - 3*value[6] - 10*value[7] - 3*value[8]);
 //        float dy = value[5] - value[3];
 //        float dx = value[7] - value[1];
-        edgelist[current_index*4 + 2] = atan(dy, dx);
-        edgelist[current_index*4 + 3] = value[4];
-
-        // float min_depth = z_far;
-        // for (int i = 0; i < 9; ++i) {
-        //     float tmp = value[i];
-        //     if (tmp < min_depth) {
-        //         min_depth = tmp;
-        //     }
-        // }
-        // if (min_depth < z_far) {
-        //     edgelist[current_index*4 + 3] = min_depth; //linearize_depth(min_depth);
-        // }
+        pack_edgepixel(current_index*2, pos, atan(dy, dx), value[4]);
     }
 }
 
 void main() {
-    ivec2 uv = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 uv = ivec2(gl_GlobalInvocationID.xy) + roi.xy;
     ivec2 size = textureSize(this_texture, 0);
     if (uv.x < size.x-1 && uv.y < size.y-1
-    && uv.x >= 1 && uv.y >= 1) {
+    && uv.x >= 1 && uv.y >= 1
+    && uv.x < roi.x + roi.z && uv.y < roi.y + roi.w) {
         compute_edge_info(uv);
     }
 }
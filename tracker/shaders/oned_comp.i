@@ -7,7 +7,7 @@ static const std::string oned_comp = R"(
 layout(local_size_x = 16, local_size_y = 16) in;
 // SSBO (Shader Storage Buffer Object)
 layout(std430, binding=0) buffer EdgeListLayout {
-    float edgelist[];
+    uint edgelist[];
 };
 layout(std430, binding=1) buffer EvidenceLayout {
     uint evidence[];
@@ -15,10 +15,6 @@ layout(std430, binding=1) buffer EvidenceLayout {
 layout(std430, binding=2) buffer EvidenceDirLayout {
     float evidence_dir[];
 };
-layout(std430, binding=3) buffer ScoreAndCornerLayout {
-    float ratio, distance;
-    float tl_x, tl_y, br_x, br_y;
-};
 
 // Atomic Object
 // reference on atomic counter:
@@ -32,11 +28,24 @@ uniform sampler2D this_texture;
 // near and far plane, tuning parameters
 uniform float z_near = 0.05;
 uniform float z_far = 5.0;
+// region of interest (x, y, width, height), the dispatch is offset by (x, y)
+uniform ivec4 roi = ivec4(0, 0, 65536, 65536);
+// maximal number of edge pixels in edgelist[], overflowing pixels are counted but dropped
+uniform int capacity;
 
 // CONSTANTS
 const float eps = 1e-4;
 const float threshold = 0.1;
 
+// pack edge pixel into two 32-bit words, MUST be consistent with feh::PackedEdgePixel:
+// int16 x & y, direction in [-pi, pi] quantized to 16 bits, depth (or distance) as half float
+const float PI = 3.14159265358979;
+void pack_edgepixel(uint index, ivec2 pos, float dir, float depth) {
+    uint q = uint(round(clamp(dir + PI, 0.0, 2 * PI) * (65535.0 / (2 * PI))));
+    edgelist[index + 0] = (uint(pos.x) & 0xFFFFu) | (uint(pos.y) << 16);
+    edgelist[index + 1] = q | (packHalf2x16(vec2(depth, 0)) << 16);
+}
+
 // tuning parameters
 uniform int search_line_length = 40;   // magic number here,
 uniform int intensity_thresh = 128;
@@ -160,13 +169,13 @@ void compute_edge_info(ivec2 pos, ivec2 size) {
         // fill in edgelist
         uint current_index = atomicCounterIncrement(edgepixel_counter);
 
-        edgelist[current_index*4 + 0] = float(pos.x);
-        edgelist[current_index*4 + 1] = float(pos.y);
         float dy = -(3*value[0]  - 3*value[2] + 10*value[3] - 10*value[5] + 3*value[6] - 3*value[8]);
         float dx = -(3*value[0]  + 10*value[1] + 3*value[2] - 3*value[6] - 10*value[7] - 3*value[8]);
-        edgelist[current_index*4 + 2] = atan(dy, dx);
-        float match_dist = oned_search(pos, edgelist[current_index*4 + 2], size);
-        edgelist[current_index*4 + 3] = match_dist;
+        float dir = atan(dy, dx);
+        float match_dist = oned_search(pos, dir, size);
+        if (current_index < uint(capacity)) {
+            pack_edgepixel(current_index*2, pos, dir, match_dist);
+        }
 
         if (match_dist >= 0) {
             atomicCounterIncrement(edgepixel_match_counter);
@@ -176,48 +185,14 @@ void compute_edge_info(ivec2 pos, ivec2 size) {
 }
 
 void main() {
-//    uvec3 groups = gl_NumWorkGroups;
-//    if (groups.x * groups.y * groups.z == 1) {
-//        ivec2 uv = ivec2(gl_GlobalInvocationID.xy);
-//        if (uv.x == 1 && uv.y == 1) {
-//            // reduction
-//            tl_x = 10000;
-//            tl_y = 10000;
-//            br_x = 0;
-//            br_y = 0;
-//            uint size = atomicCounter(edgepixel_counter);
-//            uint match_size = atomicCounter(edgepixel_match_counter);
-//            float total_dist = 0;
-//            for (uint i = 0; i < size; ++i) {
-//                // accumulate matching distance
-//                if (edgelist[size*4+3] >= 0) {
-//                    total_dist += edgelist[size*4+3];
-//                }
-//                // update bounding box corners
-//                float x = edgelist[size*4];
-//                float y = edgelist[size*4+1];
-//                tl_x = min(tl_x, x);
-//                tl_y = min(tl_y, y);
-//                br_x = max(br_x, x);
-//                br_y = max(br_y, y);
-//            }
-//            distance = total_dist / (match_size + eps);
-//            ratio = match_size / (size + eps);
-//            ivec2 img_size = textureSize(this_texture, 0);
-//            tl_x = max(0, tl_x);
-//            tl_y = max(0, tl_y);
-//            br_x = min(img_size.x-1, br_x);
-//            br_y = min(img_size.y-1, br_y);
-//        }
-//    } else
-
-    {
-        ivec2 uv = ivec2(gl_GlobalInvocationID.xy);
-        ivec2 size = textureSize(this_texture, 0);
-        if (uv.x < size.x-1 && uv.y < size.y-1
-        && uv.x >= 1 && uv.y >= 1) {
-            compute_edge_info(uv, size);
-        }
+    // matching ratio, average matching distance and bounding box of edge pixels
+    // are computed by oned_reduce.comp in a second pass
+    ivec2 uv = ivec2(gl_GlobalInvocationID.xy) + roi.xy;
+    ivec2 size = textureSize(this_texture, 0);
+    if (uv.x < size.x-1 && uv.y < size.y-1
+    && uv.x >= 1 && uv.y >= 1
+    && uv.x < roi.x + roi.z && uv.y < roi.y + roi.w) {
+        compute_edge_info(uv, size);
     }
 }
 
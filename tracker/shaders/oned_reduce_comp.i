@@ -0,0 +1,91 @@
+#pragma once
+namespace feh {
+#include <string>
+static const std::string oned_reduce_comp = R"(
+#version 430 core
+// Reduce edge lists produced by oned.comp (or oned_batch.comp) to
+// (matching ratio, average matching distance, tl_x, tl_y, br_x, br_y)
+// such that edge lists never leave the device.
+// Each work group reduces the edge list of one pose.
+layout(local_size_x = 256) in;
+layout(std430, binding=0) buffer EdgeListLayout {
+    uint edgelist[];
+};
+layout(std430, binding=3) buffer ScoreAndCornerLayout {
+    float score_and_corner[];
+};
+// number of edge pixels per pose: the atomic counter of oned.comp
+// or the counters in front of the edge lists of oned_batch.comp
+layout(std430, binding=4) buffer CounterLayout {
+    uint counts[];
+};
+
+// offset (in 32-bit words) of the first edge list in edgelist[]
+uniform int header = 0;
+// maximal number of edge pixels per pose
+uniform int capacity;
+// image size
+uniform ivec2 size;
+
+const float eps = 1e-4;
+
+shared float s_total_dist[gl_WorkGroupSize.x];
+shared uint s_matches[gl_WorkGroupSize.x];
+shared vec4 s_corner[gl_WorkGroupSize.x];
+
+void main() {
+    uint lid = gl_LocalInvocationIndex;
+    uint pose = gl_WorkGroupID.x;
+    uint count = min(counts[pose], uint(capacity));
+    // packed edge pixels of two words, see pack_edgepixel() in oned.comp
+    uint base = uint(header) + pose * uint(capacity) * 2;
+
+    // strided partial sums
+    float total_dist = 0;
+    uint matches = 0;
+    vec4 corner = vec4(10000, 10000, 0, 0);
+    for (uint i = lid; i < count; i += gl_WorkGroupSize.x) {
+        uint word0 = edgelist[base + i*2];
+        uint word1 = edgelist[base + i*2 + 1];
+        float dist = unpackHalf2x16(word1 >> 16).x;
+        if (dist >= 0) {
+            total_dist += dist;
+            matches += 1;
+        }
+        vec2 pos = vec2(bitfieldExtract(int(word0), 0, 16), bitfieldExtract(int(word0), 16, 16));
+        corner.xy = min(corner.xy, pos);
+        corner.zw = max(corner.zw, pos);
+    }
+    s_total_dist[lid] = total_dist;
+    s_matches[lid] = matches;
+    s_corner[lid] = corner;
+    barrier();
+
+    // tree reduction in shared memory
+    for (uint stride = gl_WorkGroupSize.x / 2; stride > 0; stride >>= 1) {
+        if (lid < stride) {
+            s_total_dist[lid] += s_total_dist[lid + stride];
+            s_matches[lid] += s_matches[lid + stride];
+            s_corner[lid].xy = min(s_corner[lid].xy, s_corner[lid + stride].xy);
+            s_corner[lid].zw = max(s_corner[lid].zw, s_corner[lid + stride].zw);
+        }
+        barrier();
+    }
+
+    if (lid == 0) {
+        uint out_base = pose * 6;
+        score_and_corner[out_base + 0] = s_matches[0] / (count + eps);
+        score_and_corner[out_base + 1] = s_total_dist[0] / (s_matches[0] + eps);
+        if (count > 0) {
+            score_and_corner[out_base + 2] = max(0, s_corner[0].x);
+            score_and_corner[out_base + 3] = max(0, s_corner[0].y);
+            score_and_corner[out_base + 4] = min(size.x - 1, s_corner[0].z);
+            score_and_corner[out_base + 5] = min(size.y - 1, s_corner[0].w);
+        } else {
+            for (int i = 2; i < 6; ++i) score_and_corner[out_base + i] = 0;
+        }
+    }
+}
+
+)";
+}
\ No newline at end of file
@@ -0,0 +1,192 @@
+#include "shm_ring.h"
+
+// stl
+#include <chrono>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+
+// system
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// 3rd party
+#include "glog/logging.h"
+
+namespace feh {
+
+namespace {
+constexpr uint32_t kMagic = 0x52484546;     // "FEHR"
+constexpr size_t kAlignment = 64;           // slots start on cache lines
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex words have to be 32 bit");
+
+size_t Align(size_t size) {
+    return (size + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+/// \brief: Sleep while *word == expected, at most until the deadline if any.
+/// Futexes are not private, since the word is shared with another process.
+void FutexWait(std::atomic<uint32_t> *word, uint32_t expected,
+               const std::chrono::steady_clock::time_point *deadline) {
+    timespec timeout;
+    if (deadline) {
+        auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            *deadline - std::chrono::steady_clock::now()).count();
+        if (remaining <= 0) return;
+        timeout.tv_sec = remaining / 1000000000;
+        timeout.tv_nsec = remaining % 1000000000;
+    }
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAIT, expected,
+            deadline ? &timeout : nullptr, nullptr, 0);
+}
+
+void FutexWake(std::atomic<uint32_t> *word) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+}   // namespace
+
+struct ShmRing::Header {
+    std::atomic<uint32_t> magic;    // set last by the creator
+    uint32_t num_slots;
+    uint64_t slot_size;     // capacity of the payload of a slot
+    uint64_t slot_stride;
+    alignas(kAlignment) std::atomic<uint32_t> write_seq;    // number of committed messages
+    alignas(kAlignment) std::atomic<uint32_t> read_seq;     // number of released messages
+    // slots follow: size of the message followed by the payload
+};
+
+ShmRing::ShmRing(const std::string &name, void *base, size_t mapped_size, bool owner):
+    name_(name),
+    header_(static_cast<Header *>(base)),
+    mapped_size_(mapped_size),
+    owner_(owner) {
+}
+
+ShmRing::~ShmRing() {
+    munmap(header_, mapped_size_);
+    if (owner_) shm_unlink(name_.c_str());
+}
+
+std::shared_ptr<ShmRing> ShmRing::Create(const std::string &name, int num_slots, size_t slot_size) {
+    CHECK_GT(num_slots, 0);
+    size_t slot_stride = Align(sizeof(uint64_t) + slot_size);
+    size_t mapped_size = Align(sizeof(Header)) + num_slots * slot_stride;
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        LOG(WARNING) << "failed to create shared memory " << name << ": " << strerror(errno);
+        return nullptr;
+    }
+    void *base = MAP_FAILED;
+    if (ftruncate(fd, mapped_size) == 0) {
+        base = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (base == MAP_FAILED) {
+        LOG(WARNING) << "failed to map shared memory " << name << ": " << strerror(errno);
+        shm_unlink(name.c_str());
+        return nullptr;
+    }
+    // the segment is zero filled
+    Header *header = static_cast<Header *>(base);
+    header->num_slots = num_slots;
+    header->slot_size = slot_size;
+    header->slot_stride = slot_stride;
+    header->write_seq.store(0);
+    header->read_seq.store(0);
+    header->magic.store(kMagic, std::memory_order_release);
+    return std::shared_ptr<ShmRing>(new ShmRing(name, base, mapped_size, true));
+}
+
+std::shared_ptr<ShmRing> ShmRing::Open(const std::string &name) {
+    int fd = shm_open(name.c_str(), O_RDWR, 0600);
+    if (fd < 0) return nullptr;
+    struct stat st;
+    void *base = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(Header)) {
+        base = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (base == MAP_FAILED) return nullptr;
+    Header *header = static_cast<Header *>(base);
+    if (header->magic.load(std::memory_order_acquire) != kMagic
+        || header->num_slots == 0
+        || header->slot_stride < sizeof(uint64_t) + header->slot_size
+        || Align(sizeof(Header)) + header->num_slots * header->slot_stride > (size_t)st.st_size) {
+        munmap(base, st.st_size);
+        return nullptr;
+    }
+    return std::shared_ptr<ShmRing>(new ShmRing(name, base, st.st_size, false));
+}
+
+uint8_t *ShmRing::Slot(uint32_t seq) const {
+    return reinterpret_cast<uint8_t *>(header_) + Align(sizeof(Header))
+        + (seq % header_->num_slots) * header_->slot_stride;
+}
+
+uint8_t *ShmRing::Reserve(int timeout_ms) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    // only the producer advances write_seq
+    uint32_t w = header_->write_seq.load(std::memory_order_relaxed);
+    while (true) {
+        uint32_t r = header_->read_seq.load(std::memory_order_acquire);
+        if (w - r < header_->num_slots) return Slot(w) + sizeof(uint64_t);
+        if (timeout_ms >= 0 && std::chrono::steady_clock::now() >= deadline) return nullptr;
+        FutexWait(&header_->read_seq, r, timeout_ms >= 0 ? &deadline : nullptr);
+    }
+}
+
+void ShmRing::Commit(size_t size) {
+    CHECK_LE(size, header_->slot_size) << "message exceeds the slot of " << name_;
+    uint32_t w = header_->write_seq.load(std::memory_order_relaxed);
+    *reinterpret_cast<uint64_t *>(Slot(w)) = size;
+    header_->write_seq.store(w + 1, std::memory_order_release);
+    FutexWake(&header_->write_seq);
+}
+
+const uint8_t *ShmRing::Acquire(size_t *size, int timeout_ms) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    // only the consumer advances read_seq
+    uint32_t r = header_->read_seq.load(std::memory_order_relaxed);
+    while (true) {
+        uint32_t w = header_->write_seq.load(std::memory_order_acquire);
+        if (w != r) {
+            // written by the peer, never trusted to stay within the slot
+            *size = *reinterpret_cast<const uint64_t *>(Slot(r));
+            if (*size > slot_size()) {
+                LOG(WARNING) << "message of " << *size << " bytes exceeds the slot of " << name_ << ", dropped";
+                *size = 0;
+            }
+            return Slot(r) + sizeof(uint64_t);
+        }
+        if (timeout_ms >= 0 && std::chrono::steady_clock::now() >= deadline) return nullptr;
+        FutexWait(&header_->write_seq, w, timeout_ms >= 0 ? &deadline : nullptr);
+    }
+}
+
+void ShmRing::Release() {
+    uint32_t r = header_->read_seq.load(std::memory_order_relaxed);
+    CHECK(r != header_->write_seq.load(std::memory_order_acquire)) << "nothing acquired from " << name_;
+    header_->read_seq.store(r + 1, std::memory_order_release);
+    FutexWake(&header_->read_seq);
+}
+
+int ShmRing::num_slots() const {
+    return header_->num_slots;
+}
+
+size_t ShmRing::slot_size() const {
+    return header_->slot_size;
+}
+
+int ShmRing::size() const {
+    return header_->write_seq.load(std::memory_order_acquire) - header_->read_seq.load(std::memory_order_acquire);
+}
+
+}   // namespace feh
@@ -0,0 +1,67 @@
+//
+// Shared memory ring buffer for local inter-process communication.
+//
+#pragma once
+// stl
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace feh {
+
+/// \brief: Single producer, single consumer ring of fixed size slots in POSIX shared memory.
+/// The producer writes a message in place into the slot returned by Reserve and publishes it
+/// by Commit, the consumer reads it in place from the slot returned by Acquire until Release,
+/// thus payloads are never copied through the transport. Waiting sides sleep on futexes in
+/// the shared segment, which are woken by the other process.
+/// One process creates the ring, the peer opens it by name. Linux only.
+class ShmRing {
+public:
+    ~ShmRing();
+    ShmRing(const ShmRing &) = delete;
+    ShmRing &operator=(const ShmRing &) = delete;
+
+    /// \brief: Create a ring, an existing segment of the same name is replaced.
+    /// The segment is unlinked when the creator is destroyed.
+    /// \param name: POSIX shared memory name, e.g., "/visma_request".
+    /// \return: null on failure.
+    static std::shared_ptr<ShmRing> Create(const std::string &name, int num_slots, size_t slot_size);
+    /// \brief: Open a ring created by another process.
+    /// \return: null if it does not exist (yet) or is not a ring.
+    static std::shared_ptr<ShmRing> Open(const std::string &name);
+
+    /// \brief: Wait for a free slot.
+    /// \param timeout_ms: negative to wait forever.
+    /// \return: the payload of the slot, of capacity slot_size(), null on timeout.
+    uint8_t *Reserve(int timeout_ms=-1);
+    /// \brief: Publish the reserved slot holding size bytes.
+    void Commit(size_t size);
+    /// \brief: Wait for the oldest message not yet released.
+    /// \param timeout_ms: negative to wait forever.
+    /// \return: the payload, valid until Release, null on timeout. A size beyond the slot
+    /// is reported as an empty message, which still has to be released.
+    const uint8_t *Acquire(size_t *size, int timeout_ms=-1);
+    /// \brief: Hand the acquired slot back to the producer.
+    void Release();
+
+    const std::string &name() const { return name_; }
+    int num_slots() const;
+    size_t slot_size() const;
+    /// \brief: Number of messages committed and not released yet.
+    int size() const;
+
+private:
+    struct Header;
+    ShmRing(const std::string &name, void *base, size_t mapped_size, bool owner);
+    uint8_t *Slot(uint32_t seq) const;
+
+    std::string name_;
+    Header *header_;
+    size_t mapped_size_;
+    bool owner_;
+};
+
+typedef std::shared_ptr<ShmRing> ShmRingPtr;
+
+}   // namespace feh
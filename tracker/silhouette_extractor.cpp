@@ -0,0 +1,178 @@
+#include "silhouette_extractor.h"
+
+// stl
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+// 3rd party
+#include "glog/logging.h"
+#include "tbb/parallel_for.h"
+#include "tbb/blocked_range.h"
+
+namespace feh {
+
+namespace {
+// cosine of the angle below which adjacent faces are treated as coplanar
+constexpr float kCoplanarCos = 1 - 1e-6;
+}
+
+SilhouetteExtractor::SilhouetteExtractor(const MatXf &V, const MatXi &F, float crease_angle):
+    vertices_(V.rows()),
+    rows_(0), cols_(0),
+    z_near_(0.05),
+    fx_(0), fy_(0), cx_(0), cy_(0) {
+    CHECK_EQ(V.cols(), 3);
+    CHECK_EQ(F.cols(), 3);
+    for (int i = 0; i < V.rows(); ++i) {
+        vertices_[i] = V.row(i).transpose();
+    }
+    std::vector<Vec3f> normals(F.rows());
+    for (int f = 0; f < F.rows(); ++f) {
+        const Vec3f &a = vertices_[F(f, 0)];
+        Vec3f n = (vertices_[F(f, 1)] - a).cross(vertices_[F(f, 2)] - a);
+        if (n.norm() > 0) n.normalize();
+        normals[f] = n;
+    }
+
+    // edge adjacency
+    std::vector<std::array<int, 5>> half_edges;   // (min vertex, max vertex, face, opposite vertex, forward)
+    half_edges.reserve(3 * F.rows());
+    for (int f = 0; f < F.rows(); ++f) {
+        for (int k = 0; k < 3; ++k) {
+            int a = F(f, k), b = F(f, (k + 1) % 3);
+            if (a != b) half_edges.push_back({std::min(a, b), std::max(a, b), f, F(f, (k + 2) % 3), a < b});
+        }
+    }
+    std::sort(half_edges.begin(), half_edges.end());
+    float crease_cos = std::cos(crease_angle);
+    for (int i = 0; i < half_edges.size(); ) {
+        int j = i;
+        while (j < half_edges.size()
+               && half_edges[j][0] == half_edges[i][0]
+               && half_edges[j][1] == half_edges[i][1]) ++j;
+        Edge edge{half_edges[i][0], half_edges[i][1], half_edges[i][3], -1, false};
+        if (j - i == 1) {
+            edges_.push_back(edge);
+        } else {
+            // non-manifold edges are split into pairs of faces
+            for (int k = i + 1; k < j; ++k) {
+                edge.w1 = half_edges[k][3];
+                // the shared edge runs in opposite directions in consistently oriented faces
+                float sign = half_edges[i][4] != half_edges[k][4] ? 1 : -1;
+                float cos_dihedral = sign * normals[half_edges[i][2]].dot(normals[half_edges[k][2]]);
+                edge.crease = crease_angle < M_PI && cos_dihedral < crease_cos;
+                // coplanar faces can never be separated by a contour
+                if (cos_dihedral < kCoplanarCos) edges_.push_back(edge);
+            }
+        }
+        i = j;
+    }
+    LOG(INFO) << edges_.size() << " potential contour edges out of " << half_edges.size() << " half edges";
+}
+
+void SilhouetteExtractor::SetCamera(int rows, int cols, float z_near, float fx, float fy, float cx, float cy) {
+    rows_ = rows;
+    cols_ = cols;
+    z_near_ = z_near;
+    fx_ = fx;
+    fy_ = fy;
+    cx_ = cx;
+    cy_ = cy;
+}
+
+void SilhouetteExtractor::ComputeEdgePixels(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &pose,
+                                            std::vector<EdgePixel> &edgelist) const {
+    CHECK_GT(rows_, 0) << "camera not set";
+    edgelist.clear();
+    Mat3f R = pose.block<3, 3>(0, 0);
+    Vec3f T = pose.block<3, 1>(0, 3);
+    // camera center in object frame
+    Vec3f center = -R.transpose() * T;
+
+    for (const Edge &edge : edges_) {
+        bool contour;
+        if (edge.w1 < 0) {
+            // faces are not culled, an open boundary is always part of the outline
+            contour = true;
+        } else {
+            // silhouette if both faces are on the same side of the plane through the camera center
+            // and the edge, which does not depend on the orientation of the faces
+            Vec3f n = (vertices_[edge.v0] - center).cross(vertices_[edge.v1] - center);
+            float side0 = n.dot(vertices_[edge.w0] - center);
+            float side1 = n.dot(vertices_[edge.w1] - center);
+            contour = side0 * side1 > 0 || edge.crease;
+        }
+        if (contour) {
+            SampleSegment(R * vertices_[edge.v0] + T, R * vertices_[edge.v1] + T, edgelist);
+        }
+    }
+
+    // segments share end points, keep one sample per pixel
+    std::sort(edgelist.begin(), edgelist.end(),
+              [](const EdgePixel &e1, const EdgePixel &e2) {
+                  return e1.y < e2.y || (e1.y == e2.y && e1.x < e2.x);
+              });
+    edgelist.erase(std::unique(edgelist.begin(), edgelist.end(),
+                               [](const EdgePixel &e1, const EdgePixel &e2) {
+                                   return e1.x == e2.x && e1.y == e2.y;
+                               }),
+                   edgelist.end());
+}
+
+void SilhouetteExtractor::ComputeEdgePixels(const Mat4fColMajorList &poses,
+                                            std::vector<std::vector<EdgePixel>> &edgelists) const {
+    edgelists.resize(poses.size());
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, poses.size()),
+                      [this, &poses, &edgelists](const tbb::blocked_range<size_t> &range) {
+                          for (size_t i = range.begin(); i < range.end(); ++i) {
+                              ComputeEdgePixels(poses[i], edgelists[i]);
+                          }
+                      });
+}
+
+void SilhouetteExtractor::SampleSegment(Vec3f p0, Vec3f p1, std::vector<EdgePixel> &edgelist) const {
+    // clip at the near plane
+    if (p0(2) < z_near_ && p1(2) < z_near_) return;
+    if (p0(2) < z_near_ || p1(2) < z_near_) {
+        if (p0(2) < z_near_) std::swap(p0, p1);
+        float a = (p0(2) - z_near_) / (p0(2) - p1(2));
+        p1 = p0 + a * (p1 - p0);
+    }
+    float u0 = fx_ * p0(0) / p0(2) + cx_, v0 = fy_ * p0(1) / p0(2) + cy_;
+    float u1 = fx_ * p1(0) / p1(2) + cx_, v1 = fy_ * p1(1) / p1(2) + cy_;
+    float du = u1 - u0, dv = v1 - v0;
+    // direction of the contour normal in the image
+    float dir = std::atan2(du, -dv);
+
+    // clip against the image (Liang-Barsky), such that far off-screen segments cost nothing
+    float a_min(0), a_max(1);
+    const float p[] = {-du, du, -dv, dv};
+    const float q[] = {u0 - 1, cols_ - 2 - u0, v0 - 1, rows_ - 2 - v0};
+    for (int k = 0; k < 4; ++k) {
+        if (p[k] == 0) {
+            if (q[k] < 0) return;
+        } else {
+            float a = q[k] / p[k];
+            if (p[k] < 0) a_min = std::max(a_min, a);
+            else a_max = std::min(a_max, a);
+        }
+    }
+    if (a_min > a_max) return;
+
+    // one sample per pixel along the major axis, depth is interpolated perspective-correctly
+    float length = (a_max - a_min) * std::max(std::fabs(du), std::fabs(dv));
+    int steps = std::max(1, (int)std::ceil(length));
+    float inv_z0 = 1 / p0(2), inv_z1 = 1 / p1(2);
+    for (int s = 0; s <= steps; ++s) {
+        float a = a_min + (a_max - a_min) * s / steps;
+        int x = std::round(u0 + a * du);
+        int y = std::round(v0 + a * dv);
+        // same margin as shaders/edgelist.comp
+        if (x < 1 || y < 1 || x >= cols_ - 1 || y >= rows_ - 1) continue;
+        float depth = 1 / (inv_z0 + a * (inv_z1 - inv_z0));
+        edgelist.push_back({float(x), float(y), dir, depth});
+    }
+}
+
+}   // namespace feh
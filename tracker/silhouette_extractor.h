@@ -0,0 +1,69 @@
+//
+// Geometric contour extraction without rasterizing depth.
+//
+#pragma once
+// stl
+#include <vector>
+#include <memory>
+
+// 3rd party
+#include "Eigen/Dense"
+
+// own
+#include "alias.h"
+#include "oned_search.h"
+
+namespace feh {
+
+/// \brief: Finds contour edges of a mesh by front/back face tests and samples them into
+/// edge pixels, instead of rendering a depth map and detecting edges on every pixel.
+/// Edge adjacency is computed once per mesh, the cost per pose is linear in the number
+/// of edges, which pays off for low-poly inference meshes.
+/// Contour edges are silhouette edges (between a front and a back facing face), open
+/// boundary edges and, optionally, crease edges. Face orientation is not required to be
+/// consistent, since faces are not culled by the renderer either.
+/// NOTE: There is no occlusion test, contours hidden behind other parts of the object
+/// are returned as well. The outline, and thus the enclosing rectangle, is exact.
+/// All the methods are const and thread-safe.
+class SilhouetteExtractor {
+public:
+    /// \param V, F: mesh in object frame, vertices and faces are rows.
+    /// \param crease_angle: dihedral angle (radians) above which an edge is always a contour,
+    /// crease edges are off by default.
+    SilhouetteExtractor(const MatXf &V, const MatXi &F, float crease_angle=M_PI);
+
+    /// \brief: Set pinhole camera & image size, conventions are the same as Renderer::SetCamera.
+    void SetCamera(int rows, int cols, float z_near, float fx, float fy, float cx, float cy);
+
+    /// \brief: Edge pixels along the contours, same layout as Renderer::ComputeEdgePixels:
+    /// pixel coordinates, direction of the contour normal in the image and depth.
+    /// \param pose: g(camera <- object), computer vision convention.
+    void ComputeEdgePixels(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &pose,
+                           std::vector<EdgePixel> &edgelist) const;
+    /// \brief: Same as above for many poses, parallel over poses.
+    void ComputeEdgePixels(const Mat4fColMajorList &poses,
+                           std::vector<std::vector<EdgePixel>> &edgelists) const;
+
+    int num_edges() const { return edges_.size(); }
+
+private:
+    /// \brief: Sample the segment between two points in camera frame, clipped at the near plane.
+    void SampleSegment(Vec3f p0, Vec3f p1, std::vector<EdgePixel> &edgelist) const;
+
+    struct Edge {
+        int v0, v1;
+        int w0, w1;     // opposite vertices of the adjacent faces, w1 < 0 for boundary edges
+        bool crease;
+    };
+    std::vector<Vec3f> vertices_;
+    // edges which can become contours, i.e., edges between coplanar faces are dropped
+    std::vector<Edge> edges_;
+
+    int rows_, cols_;
+    float z_near_;
+    float fx_, fy_, cx_, cy_;
+};
+
+typedef std::shared_ptr<SilhouetteExtractor> SilhouetteExtractorPtr;
+
+}   // namespace feh
@@ -0,0 +1,642 @@
+#include "software_rasterizer.h"
+
+// stl
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// 3rd party
+#include "glog/logging.h"
+#include "tbb/parallel_for.h"
+#include "tbb/blocked_range.h"
+
+// sse
+#include <smmintrin.h>
+
+namespace feh {
+
+namespace {
+// Tile size of the binning rasterizer, must be a multiple of the SSE width.
+constexpr int kTileSize = 32;
+// Number of faces per triangle setup task.
+constexpr int kFacesPerChunk = 1024;
+// Polygon clipped against 6 frustum planes has at most 3+6 vertices.
+constexpr int kMaxClipVertices = 12;
+// Rows per edge extraction task.
+constexpr int kRowsPerChunk = 8;
+// GL_DEPTH_COMPONENT24
+constexpr float kDepthScale = 16777215.0f;
+// Local size of the compute shaders. glDispatchCompute(cols_/16.0, rows_/16.0, 1)
+// truncates the number of work groups, we mimic the coverage.
+constexpr int kComputeGroupSize = 16;
+
+// Constants of shaders/edge_detection.frag, z_near & z_far are set in Renderer::Renderer.
+constexpr float kEdgeShaderZNear = 0.05f;
+constexpr float kEdgeShaderZFar = 2.0f;
+constexpr float kEdgeThreshLow = 0.05f;
+constexpr float kEdgeThreshHigh = 0.10f;
+constexpr int kEdgeShaderBorder = 5;
+// Constants of shaders/edgelist.comp & shaders/oned.comp.
+constexpr float kEdgeListThresh = 0.1f;
+constexpr float kShaderEps = 1e-4f;
+// Margin of the scissor box around the region of interest, such that 3x3 neighborhoods
+// of pixels in the region are rendered. Same as Renderer.
+constexpr int kROIMargin = 1;
+
+inline int Outcode(const float *v) {
+    int code = 0;
+    if (v[0] < -v[3]) code |= 1;
+    if (v[0] > v[3]) code |= 2;
+    if (v[1] < -v[3]) code |= 4;
+    if (v[1] > v[3]) code |= 8;
+    if (v[2] < -v[3]) code |= 16;
+    if (v[2] > v[3]) code |= 32;
+    return code;
+}
+
+/// \brief: Signed distance to the i-th frustum plane in clip space, positive inside.
+inline float PlaneDistance(int i, const float *v) {
+    switch (i) {
+        case 0: return v[3] + v[0];
+        case 1: return v[3] - v[0];
+        case 2: return v[3] + v[1];
+        case 3: return v[3] - v[1];
+        case 4: return v[3] + v[2];
+        default: return v[3] - v[2];
+    }
+}
+
+/// \brief: Sutherland-Hodgman clipping of a convex polygon against the planes in the mask.
+int ClipPolygon(float (*poly)[4], int n, int planes) {
+    float tmp[kMaxClipVertices][4];
+    for (int i = 0; i < 6 && n > 0; ++i) {
+        if (!(planes & (1 << i))) continue;
+        int m = 0;
+        for (int k = 0; k < n; ++k) {
+            const float *a = poly[k];
+            const float *b = poly[(k + 1) % n];
+            float da = PlaneDistance(i, a);
+            float db = PlaneDistance(i, b);
+            if (da >= 0) {
+                std::copy(a, a + 4, tmp[m++]);
+            }
+            if ((da >= 0) != (db >= 0)) {
+                float t = da / (da - db);
+                for (int j = 0; j < 4; ++j) tmp[m][j] = a[j] + t * (b[j] - a[j]);
+                ++m;
+            }
+        }
+        for (int k = 0; k < m; ++k) std::copy(tmp[k], tmp[k] + 4, poly[k]);
+        n = m;
+    }
+    return n;
+}
+
+inline float Linearize(float z, float z_near, float z_far) {
+    if (z == 1.0f) return -1;
+    return 2 * z_near * z_far / (z_far + z_near - (2 * z - 1) * (z_far - z_near));
+}
+
+inline float Threshold(float thresh_low, float thresh_high, float value) {
+    if (value < thresh_low) return 0.0f;
+    if (value >= thresh_high) return 1.0f;
+    return (value - thresh_low) / (thresh_high - thresh_low);
+}
+
+/// \brief: Averaged absolute difference of opposite neighbors, shared by all the edge shaders.
+inline float EdgeStrength(const float *v) {
+    return 0.25f * (std::fabs(v[1] - v[7]) + std::fabs(v[5] - v[3])
+        + std::fabs(v[0] - v[8]) + std::fabs(v[2] - v[6]));
+}
+
+/// \brief: Gather 3x3 neighbors in the order of the shaders: value[3*i+j] = (x-1+i, y-1+j)
+inline void Gather3x3(const float *img, int cols, int x, int y, float *v) {
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            v[3 * i + j] = img[(y - 1 + j) * cols + x - 1 + i];
+        }
+    }
+}
+
+void DrawLine(const float *p0, const float *p1, int rows, int cols, uint8_t *out) {
+    float dx = p1[0] - p0[0];
+    float dy = p1[1] - p0[1];
+    int n = std::ceil(std::max(std::fabs(dx), std::fabs(dy)));
+    for (int i = 0; i <= n; ++i) {
+        float t = n > 0 ? float(i) / n : 0;
+        int u = std::floor(p0[0] + t * dx);
+        int v = std::floor(p0[1] + t * dy);
+        if (u >= 0 && u < cols && v >= 0 && v < rows) {
+            out[v * cols + u] = 0;
+        }
+    }
+}
+
+}   // namespace
+
+
+SoftwareRasterizer::SoftwareRasterizer(int rows, int cols):
+    rows_(rows),
+    cols_(cols),
+    stride_((cols + 3) & ~3),
+    tiles_x_((cols + kTileSize - 1) / kTileSize),
+    tiles_y_((rows + kTileSize - 1) / kTileSize),
+    z_near_(0.05f),
+    z_far_(5.0f),
+    projection_(Eigen::Matrix<float, 4, 4, Eigen::ColMajor>::Identity()),
+    view_(Eigen::Matrix<float, 4, 4, Eigen::ColMajor>::Identity()),
+    depth_(rows * ((cols + 3) & ~3), 1.0f),
+    linear_depth_(rows * cols, -1.0f),
+    bins_(tiles_x_ * tiles_y_),
+    evidence_(std::make_shared<std::vector<uint8_t>>()),
+    evidence_dir_(std::make_shared<std::vector<float>>()),
+    search_line_length_(40),
+    intensity_thresh_(128),
+    direction_thresh_(0.8f)
+{
+    dirty_[0] = linear_dirty_[0] = cols_;
+    dirty_[1] = linear_dirty_[1] = rows_;
+    dirty_[2] = linear_dirty_[2] = -1;
+    dirty_[3] = linear_dirty_[3] = -1;
+    ClearROI();
+}
+
+void SoftwareRasterizer::SetProjection(float z_near, float z_far, const float *projection) {
+    z_near_ = z_near;
+    z_far_ = z_far;
+    projection_ = Eigen::Map<const Eigen::Matrix<float, 4, 4, Eigen::ColMajor>>(projection);
+}
+
+void SoftwareRasterizer::SetView(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &view) {
+    view_ = view;
+}
+
+void SoftwareRasterizer::SetMesh(const float *vertices, int num_vertices, const int *faces, int num_faces) {
+    vertices_.resize(4, num_vertices);
+    for (int i = 0; i < num_vertices; ++i) {
+        vertices_.col(i) << vertices[3 * i], vertices[3 * i + 1], vertices[3 * i + 2], 1.0f;
+    }
+    faces_.assign(faces, faces + 3 * num_faces);
+}
+
+void SoftwareRasterizer::SetOneDimSearch(int search_line_length,
+                                         int intensity_thresh,
+                                         float direction_thresh) {
+    if (search_line_length >= 0) search_line_length_ = search_line_length;
+    if (intensity_thresh >= 0) intensity_thresh_ = intensity_thresh;
+    if (direction_thresh >= 0) direction_thresh_ = direction_thresh;
+}
+
+void SoftwareRasterizer::SetROI(int x, int y, int width, int height) {
+    has_roi_ = true;
+    // possibly empty, i.e., xmax = xmin - 1
+    roi_[0] = std::min(std::max(0, x), cols_);
+    roi_[1] = std::min(std::max(0, y), rows_);
+    roi_[2] = std::max(roi_[0], std::min(cols_, x + width)) - 1;
+    roi_[3] = std::max(roi_[1], std::min(rows_, y + height)) - 1;
+    scissor_[0] = std::max(0, roi_[0] - kROIMargin);
+    scissor_[1] = std::max(0, roi_[1] - kROIMargin);
+    scissor_[2] = std::min(cols_ - 1, roi_[2] + kROIMargin);
+    scissor_[3] = std::min(rows_ - 1, roi_[3] + kROIMargin);
+}
+
+void SoftwareRasterizer::ClearROI() {
+    has_roi_ = false;
+    roi_[0] = scissor_[0] = 0;
+    roi_[1] = scissor_[1] = 0;
+    roi_[2] = scissor_[2] = cols_ - 1;
+    roi_[3] = scissor_[3] = rows_ - 1;
+}
+
+void SoftwareRasterizer::UploadEvidence(const uint8_t *data_ptr) {
+    evidence_->assign(data_ptr, data_ptr + rows_ * cols_);
+}
+
+void SoftwareRasterizer::UploadEvidenceDirection(const float *data_ptr) {
+    evidence_dir_->assign(data_ptr, data_ptr + rows_ * cols_);
+}
+
+void SoftwareRasterizer::ShareEvidence(const SoftwareRasterizer &other) {
+    CHECK_EQ(rows_, other.rows_);
+    CHECK_EQ(cols_, other.cols_);
+    evidence_ = other.evidence_;
+    evidence_dir_ = other.evidence_dir_;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Rasterization
+////////////////////////////////////////////////////////////////////////////////
+void SoftwareRasterizer::ClearDepth() {
+    if (dirty_[0] > dirty_[2]) return;
+    for (int y = dirty_[1]; y <= dirty_[3]; ++y) {
+        std::fill(depth_.begin() + y * stride_ + dirty_[0],
+                  depth_.begin() + y * stride_ + dirty_[2] + 1,
+                  1.0f);
+    }
+    dirty_[0] = cols_;
+    dirty_[1] = rows_;
+    dirty_[2] = -1;
+    dirty_[3] = -1;
+}
+
+int SoftwareRasterizer::ClipFace(int face, float (*poly)[4]) const {
+    int outcodes[3];
+    for (int k = 0; k < 3; ++k) {
+        const float *v = clip_.col(faces_[3 * face + k]).data();
+        std::copy(v, v + 4, poly[k]);
+        outcodes[k] = Outcode(v);
+    }
+    // trivial rejection: all vertices outside the same plane
+    if (outcodes[0] & outcodes[1] & outcodes[2]) return 0;
+    int n = 3;
+    int planes = outcodes[0] | outcodes[1] | outcodes[2];
+    if (planes) n = ClipPolygon(poly, n, planes);
+    // perspective division & viewport transformation, glViewport(0, 0, cols_, rows_) and glDepthRange(0, 1)
+    for (int k = 0; k < n; ++k) {
+        float inv_w = 1.0f / poly[k][3];
+        poly[k][0] = (poly[k][0] * inv_w + 1) * 0.5f * cols_;
+        poly[k][1] = (poly[k][1] * inv_w + 1) * 0.5f * rows_;
+        poly[k][2] = (poly[k][2] * inv_w + 1) * 0.5f;
+    }
+    return n;
+}
+
+bool SoftwareRasterizer::SetupTriangle(const float *v0, const float *v1, const float *v2, Triangle *tri) const {
+    double x[3] = {v0[0], v1[0], v2[0]};
+    double y[3] = {v0[1], v1[1], v2[1]};
+    double z[3] = {v0[2], v1[2], v2[2]};
+    double area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (area == 0) return false;
+    // face culling is disabled in the GL path: make all triangles counter-clockwise
+    if (area < 0) {
+        std::swap(x[1], x[2]);
+        std::swap(y[1], y[2]);
+        std::swap(z[1], z[2]);
+        area = -area;
+    }
+    // pixel (i, j) is covered if its center (j+0.5, i+0.5) is inside the triangle
+    double xmin = std::min({x[0], x[1], x[2]});
+    double xmax = std::max({x[0], x[1], x[2]});
+    double ymin = std::min({y[0], y[1], y[2]});
+    double ymax = std::max({y[0], y[1], y[2]});
+    // scissor test
+    tri->xmin = std::max(scissor_[0], (int)std::ceil(xmin - 0.5));
+    tri->xmax = std::min(scissor_[2], (int)std::floor(xmax - 0.5));
+    tri->ymin = std::max(scissor_[1], (int)std::ceil(ymin - 0.5));
+    tri->ymax = std::min(scissor_[3], (int)std::floor(ymax - 0.5));
+    if (tri->xmin > tri->xmax || tri->ymin > tri->ymax) return false;
+
+    double px = tri->xmin + 0.5;
+    double py = tri->ymin + 0.5;
+    for (int k = 0; k < 3; ++k) {
+        int l = (k + 1) % 3;
+        // E(p) = a * (p.x - x_k) + b * (p.y - y_k), positive on the left of edge k->l
+        double a = y[k] - y[l];
+        double b = x[l] - x[k];
+        tri->a[k] = a;
+        tri->b[k] = b;
+        tri->e0[k] = a * (px - x[k]) + b * (py - y[k]);
+        // window y points upward, top edges run right to left, left edges run downward
+        tri->top_left[k] = a > 0 || (a == 0 && b < 0);
+    }
+    // depth is affine in window coordinates
+    double za = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) / area;
+    double zb = ((x[1] - x[0]) * (z[2] - z[0]) - (x[2] - x[0]) * (z[1] - z[0])) / area;
+    tri->za = za;
+    tri->zb = zb;
+    tri->z0 = z[0] + za * (px - x[0]) + zb * (py - y[0]);
+    return true;
+}
+
+void SoftwareRasterizer::Rasterize(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model) {
+    ClearDepth();
+    Eigen::Matrix<float, 4, 4, Eigen::ColMajor> mvp = projection_ * view_ * model;
+    clip_.noalias() = mvp * vertices_;
+
+    // triangle setup
+    int num_faces = faces_.size() / 3;
+    int num_chunks = (num_faces + kFacesPerChunk - 1) / kFacesPerChunk;
+    if ((int)chunk_triangles_.size() < num_chunks) chunk_triangles_.resize(num_chunks);
+    tbb::parallel_for(tbb::blocked_range<int>(0, num_chunks),
+        [this, num_faces](const tbb::blocked_range<int> &range) {
+            float poly[kMaxClipVertices][4];
+            for (int c = range.begin(); c < range.end(); ++c) {
+                auto &tris = chunk_triangles_[c];
+                tris.clear();
+                int end = std::min(num_faces, (c + 1) * kFacesPerChunk);
+                for (int f = c * kFacesPerChunk; f < end; ++f) {
+                    int n = ClipFace(f, poly);
+                    for (int k = 1; k + 1 < n; ++k) {
+                        Triangle tri;
+                        if (SetupTriangle(poly[0], poly[k], poly[k + 1], &tri)) {
+                            tris.push_back(tri);
+                        }
+                    }
+                }
+            }
+        });
+
+    // binning, triangles keep the submission order within each tile
+    triangles_.clear();
+    for (auto &bin : bins_) bin.clear();
+    for (int c = 0; c < num_chunks; ++c) {
+        for (const auto &tri : chunk_triangles_[c]) {
+            int index = triangles_.size();
+            triangles_.push_back(tri);
+            for (int ty = tri.ymin / kTileSize; ty <= tri.ymax / kTileSize; ++ty) {
+                for (int tx = tri.xmin / kTileSize; tx <= tri.xmax / kTileSize; ++tx) {
+                    bins_[ty * tiles_x_ + tx].push_back(index);
+                }
+            }
+            dirty_[0] = std::min(dirty_[0], tri.xmin);
+            dirty_[1] = std::min(dirty_[1], tri.ymin);
+            dirty_[2] = std::max(dirty_[2], tri.xmax);
+            dirty_[3] = std::max(dirty_[3], tri.ymax);
+        }
+    }
+
+    // rasterization, tiles are independent
+    tbb::parallel_for(tbb::blocked_range<int>(0, tiles_x_ * tiles_y_),
+        [this](const tbb::blocked_range<int> &range) {
+            const __m128 lane = _mm_setr_ps(0, 1, 2, 3);
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 depth_scale = _mm_set1_ps(kDepthScale);
+            for (int t = range.begin(); t < range.end(); ++t) {
+                if (bins_[t].empty()) continue;
+                int tx0 = (t % tiles_x_) * kTileSize;
+                int ty0 = (t / tiles_x_) * kTileSize;
+                int tx1 = std::min(tx0 + kTileSize, cols_) - 1;
+                int ty1 = std::min(ty0 + kTileSize, rows_) - 1;
+                for (int index : bins_[t]) {
+                    const Triangle &tri = triangles_[index];
+                    int x0 = std::max(tri.xmin, tx0);
+                    int x1 = std::min(tri.xmax, tx1);
+                    int y0 = std::max(tri.ymin, ty0);
+                    int y1 = std::min(tri.ymax, ty1);
+                    // aligned start, stays inside the tile since tiles are aligned
+                    int xs = x0 & ~3;
+
+                    __m128 step[3];
+                    for (int k = 0; k < 3; ++k) step[k] = _mm_set1_ps(4 * tri.a[k]);
+                    __m128 zstep = _mm_set1_ps(4 * tri.za);
+
+                    for (int y = y0; y <= y1; ++y) {
+                        float dx = xs - tri.xmin;
+                        float dy = y - tri.ymin;
+                        __m128 e[3];
+                        for (int k = 0; k < 3; ++k) {
+                            e[k] = _mm_add_ps(_mm_set1_ps(tri.e0[k] + tri.a[k] * dx + tri.b[k] * dy),
+                                              _mm_mul_ps(_mm_set1_ps(tri.a[k]), lane));
+                        }
+                        __m128 z = _mm_add_ps(_mm_set1_ps(tri.z0 + tri.za * dx + tri.zb * dy),
+                                              _mm_mul_ps(_mm_set1_ps(tri.za), lane));
+                        float *row = &depth_[y * stride_];
+                        for (int x = xs; x <= x1; x += 4) {
+                            __m128 mask = _mm_cmple_ps(lane, _mm_set1_ps(x1 - x));
+                            for (int k = 0; k < 3; ++k) {
+                                mask = _mm_and_ps(mask, tri.top_left[k] ?
+                                                        _mm_cmpge_ps(e[k], zero) :
+                                                        _mm_cmpgt_ps(e[k], zero));
+                            }
+                            if (_mm_movemask_ps(mask)) {
+                                // depth values are stored with the precision of a 24-bit depth buffer
+                                __m128 zq = _mm_div_ps(
+                                    _mm_round_ps(_mm_mul_ps(z, depth_scale), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC),
+                                    depth_scale);
+                                __m128 old = _mm_loadu_ps(row + x);
+                                mask = _mm_and_ps(mask, _mm_cmplt_ps(zq, old));
+                                _mm_storeu_ps(row + x, _mm_blendv_ps(old, zq, mask));
+                            }
+                            for (int k = 0; k < 3; ++k) e[k] = _mm_add_ps(e[k], step[k]);
+                            z = _mm_add_ps(z, zstep);
+                        }
+                    }
+                }
+            }
+        });
+}
+
+void SoftwareRasterizer::LinearizeDepth(float z_near, float z_far) {
+    for (int y = linear_dirty_[1]; y <= linear_dirty_[3]; ++y) {
+        std::fill(linear_depth_.begin() + y * cols_ + linear_dirty_[0],
+                  linear_depth_.begin() + y * cols_ + linear_dirty_[2] + 1,
+                  -1.0f);
+    }
+    std::copy(dirty_, dirty_ + 4, linear_dirty_);
+    for (int y = dirty_[1]; y <= dirty_[3]; ++y) {
+        const float *src = &depth_[y * stride_];
+        float *dst = &linear_depth_[y * cols_];
+        for (int x = dirty_[0]; x <= dirty_[2]; ++x) {
+            dst[x] = Linearize(src[x], z_near, z_far);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Render passes
+////////////////////////////////////////////////////////////////////////////////
+void SoftwareRasterizer::RenderDepth(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model, float *out) {
+    Rasterize(model);
+    if (out) {
+        // only the region of interest is read back
+        if (has_roi_) std::fill(out, out + rows_ * cols_, 1.0f);
+        for (int y = roi_[1]; y <= roi_[3] && roi_[0] <= roi_[2]; ++y) {
+            std::memcpy(out + y * cols_ + roi_[0], &depth_[y * stride_ + roi_[0]],
+                        (roi_[2] - roi_[0] + 1) * sizeof(float));
+        }
+    }
+}
+
+void SoftwareRasterizer::RenderMask(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model, uint8_t *out) {
+    Rasterize(model);
+    if (out) {
+        std::memset(out, 255, rows_ * cols_);
+        for (int y = std::max(dirty_[1], roi_[1]); y <= std::min(dirty_[3], roi_[3]); ++y) {
+            for (int x = std::max(dirty_[0], roi_[0]); x <= std::min(dirty_[2], roi_[2]); ++x) {
+                if (depth_[y * stride_ + x] < 1.0f) out[y * cols_ + x] = 0;
+            }
+        }
+    }
+}
+
+void SoftwareRasterizer::RenderEdge(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model, uint8_t *out) {
+    Rasterize(model);
+    if (out == nullptr) return;
+    LinearizeDepth(kEdgeShaderZNear, kEdgeShaderZFar);
+    std::memset(out, 0, rows_ * cols_);
+    // pixels within kEdgeShaderBorder of the image boundary are zero
+    int x0 = std::max({dirty_[0], roi_[0], kEdgeShaderBorder});
+    int x1 = std::min({dirty_[2], roi_[2], cols_ - kEdgeShaderBorder - 1});
+    int y0 = std::max({dirty_[1], roi_[1], kEdgeShaderBorder});
+    int y1 = std::min({dirty_[3], roi_[3], rows_ - kEdgeShaderBorder - 1});
+    if (y0 > y1) return;
+    tbb::parallel_for(tbb::blocked_range<int>(y0, y1 + 1, kRowsPerChunk),
+        [this, x0, x1, out](const tbb::blocked_range<int> &range) {
+            float value[9];
+            for (int y = range.begin(); y < range.end(); ++y) {
+                for (int x = x0; x <= x1; ++x) {
+                    if (linear_depth_[y * cols_ + x] == -1) continue;
+                    Gather3x3(&linear_depth_[0], cols_, x, y, value);
+                    float edge = Threshold(kEdgeThreshLow, kEdgeThreshHigh, EdgeStrength(value));
+                    out[y * cols_ + x] = static_cast<uint8_t>(edge * 255 + 0.5f);
+                }
+            }
+        });
+}
+
+void SoftwareRasterizer::RenderWireframe(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model, uint8_t *out) {
+    if (out == nullptr) return;
+    Eigen::Matrix<float, 4, 4, Eigen::ColMajor> mvp = projection_ * view_ * model;
+    clip_.noalias() = mvp * vertices_;
+    std::memset(out, 255, rows_ * cols_);
+    // polygon mode GL_LINE without filled surfaces: every edge is visible
+    float poly[kMaxClipVertices][4];
+    for (int f = 0; f < (int)faces_.size() / 3; ++f) {
+        int n = ClipFace(f, poly);
+        for (int k = 0; k < n && n >= 3; ++k) {
+            DrawLine(poly[k], poly[(k + 1) % n], rows_, cols_, out);
+        }
+    }
+    if (has_roi_) {
+        // background outside of the region of interest
+        for (int y = 0; y < rows_; ++y) {
+            uint8_t *row = out + y * cols_;
+            if (y < roi_[1] || y > roi_[3]) {
+                std::memset(row, 255, cols_);
+            } else {
+                std::memset(row, 255, roi_[0]);
+                std::memset(row + roi_[2] + 1, 255, cols_ - roi_[2] - 1);
+            }
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Edge list & one dimensional search
+////////////////////////////////////////////////////////////////////////////////
+void SoftwareRasterizer::ComputeEdgePixels(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model,
+                                           std::vector<EdgePixel> &edgelist) {
+    Rasterize(model);
+    ExtractEdgePixels(false, edgelist);
+}
+
+void SoftwareRasterizer::OneDimSearch(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model,
+                                      std::vector<EdgePixel> &edgelist) {
+    CHECK_EQ((int)evidence_->size(), rows_ * cols_) << "evidence not uploaded";
+    CHECK_EQ((int)evidence_dir_->size(), rows_ * cols_) << "evidence direction not uploaded";
+    Rasterize(model);
+    ExtractEdgePixels(true, edgelist);
+}
+
+void SoftwareRasterizer::ExtractEdgePixels(bool with_search, std::vector<EdgePixel> &edgelist) {
+    edgelist.clear();
+    LinearizeDepth(z_near_, z_far_);
+    // invocations cover [1, size-2] intersected with the work groups actually dispatched,
+    // which cover the region of interest if any
+    int x0 = std::max({dirty_[0], roi_[0], 1});
+    int x1 = std::min({dirty_[2], cols_ - 2, has_roi_ ? roi_[2] : (cols_ / kComputeGroupSize) * kComputeGroupSize - 1});
+    int y0 = std::max({dirty_[1], roi_[1], 1});
+    int y1 = std::min({dirty_[3], rows_ - 2, has_roi_ ? roi_[3] : (rows_ / kComputeGroupSize) * kComputeGroupSize - 1});
+    if (y0 > y1 || x0 > x1) return;
+
+    // fixed partition of rows such that the output is in row-major order
+    int num_chunks = (y1 - y0 + kRowsPerChunk) / kRowsPerChunk;
+    std::vector<std::vector<EdgePixel>> chunks(num_chunks);
+    tbb::parallel_for(tbb::blocked_range<int>(0, num_chunks),
+        [&](const tbb::blocked_range<int> &range) {
+            float value[9];
+            for (int c = range.begin(); c < range.end(); ++c) {
+                int end = std::min(y1 + 1, y0 + (c + 1) * kRowsPerChunk);
+                for (int y = y0 + c * kRowsPerChunk; y < end; ++y) {
+                    for (int x = x0; x <= x1; ++x) {
+                        if (linear_depth_[y * cols_ + x] == -1) continue;
+                        Gather3x3(&linear_depth_[0], cols_, x, y, value);
+                        if (EdgeStrength(value) < kEdgeListThresh) continue;
+                        float dy = -(3 * value[0] - 3 * value[2] + 10 * value[3]
+                            - 10 * value[5] + 3 * value[6] - 3 * value[8]);
+                        float dx = -(3 * value[0] + 10 * value[1] + 3 * value[2]
+                            - 3 * value[6] - 10 * value[7] - 3 * value[8]);
+                        float dir = std::atan2(dy, dx);
+                        chunks[c].push_back({float(x), float(y), dir,
+                                             with_search ? OneDimSearchAt(x, y, dir) : value[4]});
+                    }
+                }
+            }
+        });
+    for (const auto &chunk : chunks) {
+        edgelist.insert(edgelist.end(), chunk.begin(), chunk.end());
+    }
+}
+
+bool SoftwareRasterizer::Bresenham(int x1, int y1, int x2, int y2, float dir, int *px, int *py) const {
+    bool steep = false;
+    if (std::abs(x1 - x2) < std::abs(y1 - y2)) {
+        std::swap(x1, y1);
+        std::swap(x2, y2);
+        steep = true;
+    }
+    if (x1 > x2) {
+        std::swap(x1, x2);
+        std::swap(y1, y2);
+    }
+    int dx = x2 - x1;
+    int s = y2 < y1 ? -1 : 1;
+    int dy = s * (y2 - y1);
+    int dx2 = dx + dx;
+    int dy2 = dy + dy;
+    int err = 0;
+    int y = y1;
+    for (int x = x1; x <= x2; ++x) {
+        int u = steep ? y : x;
+        int v = steep ? x : y;
+        if (u >= 0 && u < cols_ && v >= 0 && v < rows_) {
+            int index = v * cols_ + u;
+            if ((*evidence_)[index] >= intensity_thresh_
+                && std::fabs(std::cos(dir - (*evidence_dir_)[index])) >= direction_thresh_) {
+                *px = u;
+                *py = v;
+                return true;
+            }
+        }
+        if (err > dx) {
+            y += s;
+            err -= dx2;
+        }
+        err += dy2;
+    }
+    return false;
+}
+
+float SoftwareRasterizer::OneDimSearchAt(int x, int y, float dir) const {
+    float cos_th = std::cos(dir);
+    float sin_th = std::sin(dir);
+    if (cos_th < 0) {
+        cos_th = -cos_th;
+        sin_th = -sin_th;
+    }
+
+    float l1 = std::min<float>(search_line_length_, (cols_ - 1 - x) / (cos_th + kShaderEps));
+    if (sin_th > 0) {
+        l1 = std::min(l1, (rows_ - 1 - y) / (sin_th + kShaderEps));
+    } else {
+        l1 = std::min(l1, (y - 1) / (-sin_th + kShaderEps));
+    }
+    int mx, my;
+    bool found_match = Bresenham(x, y, int(x + l1 * cos_th), int(y + l1 * sin_th), dir, &mx, &my);
+    float dist = found_match ? std::sqrt(float((mx - x) * (mx - x) + (my - y) * (my - y))) : -1;
+
+    float l2 = search_line_length_;
+    if (found_match) l2 = std::min(l2, dist);
+    l2 = std::min(l2, (x - 1) / (cos_th + kShaderEps));
+    if (sin_th > 0) {
+        l2 = std::min(l2, (y - 1) / (sin_th + kShaderEps));
+    } else {
+        l2 = std::min(l2, (rows_ - 1 - y) / (-sin_th + kShaderEps));
+    }
+    if (Bresenham(x, y, int(x - l2 * cos_th), int(y - l2 * sin_th), dir, &mx, &my)) {
+        return std::sqrt(float((mx - x) * (mx - x) + (my - y) * (my - y)));
+    }
+    return dist;
+}
+
+}   // namespace feh
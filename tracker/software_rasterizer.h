@@ -0,0 +1,130 @@
+//
+// Headless CPU rasterizer mirroring the OpenGL path of feh::Renderer.
+//
+#pragma once
+// stl
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+// 3rd party
+#include "Eigen/Dense"
+
+// own
+#include "oned_search.h"
+
+namespace feh {
+
+/// \brief: Tile-based, SIMD (SSE) software rasterizer which reproduces the
+/// depth, mask, edge, edge list and one dimensional search passes of the GL
+/// renderer without any window or GL context.
+/// Conventions (projection, viewport, pixel centers, 24-bit depth, GL_LESS,
+/// top-left fill rule) follow the GL path such that outputs agree
+/// pixel-for-pixel up to floating point round-off.
+/// NOTE: An instance is NOT thread-safe: it owns its depth buffer and scratch
+/// space. Use one instance per thread.
+class SoftwareRasterizer {
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    SoftwareRasterizer(int rows, int cols);
+
+    /// \brief: Set projection matrix (column major, OpenGL convention) and
+    /// near/far planes used to linearize depth.
+    void SetProjection(float z_near, float z_far, const float *projection);
+    /// \brief: Set view matrix (column major, OpenGL convention).
+    void SetView(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &view);
+    /// \brief: Set object mesh in canonical frame.
+    void SetMesh(const float *vertices, int num_vertices, const int *faces, int num_faces);
+    /// \brief: Restrict rendering and search to the region of interest, clamped to the image.
+    /// Outputs outside of the region are background. Mirrors Renderer::SetROI.
+    void SetROI(int x, int y, int width, int height);
+    void ClearROI();
+    /// \brief: Set parameters of one dimensional search, negative values are ignored.
+    void SetOneDimSearch(int search_line_length, int intensity_thresh, float direction_thresh);
+    void UploadEvidence(const uint8_t *data_ptr);
+    void UploadEvidenceDirection(const float *data_ptr);
+    /// \brief: Use the evidence buffers of another rasterizer of the same size, such that
+    /// evidence uploaded to any of them is visible to all of them.
+    void ShareEvidence(const SoftwareRasterizer &other);
+
+    /// \brief: Render depth buffer (window z in [0, 1], background = 1).
+    void RenderDepth(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model, float *out);
+    /// \brief: Render binary mask, 0 for object and 255 for background.
+    void RenderMask(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model, uint8_t *out);
+    /// \brief: Render edge map, port of shaders/edge_detection.frag.
+    void RenderEdge(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model, uint8_t *out);
+    /// \brief: Render all triangle edges, 0 for edge and 255 for background.
+    void RenderWireframe(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model, uint8_t *out);
+    /// \brief: Edge pixels with search direction, port of shaders/edgelist.comp.
+    void ComputeEdgePixels(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model,
+                           std::vector<EdgePixel> &edgelist);
+    /// \brief: Edge pixels with matching distance, port of shaders/oned.comp.
+    void OneDimSearch(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model,
+                      std::vector<EdgePixel> &edgelist);
+
+    int rows() const { return rows_; }
+    int cols() const { return cols_; }
+
+private:
+    /// \brief: Rasterization of the current mesh into the depth buffer.
+    void Rasterize(const Eigen::Matrix<float, 4, 4, Eigen::ColMajor> &model);
+    /// \brief: Reset the region touched by last rasterization.
+    void ClearDepth();
+    /// \brief: Clip the given face against the view frustum.
+    /// \param poly: Output polygon in window coordinates (x, y, z) of at most kMaxClipVertices vertices.
+    /// \return: Number of vertices of the clipped polygon.
+    int ClipFace(int face, float (*poly)[4]) const;
+    /// \brief: Fill linear_depth_ over the dirty region: linearized depth or -1 for background.
+    void LinearizeDepth(float z_near, float z_far);
+    /// \brief: Shared implementation of edge list extraction.
+    void ExtractEdgePixels(bool with_search, std::vector<EdgePixel> &edgelist);
+    /// \brief: Bresenham line search on evidence, port of bresenham() in oned.comp.
+    bool Bresenham(int x1, int y1, int x2, int y2, float dir, int *px, int *py) const;
+    /// \brief: Bidirectional search, port of oned_search() in oned.comp.
+    float OneDimSearchAt(int x, int y, float dir) const;
+
+    struct Triangle;
+    /// \brief: Setup edge functions, depth plane and bounding box of a window space triangle.
+    /// \return: false if the triangle is degenerate or covers no pixel center.
+    bool SetupTriangle(const float *v0, const float *v1, const float *v2, Triangle *tri) const;
+
+    struct Triangle {
+        float e0[3], a[3], b[3];    // edge functions at bbox origin and their gradients
+        bool top_left[3];
+        float z0, za, zb;           // depth plane
+        int xmin, ymin, xmax, ymax; // inclusive bounding box in pixels
+    };
+
+private:
+    int rows_, cols_;
+    int stride_;    // padded row length of the depth buffer
+    int tiles_x_, tiles_y_;
+    float z_near_, z_far_;
+    Eigen::Matrix<float, 4, 4, Eigen::ColMajor> projection_, view_;
+
+    // mesh
+    Eigen::Matrix<float, 4, Eigen::Dynamic, Eigen::ColMajor> vertices_;
+    Eigen::Matrix<float, 4, Eigen::Dynamic, Eigen::ColMajor> clip_;   // vertices in clip space
+    std::vector<int> faces_;
+
+    // buffers
+    std::vector<float> depth_;
+    std::vector<float> linear_depth_;
+    int dirty_[4];  // xmin, ymin, xmax, ymax of region written by last rasterization
+    int linear_dirty_[4];   // same for linear_depth_
+    bool has_roi_;
+    int roi_[4];        // xmin, ymin, xmax, ymax (inclusive) of region of interest
+    int scissor_[4];    // region of interest with margin, where triangles are rasterized
+    std::vector<std::vector<Triangle>> chunk_triangles_;
+    std::vector<Triangle> triangles_;
+    std::vector<std::vector<int>> bins_;
+
+    // one dimensional search, evidence might be shared with other rasterizers
+    std::shared_ptr<std::vector<uint8_t>> evidence_;
+    std::shared_ptr<std::vector<float>> evidence_dir_;
+    int search_line_length_;
+    int intensity_thresh_;
+    float direction_thresh_;
+};
+
+}   // namespace feh
@@ -4,6 +4,9 @@
 #include <tracker.h>
 #include "tracker.h"
 
+// stl
+#include <mutex>
+
 // 3rd party
 #include "opencv2/imgproc/imgproc.hpp"
 #include "json/json.h"
@@ -12,6 +15,7 @@
 #include "tracker_utils.h"
 #include "parallel_kernels.h"
 #include "dataloaders.h"
+#include "mesh_simplification.h"
 
 
 namespace feh {
@@ -49,8 +53,15 @@ Tracker::Tracker() :
     saved_status_(TrackerStatus::INVALID),
     ts_(0),
     use_partial_mesh_(false),
-    port_(nullptr),
-    generator_(nullptr),
+    use_mesh_lod_(false),
+    use_geometric_contour_(false),
+    CNN_client_(nullptr),
+    likelihood_cache_(nullptr),
+    likelihood_cache_quantization_(0.5),
+    use_geometric_gating_(false),
+    gating_min_visible_ratio_(0),
+    gating_min_iou_(0),
+    gated_poses_(0),
     timer_("tracker"),
     class_name_(""),
     scale_level_(0),
@@ -59,8 +70,24 @@ Tracker::Tracker() :
     prediction_kernel_size_(0),
     use_CNN_(false),
     use_MC_move_(false),
+    oned_reduce_on_device_(true),
+    oned_use_roi_(false),
+    oned_batch_size_(1),
     CNN_prob_thresh_(0.0),
+    CNN_deadline_ms_(0),
+    CNN_early_hypotheses_(false),
+    CNN_timeouts_(0),
+    CNN_box_quantization_(1),
+    CNN_batched_(false),
+    CNN_resampling_pending_(false),
     max_num_particles_(500),
+    resampling_scheme_(ResamplingScheme::SYSTEMATIC),
+    resampling_ess_threshold_(1.0),
+    use_kld_sampling_(false),
+    kld_min_num_particles_(100),
+    kld_max_num_particles_(500),
+    kld_epsilon_(0.05),
+    kld_upper_quantile_(2.33),
     total_visible_edgepixels_(0),
     visible_ratio_(1.0f),
     visible_tl_(10000, 10000),
@@ -111,12 +138,31 @@ void Tracker::Initialize(const std::string &config_file,
     LOG(INFO) << "max num of particles=" << max_num_particles_;
     LOG(INFO) << "initial std=" << initial_std_.transpose();
     LOG(INFO) << "proposal std=" << proposal_std_.transpose();
+    resampling_scheme_        = ResamplingSchemeFromString(filter_cfg.get("resampling_scheme", "systematic").asString());
+    resampling_ess_threshold_ = filter_cfg.get("resampling_ess_threshold", 1.0).asDouble();
+
+    auto kld_cfg = filter_cfg["kld_sampling"];
+    use_kld_sampling_      = kld_cfg.get("enabled", false).asBool();
+    if (use_kld_sampling_) {
+        kld_min_num_particles_ = kld_cfg["min_num_particles"].asInt();
+        kld_max_num_particles_ = kld_cfg["max_num_particles"].asInt();
+        kld_epsilon_           = kld_cfg["epsilon"].asDouble();
+        kld_upper_quantile_    = kld_cfg["upper_quantile"].asDouble();
+        kld_bin_size_          = GetVectorFromJson<float, 4>(kld_cfg, "bin_size");
+        CHECK_GT(kld_min_num_particles_, 0);
+        CHECK_LE(kld_min_num_particles_, kld_max_num_particles_);
+        CHECK(kld_bin_size_.minCoeff() > 0) << "KLD-sampling bin size must be positive";
+        LOG(INFO) << "KLD-sampling with " << kld_min_num_particles_ << "~" << kld_max_num_particles_ << " particles";
+    }
 
     // setup likelihood parameters
     use_partial_mesh_          = filter_cfg["use_partial_mesh"].asBool();
     use_CNN_                   = filter_cfg["use_CNN"].asBool();
     use_MC_move_               = filter_cfg["use_MC_move"].asBool();
     CNN_prob_thresh_           = filter_cfg["CNN_probability_threshold"].asDouble();
+    CNN_deadline_ms_           = filter_cfg.get("CNN_deadline_ms", 0).asInt();
+    CNN_early_hypotheses_      = filter_cfg.get("CNN_early_hypotheses", false).asBool();
+    CNN_box_quantization_      = std::max(1, filter_cfg.get("CNN_box_quantization", 1).asInt());
     evidence_kernel_size_      = filter_cfg["evidence_blur_kernel_size"].asInt();
     prediction_kernel_size_    = filter_cfg["prediction_blur_kernel_size"].asInt();
     scale_level_               = filter_cfg["scale_level"].asInt();
@@ -142,6 +188,10 @@ void Tracker::Initialize(const std::string &config_file,
     oned_search_.intensity_threshold_          = uint8_t(oned_cfg["intensity_thresh"].asInt() & 0xff);
     oned_search_.direction_consistency_thresh_ = oned_cfg["direction_thresh"].asDouble();
     oned_search_.parallel_                     = oned_cfg["parallel"].asBool();
+    oned_reduce_on_device_                     = oned_cfg.get("reduce_on_device", true).asBool();
+    oned_use_roi_                              = oned_cfg.get("use_roi", false).asBool();
+    oned_batch_size_                           = std::min(oned_cfg.get("batch_size", 1).asInt(),
+                                                          int(Renderer::kMaxBatchSize));
 
 
     // camera parameters
@@ -169,6 +219,7 @@ void Tracker::Initialize(const std::string &config_file,
             std::string mesh_file = config_["CAD_database_root"].asString() + "/" + cad_list[i] + ".obj";
             std::cout << "loading mesh @ " << mesh_file << "\n";
             std::tie(shapes_[i].vertices_, shapes_[i].faces_) = LoadMesh(mesh_file);
+            shapes_[i].radius_ = shapes_[i].vertices_.rowwise().norm().maxCoeff();
         } catch (std::exception &e) {
             std::cout << TermColor::red << e.what() << TermColor::endl;
         }
@@ -191,24 +242,82 @@ void Tracker::Initialize(const std::string &config_file,
     z_near = cam_cfg["z_near"].asDouble();
     z_far = cam_cfg["z_far"].asDouble();
 
+    // level of detail of inference meshes
+    use_mesh_lod_ = config_["mesh_lod"].get("enabled", false).asBool();
+    if (use_mesh_lod_) BuildMeshLOD(config_["mesh_lod"], z_near, z_far);
+    for (int sid : shape_ids_) {
+        shapes_.at(sid).control_points_ = GenerateControlPoints(shapes_.at(sid).InferenceVertices(0));
+    }
+    use_geometric_contour_ = config_.get("geometric_contour", false).asBool();
+
     // scaling factor of the target level relative to input image
     scale_factor_ = powf(0.5, scale_level_-1);
-    // setup a bank of renderers
+    // setup a bank of renderers: one group per level sharing context & evidence, one member per shape
+    RenderBackend render_backend = RenderBackendFromString(config_.get("render_backend", "opengl").asString());
+    render_groups_.clear();
+    // software render engines of the parallel likelihood evaluation
+    likelihood_workers_.clear();
+    auto parallel_cfg = config_["parallel_likelihood"];
+    if (parallel_cfg.get("enabled", false).asBool()) {
+        int num_workers = parallel_cfg.get("num_workers", 0).asInt();
+        if (num_workers <= 0) num_workers = tbb::this_task_arena::max_concurrency();
+        likelihood_workers_.resize(num_workers);
+        likelihood_arena_ = std::make_shared<tbb::task_arena>(num_workers);
+        idle_workers_.clear();
+        idle_workers_.set_capacity(num_workers);
+        for (int w = 0; w < num_workers; ++w) idle_workers_.push(w);
+        LOG(INFO) << num_workers << " likelihood workers";
+        if (render_backend != RenderBackend::SOFTWARE) {
+            // the GPU batch & reduce paths of the configured backend are bypassed
+            LOG(WARNING) << TermColor::yellow << "parallel likelihood scores particles with the software backend, "
+                         << "render_backend only applies outside likelihood evaluation" << TermColor::endl;
+        }
+    }
+    if (oned_use_roi_ && oned_batch_size_ > 1
+        && render_backend == RenderBackend::OPENGL && likelihood_workers_.empty()) {
+        LOG(WARNING) << TermColor::yellow << "batched search on OpenGL ignores oned_search.use_roi, "
+                     << "set oned_search.batch_size to 1 to honor it" << TermColor::endl;
+    }
+    auto cache_cfg = config_["likelihood_cache"];
+    if (cache_cfg.get("enabled", false).asBool()) {
+        likelihood_cache_ = std::make_shared<LikelihoodCache>();
+        likelihood_cache_quantization_ = cache_cfg.get("quantization", 0.5).asDouble();
+        CHECK_GT(likelihood_cache_quantization_, 0);
+    }
+    auto gating_cfg = config_["geometric_gating"];
+    use_geometric_gating_ = gating_cfg.get("enabled", false).asBool();
+    gating_min_visible_ratio_ = gating_cfg.get("min_visible_ratio", 0.0).asDouble();
+    gating_min_iou_ = gating_cfg.get("min_iou", 0.0).asDouble();
     for (int i = 0; i < scale_level_; ++i) {
         int search_line_len = oned_cfg["search_line_length"].asInt();
+        RendererGroupPtr group = std::make_shared<RendererGroup>(rows_[i], cols_[i], render_backend);
+        group->SetCamera(z_near, z_far, fx_[i], fy_[i], cx_[i], cy_[i]);
+        group->SetOneDimSearch(search_line_len,
+                               oned_cfg["intensity_thresh"].asInt(),
+                               oned_cfg["direction_thresh"].asDouble());
         for (int sid : shape_ids_) {
-            RendererPtr new_renderer = std::make_shared<Renderer>(rows_[i], cols_[i]);
-            new_renderer->SetCamera(z_near, z_far, fx_[i], fy_[i], cx_[i], cy_[i]);
-            new_renderer->SetOneDimSearch(search_line_len,
+            const Shape &shape = shapes_.at(sid);
+            RendererPtr new_renderer = group->AddMesh(shape.InferenceVertices(i), shape.InferenceFaces(i));
+            // render engine setup here
+            shapes_.at(sid).render_engines_.push_back(new_renderer);
+            if (use_geometric_contour_) {
+                auto extractor = std::make_shared<SilhouetteExtractor>(shape.InferenceVertices(i), shape.InferenceFaces(i));
+                extractor->SetCamera(rows_[i], cols_[i], z_near, fx_[i], fy_[i], cx_[i], cy_[i]);
+                shapes_.at(sid).silhouette_extractors_.push_back(extractor);
+            }
+        }
+        render_groups_.push_back(group);
+        for (auto &worker : likelihood_workers_) {
+            RendererGroupPtr worker_group = std::make_shared<RendererGroup>(rows_[i], cols_[i], RenderBackend::SOFTWARE);
+            worker_group->SetCamera(z_near, z_far, fx_[i], fy_[i], cx_[i], cy_[i]);
+            worker_group->SetOneDimSearch(search_line_len,
                                           oned_cfg["intensity_thresh"].asInt(),
                                           oned_cfg["direction_thresh"].asDouble());
-            if (shapes_.at(sid).part_vertices_.size() > 0) {
-                new_renderer->SetMesh(shapes_.at(sid).part_vertices_, shapes_.at(sid).part_faces_);
-            } else {
-                new_renderer->SetMesh(shapes_.at(sid).vertices_, shapes_.at(sid).faces_);
+            for (int sid : shape_ids_) {
+                const Shape &shape = shapes_.at(sid);
+                worker.render_engines_[sid].push_back(worker_group->AddMesh(shape.InferenceVertices(i), shape.InferenceFaces(i)));
             }
-            // render engine setup here
-            shapes_.at(sid).render_engines_.push_back(new_renderer);
+            worker.render_groups_.push_back(worker_group);
         }
         // DO NOT TOUCH!!! THE FOLLOWING SETUP PERFORMS REASONABLY WELL
         search_line_len /= 1.414;
@@ -226,23 +335,21 @@ void Tracker::Initialize(const std::string &config_file,
     visible_mask_.setTo(1);
 
     // setup random number generator
-    if (config_["fixed_seed"].asBool()) {
-        generator_ = std::make_shared<std::knuth_b>(0);
-    } else {
-        generator_ = std::make_shared<std::knuth_b>(time(NULL));
-    }
-    particles_.Initialize(generator_);
+    uint32_t seed = config_["fixed_seed"].asBool() ? 0 : time(NULL);
+    rng_key_ = (uint64_t(id_) << 32) | seed;
+    rng_update_ = 0;
+    // the engine of the particles only backs their legacy resampling calls, drawn from the same key
+    particle_buffers_.Initialize(std::make_shared<std::knuth_b>(Philox(rng_key_, 0, 0, kParticleSeedStream)()));
 
 
     // set flag
     status_ = TrackerStatus::VALID;
 
-    // setup port for inter process communication
-    if (use_CNN_) {
-        handler_ = std::make_shared<BBoxLikelihoodHandler>();
-        port_    = std::make_shared<lcm::LCM>();
-        port_->subscribe("likelihood", &BBoxLikelihoodHandler::Handle, handler_.get());
-        if (port_->good()) {
+    // setup port for inter process communication, the scene sends hypotheses of all the trackers at once if batched
+    CNN_batched_ = config_["CNN_batching"].get("enabled", false).asBool();
+    if (use_CNN_ && !CNN_batched_) {
+        CNN_client_ = std::make_shared<BBoxLikelihoodClient>(id());
+        if (CNN_client_->good()) {
             LOG(INFO) << TermColor::green << "LCM port ready to go" << TermColor::end;
         } else {
             LOG(FATAL) << TermColor::red << "failed to setup LCM port" << TermColor::end;
@@ -330,7 +437,9 @@ int Tracker::Update(const cv::Mat &in_evidence,
                     use_CNN_ = true;
                     use_MC_move_ = false;
                     azi_flip_rate_ = 0.01;
-                    particles_.Subsample(config_["filter"]["tracking_num_particles"].asInt());
+                    // the particle set changes, scores of a pending CNN batch would not match
+                    if (CNN_resampling_pending_) ApplyCNNLikelihood(std::chrono::steady_clock::now());
+                    particles().Subsample(config_["filter"]["tracking_num_particles"].asInt());
                     timer_.Reset();
                     initialization_counter_ = 0;
                     no_observation_counter_ = 0;
@@ -384,7 +493,9 @@ int Tracker::Update(const cv::Mat &in_evidence,
                         use_CNN_ = true;
 //                    azi_flip_rate_     = filter_cfg["azimuth_flip_rate"].asDouble();
                         // FIXME: PROPER RE-INITIALIZATION
-                        particles_.resize(max_num_particles_ * shape_ids_.size(), {mean_, best_shape_match_, 0.0f});
+                        if (CNN_resampling_pending_) ApplyCNNLikelihood(std::chrono::steady_clock::now());
+                        particles().resize(max_num_particles_ * shape_ids_.size(), {mean_, best_shape_match_, 0.0f});
+                        particles().SetLogWeights(0);
 
                         timer_.Reset();
                         initialization_counter_ = 0;
@@ -473,9 +584,9 @@ int Tracker::Preprocess(const cv::Mat &in_evidence,
     // set current camera pose
     gwc_ = gwc;
     grc_ = gwr_.inv() * gwc;
-    for (auto sid : shape_ids_) {
-        for (auto r: shapes_.at(sid).render_engines_) {
-            r->SetCamera(grc_.inv().matrix());
+    for (int lvl = 0; lvl < render_groups_.size(); ++lvl) {
+        for (auto group : RenderGroups(lvl)) {
+            group->SetCamera(grc_.inv().matrix());
         }
     }
 
@@ -484,9 +595,7 @@ int Tracker::Preprocess(const cv::Mat &in_evidence,
 
     cv::Rect rect = visible_region();
     if (rect.area() == 0) {
-        std::vector<EdgePixel> edgelist;
-        renderers_[0]->ComputeEdgePixels(MatForRender(mean_), edgelist);
-        rect = RectEnclosedByContour(edgelist, rows_[0], cols_[0]);
+        rect = ContourRect(0);
     }
 
     timer_.Tick("compute iou");
@@ -558,13 +667,16 @@ int Tracker::Preprocess(const cv::Mat &in_evidence,
         cv::pyrDown(evidence_[i-1], evidence_[i], sz);
     }
     ComputeEdgeNormalAllLevel();
-    for (auto sid : shape_ids_) {
-        std::vector<RendererPtr> render_engines{shapes_.at(sid).render_engines_};
-        for (int lvl = 0; lvl < render_engines.size(); ++lvl) {
-            render_engines[lvl]->UploadEvidence(evidence_[lvl].data);
-            render_engines[lvl]->UploadEvidenceDirection((float*)evidence_dir_[lvl].data);
+    // evidence buffers are shared by all the shapes of a level
+    for (int lvl = 0; lvl < render_groups_.size(); ++lvl) {
+        for (auto group : RenderGroups(lvl)) {
+            group->UploadEvidence(evidence_[lvl].data);
+            group->UploadEvidenceDirection((float*)evidence_dir_[lvl].data);
         }
     }
+    // cached scores are only valid for the evidence they are computed on
+    ResetLikelihoodCache();
+    gated_poses_ = 0;
     ////////////////////////////////////////
     timer_.Tock("prepare evidence");
 
@@ -618,9 +730,7 @@ bool Tracker::IsOutOfView() {
         return true;
     }
 
-    std::vector<EdgePixel> edgelist;
-    renderer->ComputeEdgePixels(MatForRender(mean_), edgelist);
-    cv::Rect rect = RectEnclosedByContour(edgelist, rows_[level], cols_[level]);
+    cv::Rect rect = ContourRect(level);
 
     if (rect.tl().x > cols_[level] * 0.90f
         || rect.tl().y > rows_[level] * 0.90
@@ -637,9 +747,20 @@ bool Tracker::IsOutOfView() {
 
 
 cv::Rect Tracker::RectangleExplained(int level) {
-    auto renderer = renderers_[level];
-    std::vector<EdgePixel> edgelist;
-    renderer->ComputeEdgePixels(MatForRender(mean_), edgelist);
+    return ContourRect(level);
+}
+
+cv::Rect Tracker::ContourRect(int level) {
+    const auto &extractors = shapes_.at(best_shape_match_).silhouette_extractors_;
+    if (use_geometric_contour_ && level < extractors.size()) {
+        // no depth rendering and readback, only the contour edges of the mesh are projected
+        Eigen::Matrix<float, 4, 4, Eigen::ColMajor> pose = grc_.inv().matrix() * MatForRender(mean_);
+        std::vector<EdgePixel> edgelist;
+        extractors[level]->ComputeEdgePixels(pose, edgelist);
+        return RectEnclosedByContour(edgelist, rows_[level], cols_[level]);
+    }
+    std::vector<PackedEdgePixel> edgelist;
+    renderers_[level]->ComputeEdgePixels(MatForRender(mean_), edgelist);
     return RectEnclosedByContour(edgelist, rows_[level], cols_[level]);
 }
 
@@ -766,11 +887,11 @@ void Tracker::BuildFilterView() {
 }
 
 void Tracker::WriteOutParticles(const std::string &filename) const {
-    particles_.WriteToFile(filename);
+    particles().WriteToFile(filename);
 }
 
 void Tracker::LogDebugInfo() {
-    dbg_file_ << mean_.transpose() << "\n"; // << particles_.Covariance()
+    dbg_file_ << mean_.transpose() << "\n"; // << particles().Covariance()
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -866,6 +987,27 @@ cv::Mat Tracker::RenderDepthAt(const SE3 &object_pose,
     return out;
 }
 
+RenderReadbackPtr Tracker::RenderAsync(cv::Mat &out, int level) {
+    auto renderer = renderers_[level];
+    CHECK(renderer != nullptr);
+
+    SE3 pose(MatForRender(mean_));
+    out.create(rows_[level], cols_[level], CV_8UC1);
+    return renderer->RenderEdgeAsync(pose.matrix(), out.data);
+}
+
+RenderReadbackPtr Tracker::RenderDepthAsync(cv::Mat &out, int level) {
+    auto renderer = renderers_[level];
+    CHECK(renderer != nullptr);
+
+    SE3 pose(MatForRender(mean_));
+    out.create(rows_[level], cols_[level], CV_32FC1);
+    auto readback = renderer->RenderDepthAsync(pose.matrix(), (float*) out.data);
+    // shares data with out
+    cv::Mat depth(out);
+    readback->Then([depth]() mutable { PrettyDepth(depth); });
+    return readback;
+}
 
 Vec2f Tracker::Project(const Vec3f &vertex,
                        int level) const {
@@ -878,9 +1020,9 @@ Vec2f Tracker::Project(const Vec3f &vertex,
 void Tracker::GetProjection(std::vector<Vec2f> &projections,
                             int level) const {
     projections.clear();
-    for (int i = 0; i < particles_.size(); ++i) {
-        if (particles_[i].shape_id() == best_shape_match_) {
-            Vec3f v(particles_[i].v().head<3>());
+    for (int i = 0; i < particles().size(); ++i) {
+        if (particles()[i].shape_id() == best_shape_match_) {
+            Vec3f v(particles()[i].v().head<3>());
             v(2) = std::exp(v(2));
             v.head<2>() *= v(2);
             v = gwc_.inv() * gwr_ * v;
@@ -898,17 +1040,17 @@ Vec2f Tracker::ProjectMean(int level) const {
 }
 
 void Tracker::SwitchMeshForInference() {
-    if (use_partial_mesh_) {
+    if (use_partial_mesh_ || use_mesh_lod_) {
         for (auto &kv : shapes_) {
             Shape &s = kv.second;
             for (int i = 0; i < s.render_engines_.size(); ++i)
-                if (s.part_vertices_.size() > 0) s.render_engines_[i]->SetMesh(s.part_vertices_, s.part_faces_);
+                if (s.InferenceVertices(i).size() > 0) s.render_engines_[i]->SetMesh(s.InferenceVertices(i), s.InferenceFaces(i));
         }
     }   // no need to switch otherwise
 }
 
 void Tracker::SwitchMeshForVisualization() {
-    if (use_partial_mesh_) {
+    if (use_partial_mesh_ || use_mesh_lod_) {
         for (auto &kv : shapes_) {
             Shape &s = kv.second;
             for (int i = 0; i < s.render_engines_.size(); ++i)
@@ -917,6 +1059,62 @@ void Tracker::SwitchMeshForVisualization() {
     } // no need to switch otherwise
 }
 
+void Tracker::BuildMeshLOD(const Json::Value &lod_cfg, float z_near, float z_far) {
+    // simplified meshes only depend on the shape, the budget and the camera the silhouette error
+    // is checked with, share them across trackers
+    static std::mutex cache_mutex;
+    static std::unordered_map<std::string, std::pair<MatXf, MatXi>> cache;
+
+    std::vector<int> budgets;
+    for (const auto &value : lod_cfg["face_budget"]) budgets.push_back(value.asInt());
+    CHECK(!budgets.empty()) << "mesh_lod.face_budget is empty";
+    float max_error = lod_cfg.get("max_silhouette_error", 0.5).asDouble();
+    float depth = lod_cfg.get("reference_depth", 2.5).asDouble();
+
+    for (auto &kv : shapes_) {
+        Shape &s = kv.second;
+        s.lod_vertices_.clear();
+        s.lod_faces_.clear();
+        const MatXf &V = s.part_vertices_.size() > 0 ? s.part_vertices_ : s.vertices_;
+        const MatXi &F = s.part_vertices_.size() > 0 ? s.part_faces_ : s.faces_;
+        if (V.size() == 0) continue;
+        for (int i = 0; i < scale_level_; ++i) {
+            int budget = budgets[std::min<int>(i, budgets.size() - 1)];
+            std::string key = absl::StrFormat("%s#%d#%d#%dx%d#%f,%f,%f,%f#%f,%f#%f#%f",
+                                              s.name_, int(s.part_vertices_.size() > 0), budget,
+                                              rows_[i], cols_[i], fx_[i], fy_[i], cx_[i], cy_[i],
+                                              z_near, z_far, max_error, depth);
+            {
+                std::lock_guard<std::mutex> lock(cache_mutex);
+                auto it = cache.find(key);
+                if (it != cache.end()) {
+                    s.lod_vertices_.push_back(it->second.first);
+                    s.lod_faces_.push_back(it->second.second);
+                    continue;
+                }
+            }
+            // simplified without holding the lock, such that trackers initialize concurrently
+            float intrinsics[] = {fx_[i], fy_[i], cx_[i], cy_[i]};
+            MatXf V_lod;
+            MatXi F_lod;
+            for (;; budget *= 2) {
+                SimplifyMesh(V, F, budget, V_lod, F_lod);
+                if (F_lod.rows() == F.rows()) break;
+                float error = SilhouetteError(V, F, V_lod, F_lod, rows_[i], cols_[i], intrinsics, z_near, z_far, depth);
+                if (error <= max_error) break;
+                LOG(INFO) << s.name_ << "@level " << i << ": silhouette error " << error
+                          << " with " << F_lod.rows() << " faces, increasing budget";
+            }
+            LOG(INFO) << s.name_ << "@level " << i << ": " << F_lod.rows() << "/" << F.rows() << " faces";
+            std::lock_guard<std::mutex> lock(cache_mutex);
+            // the result of a tracker which simplified the same mesh meanwhile is kept
+            auto it = cache.insert({key, std::make_pair(V_lod, F_lod)}).first;
+            s.lod_vertices_.push_back(it->second.first);
+            s.lod_faces_.push_back(it->second.second);
+        }
+    }
+}
+
 void Tracker::ComputeQualityMeasure() {
     std::vector<EdgePixel> edgelist;
     renderers_.front()->OneDimSearch(MatForRender(), edgelist);
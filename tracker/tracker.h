@@ -9,23 +9,31 @@
 #include <vector>
 #include <unordered_map>
 #include <memory>
+#include <functional>
+#include <chrono>
+#include <future>
 #include "math.h"
 
 // sophus
 #include "json/json.h"
 #include "opencv2/highgui/highgui.hpp"
 
-// lcm
-#include "lcm/lcm-cpp.hpp"
+// tbb
+#include "tbb/task_arena.h"
+#include "tbb/concurrent_queue.h"
 
 // own
 #include "renderer.h"
+#include "silhouette_extractor.h"
+#include "likelihood_cache.h"
 #include "vlslam.pb.h"
 #include "oned_search.h"
 #include "distance_transform.h"
 #include "particle.h"
-#include "lcm_msg_handlers.h"
+#include "particle_array.h"
+#include "bbox_likelihood_client.h"
 #include "se3.h"
+#include "philox.h"
 
 namespace feh {
 namespace tracker {
@@ -48,10 +56,35 @@ struct Shape {
     // we only use the upper part of the chair for inference.
     MatXf vertices_, part_vertices_;
     MatXi faces_, part_faces_;
+    float radius_ = 0;  // radius of the bounding sphere centered at the origin of the object frame
+    // simplified inference mesh per pyramid level, empty if level of detail is off
+    std::vector<MatXf> lod_vertices_;
+    std::vector<MatXi> lod_faces_;
     std::vector<RendererPtr> render_engines_;
+    // contour extraction from the inference mesh per pyramid level, empty if geometric contours are off
+    std::vector<SilhouetteExtractorPtr> silhouette_extractors_;
+    // 8 corners and the centroid of the bounding box of the inference mesh, see GenerateControlPoints
+    std::vector<Vec3f> control_points_;
+
+    /// \brief: Mesh used for inference at the given level.
+    const MatXf &InferenceVertices(int level) const {
+        if (level < lod_vertices_.size()) return lod_vertices_[level];
+        return part_vertices_.size() > 0 ? part_vertices_ : vertices_;
+    }
+    const MatXi &InferenceFaces(int level) const {
+        if (level < lod_faces_.size()) return lod_faces_[level];
+        return part_vertices_.size() > 0 ? part_faces_ : faces_;
+    }
 };
 using ShapeId = int;
 
+/// \brief: Render engines owned by one worker of the parallel likelihood evaluation.
+struct LikelihoodWorker {
+    // one group per level, members are the render engines of the shapes
+    std::vector<RendererGroupPtr> render_groups_;
+    std::unordered_map<ShapeId, std::vector<RendererPtr>> render_engines_;
+};
+
 class Tracker {
 public:
     friend class Scene;
@@ -89,6 +122,13 @@ public:
                const SO3 &Rg,
                const cv::Mat &img,
                std::string imagepath="");
+    /// \brief: Queue the bounding box hypotheses of the finest level of the last update on the
+    /// scene-wide CNN batch. Nothing is queued if no update waits for CNN scores.
+    void RequestCNNLikelihood(BBoxLikelihoodBatcher &batcher);
+    /// \brief: Weight the particles by the CNN scores of the queued hypotheses, then finish the
+    /// resampling of the finest level deferred by the last update and refresh the estimate.
+    /// Edge-only weights are kept if the scores do not arrive before the deadline.
+    void ApplyCNNLikelihood(std::chrono::steady_clock::time_point deadline);
     /// \brief: Given hypothesis (v) and pixelwise posterior map (P), compute
     /// log likelihood.
     float ComputeAppearanceLikelihood(const Vec4f &v, const std::vector<cv::Mat> &P);
@@ -123,6 +163,45 @@ public:
     float LogLikelihoodFromEdgelist(const std::vector<EdgePixel> &edgelist,
                                     std::array<float, 2> *info=nullptr,
                                     float match_ratio_order=1);
+    /// \brief: Compute log-likelihood from match ratio & average match distance,
+    /// e.g., reduced on the device by Renderer::OneDimSearch.
+    float LogLikelihoodFromScore(float match_ratio,
+                                 float average_match_distance,
+                                 float match_ratio_order=1);
+    /// \brief: One dimensional search of the given pose, reduced on the device if
+    /// oned_reduce_on_device_ is set, otherwise on the host.
+    /// \param score_and_corner: [match_ratio, average_match_distance, tl_x, tl_y, br_x, br_y]
+    void OneDimSearchScore(RendererPtr renderer,
+                           const Mat4f &model,
+                           std::array<float, 6> &score_and_corner);
+    /// \brief: Same as above for many poses, searched in batches of oned_batch_size_.
+    void OneDimSearchScores(RendererPtr renderer,
+                            const Mat4fColMajorList &models,
+                            std::vector<std::array<float, 6>> &score_and_corners);
+    /// \brief: Scores of particle states at the given level. Cached scores are looked up first,
+    /// the remaining poses are bucketed by shape and each bucket is searched in batches,
+    /// such that a render engine is bound once per batch, then results are scattered back.
+    /// \param sids, states: shape id and state (x, y, log-depth, azimuth) of each pose.
+    void OneDimSearchScores(int level,
+                            const std::vector<ShapeId> &sids,
+                            const std::vector<Vec4f> &states,
+                            std::vector<std::array<float, 6>> &score_and_corners);
+    /// \brief: Reject a pose without rendering if the projection of the bounding box of the shape
+    /// is mostly outside the image or does not overlap the matched detection.
+    /// \param score_and_corner: analytic score of a rejected pose, zero match ratio and the
+    /// projected bounding box clipped to the image of the level.
+    /// \return: true if the pose is rejected.
+    bool GeometricGate(ShapeId sid, int level, const Vec4f &state,
+                       std::array<float, 6> &score_and_corner) const;
+    /// \brief: Bounding box of the projected corners of the 3D bounding box of the shape in the input image.
+    /// \return: number of corners behind the near plane, the box is only valid if zero.
+    int ProjectBoundingBox(ShapeId sid, const Vec4f &state, cv::Rect &box) const;
+    /// \brief: Hypothesis box of a pose sent to the CNN before rendering, the projected bounding box
+    /// clipped to the image, or the whole image if the box crosses the near plane.
+    cv::Rect HypothesisBox(ShapeId sid, const Vec4f &state) const;
+    /// \brief: Predict the region covered by the object from the particle cloud, plus margin of the search line.
+    /// The whole image if any particle is too close to the camera.
+    cv::Rect PredictRegion(int level) const;
 //    /// \brief: Update visibility properties, also dependent on other objects in the scene.
 //    /// \param visible_ratio: Ratio of visible area over total projection area.
 //    void UpdateVisibility(float visible_ratio);
@@ -138,6 +217,11 @@ public:
     cv::Rect RectangleExplained(int level=0);
     void SwitchMeshForInference();
     void SwitchMeshForVisualization();
+    /// \brief: Simplify the inference mesh of each shape for each pyramid level within the
+    /// triangle budget of the level, doubling the budget until the silhouette error is acceptable.
+    void BuildMeshLOD(const Json::Value &lod_cfg, float z_near, float z_far);
+    /// \brief: Rectangle enclosing the contour of the best shape at the current estimate.
+    cv::Rect ContourRect(int level=0);
 
     /// \brief: Render edge map at current best estimate.
     cv::Mat Render(int level=0);
@@ -148,6 +232,10 @@ public:
     cv::Mat RenderDepthAt(const SE3 &object_pose, int level=0);
     cv::Mat RenderMask(int level=0);
     cv::Mat RenderMaskAt(const SE3 &object_pose, int level=0);
+    /// \brief: Asynchronous versions of Render and RenderDepth, out is allocated here and
+    /// holds the result once the returned handle is waited on.
+    RenderReadbackPtr RenderAsync(cv::Mat &out, int level=0);
+    RenderReadbackPtr RenderDepthAsync(cv::Mat &out, int level=0);
     Vec2f Project(const Vec3f &vertex, int level=0) const;
     void GetProjection(std::vector<Vec2f> &projections, int level=0) const;
     Vec2f ProjectMean(int level=0) const;
@@ -209,13 +297,40 @@ private:
     /// 3. ComputePrior:
     void PFUpdate(int level=-1);
     void MultiScalePFUpdate();
+    /// \brief: Resample, or not depending on the effective sample size, and commit the update.
+    void ResampleParticles();
+    /// \brief: Most probable shape and its mean from the weighted particles.
+    void UpdateEstimate();
+    /// \brief: Whether the CNN term of the level comes from the scene-wide batch, which is scored
+    /// after all the trackers are updated, such that resampling waits for ApplyCNNLikelihood.
+    bool BatchesCNN(int level) const { return use_CNN_ && CNN_batched_ && level == 0; }
     int ComputeProposals(int level=-1);
     void ComputeLikelihood(int level=-1);
     void ComputePrior(int level=-1);
     // publish bounding box proposals to be evaluated in network process via LCM port
-    void PublishBBoxProposals(const std::vector<cv::Rect> &rect_list);
+    /// \brief: Send bounding box hypotheses to the detector, boxes are quantized and duplicates are sent once.
+    /// \param index: index[i] is the position of the box of hypothesis i among the boxes sent.
+    /// \return: future of one score per box sent.
+    std::future<std::vector<float>> PublishBBoxProposals(const std::vector<cv::Rect> &hyp_bbox_list,
+                                                         std::vector<int> &index);
+    /// \brief: Add the CNN log-likelihood to the weights, particle i is scored by box_scores[box_index[i]].
+    /// \return: false and weights untouched if the scores do not cover the boxes.
+    bool ApplyCNNScores(const std::vector<float> &box_scores,
+                        const std::vector<int> &box_index,
+                        int level);
     /// \brief: Make Monte Carlo move on azimuth estimation to explore symmetry of objects.
     void MakeMonteCarloMove(int level=-1);
+    /// \brief: Run func(i, worker) for i in [0, n), in parallel on the likelihood workers if any,
+    /// worker is -1 otherwise.
+    void ForEach(int n, const std::function<void(int, int)> &func);
+    /// \brief: Render engine of a shape used by the given likelihood worker, -1 for the shared ones.
+    RendererPtr LikelihoodRenderer(ShapeId sid, int level, int worker) const;
+    /// \brief: Render groups of a level, the shared one followed by those of the likelihood workers.
+    std::vector<RendererGroupPtr> RenderGroups(int level) const;
+    /// \brief: Drop cached likelihoods, bins are sized by the pixel footprint of each level at the current depth.
+    void ResetLikelihoodCache();
+    ParticleArray<float, 4> &particles() { return particle_buffers_.current(); }
+    const ParticleArray<float, 4> &particles() const { return particle_buffers_.current(); }
 
     void EKFUpdate();
     void EKFInitialize();
@@ -231,22 +346,52 @@ private:
     TrackerStatus status_, saved_status_;
     float ts_, last_update_ts_;
     bool use_partial_mesh_;
+    bool use_mesh_lod_;     // render simplified meshes on each pyramid level for inference
+    bool use_geometric_contour_;    // extract contours from mesh edges instead of rendering depth
 
     // camera model & render engine
     Json::Value config_;
 
-    std::shared_ptr<lcm::LCM> port_;
-    std::shared_ptr<BBoxLikelihoodHandler> handler_;
+    BBoxLikelihoodClientPtr CNN_client_;
 
 //    std::shared_ptr<UndistorterPTAM> undistorter_;
     //FIXME: ideally render engines are wrapped into Shape class, need to eliminate the following
     // stack of render engines conditioned on most probable shape id
     std::vector<RendererPtr> renderers_;
+    // one group per level, members are the render engines of the shapes
+    std::vector<RendererGroupPtr> render_groups_;
+    // parallel likelihood evaluation: software render engines per worker since
+    // OpenGL contexts are bound to the thread which created them
+    std::vector<LikelihoodWorker> likelihood_workers_;
+    std::shared_ptr<tbb::task_arena> likelihood_arena_;
+    tbb::concurrent_bounded_queue<int> idle_workers_;
+    // scores of quantized poses within a frame, null if disabled
+    std::shared_ptr<LikelihoodCache> likelihood_cache_;
+    float likelihood_cache_quantization_;   // bin size in pixels of the level
+    // geometric pre-rejection of poses by their projected bounding box
+    bool use_geometric_gating_;
+    float gating_min_visible_ratio_;    // fraction of the projected box inside the image
+    float gating_min_iou_;      // IoU of the projected box and the matched detection
+    int gated_poses_;   // number of poses rejected without rendering in the current frame
 //    RendererPtr renderer_; // renderer for downsampled size
 //    RendererPtr renderer0_; // renderer for original size
-    std::shared_ptr<std::knuth_b> generator_;
+    // counter-based random numbers addressed by (tracker & seed, update, particle index, stream)
+    enum RandomStream : uint32_t {
+        kInitialStateStream = 0,
+        kProposalStream,
+        kAzimuthMixStream,
+        kShapeJumpStream,
+        kMonteCarloMoveStream,
+        kResamplingStream,
+        kParticleSeedStream
+    };
+    uint64_t rng_key_;
+    uint32_t rng_update_;   // advances on every filter update
     Timer timer_;
     OneDimSearch oned_search_;
+    bool oned_reduce_on_device_;    // only read back scores and bounding box corners from the renderer
+    bool oned_use_roi_;     // restrict rendering & search to the region predicted from particles
+    int oned_batch_size_;   // poses per batched search, 1 to search one pose at a time
     DistanceTransform distance_transform_;
     std::string class_name_;
 
@@ -268,6 +413,16 @@ private:
     bool use_CNN_, use_MC_move_;
     std::vector<float> log_likelihood_weight_, log_prior_weight_, log_proposal_weight_, CNN_log_likelihood_weight_;
     float CNN_prob_thresh_;
+    int CNN_deadline_ms_;   // wait at most this long for CNN scores, 0 to wait forever
+    bool CNN_early_hypotheses_;     // publish projected bounding boxes before edge scoring
+    int CNN_timeouts_;  // number of updates which fell back to edge-only weights
+    int CNN_box_quantization_;  // grid spacing in pixels of hypothesis boxes, equal boxes are scored once
+    bool CNN_batched_;  // the scene scores hypotheses of all the trackers at once
+    // scene-wide batch: hypotheses of the finest level & their scores, the update is resampled once applied
+    bool CNN_resampling_pending_;
+    std::vector<cv::Rect> CNN_batch_hypotheses_;
+    std::future<std::vector<float>> CNN_batch_reply_;
+    std::vector<int> CNN_batch_box_index_;  // particle -> box of the batch
     float keep_id_prob_;    // probability of keeping the current shape id
     float azi_flip_rate_;   // flip rate of azimuth in MC move
     float azi_uniform_mix_;
@@ -290,8 +445,17 @@ private:
 
     // particles and weights
     int max_num_particles_;
+    ResamplingScheme resampling_scheme_;
+    float resampling_ess_threshold_;    // resample if the effective sample size drops below this fraction
+    // KLD-sampling: the number of particles adapts to the spread of the posterior on resampling
+    bool use_kld_sampling_;
+    int kld_min_num_particles_, kld_max_num_particles_;
+    double kld_epsilon_;    // bound of the KL divergence
+    double kld_upper_quantile_;     // standard normal upper quantile of the confidence
+    Vec4f kld_bin_size_;    // bin size of (x, y, log-depth, azimuth)
     int total_visible_edgepixels_;
-    Particles<float, 4> particles_;
+    // current particles and the ones of the last committed update
+    ParticleBuffers<ParticleArray<float, 4>> particle_buffers_;
 
     // visibility properties
     float visible_ratio_;
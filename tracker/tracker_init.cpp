@@ -19,9 +19,9 @@ void Tracker::InitializeFromBoundingBox(const vlslam_pb::BoundingBox &bbox,
     gwr_ = cam_pose;
     Rg_ = Rg;
 
-    for (auto sid : shape_ids_) {
-        for (auto r: shapes_.at(sid).render_engines_) {
-            r->SetCamera(grc_.inv().matrix());
+    for (int lvl = 0; lvl < render_groups_.size(); ++lvl) {
+        for (auto group : RenderGroups(lvl)) {
+            group->SetCamera(grc_.inv().matrix());
         }
     }
     status_ = TrackerStatus::INITIALIZING;
@@ -35,13 +35,19 @@ void Tracker::InitializeFromBoundingBox(const vlslam_pb::BoundingBox &bbox,
     mean_ = init_state_;
 
     // initialize particles
-    particles_.resize(max_num_particles_, {mean_, 0, 0.0f});
+    particles().resize(max_num_particles_, {mean_, 0, 0.0f});
     // diffuse pose
-    std::uniform_real_distribution<float> uniform_azimuth_dist(0, M_PI*2);
-    for (auto &particle : particles_) {
-        Vec4f perturbation = RandomVector<4>(0, 1.0, generator_);
+    ++rng_update_;
+    int n = particles().size();
+    // standard normal perturbations (first 4 columns) and uniform azimuth (last column)
+    Eigen::Matrix<float, Eigen::Dynamic, 5, Eigen::ColMajor> noise(n, 5);
+    FillNormal(rng_key_, rng_update_, kInitialStateStream, 0, n, 4, noise.data());
+    FillUniform(rng_key_, rng_update_, kInitialStateStream, n, n, 1, noise.col(4).data());
+    for (int i = 0; i < n; ++i) {
+        auto particle = particles()[i];
+        Vec4f perturbation = noise.block<1, 4>(i, 0).transpose();
         particle.Perturbate(initial_std_.cwiseProduct(perturbation));
-        particle.v()(3) = WarpAngle(uniform_azimuth_dist(*generator_));    // initialize from uniform distribution
+        particle.v()(3) = WarpAngle(2 * M_PI * noise(i, 4));    // initialize from uniform distribution
 
 //        if (particle.v(2) < log(0.1) || particle.v(2) > log(5.0)) {
 //            particle.set_zero_w();
@@ -58,7 +64,7 @@ void Tracker::InitializeFromBoundingBox(const vlslam_pb::BoundingBox &bbox,
     // assign same initial pose to each possible shape
     for (int i = 1; i < shape_ids_.size(); ++i) {
         for (int j = 0; j < max_num_particles_; ++j) {
-            particles_.push_back(particles_[j]);
+            particles().push_back(particles()[j]);
         }
     }
     // assign equally likely shape labels
@@ -67,16 +73,16 @@ void Tracker::InitializeFromBoundingBox(const vlslam_pb::BoundingBox &bbox,
         tmp_ids.insert(tmp_ids.begin(), max_num_particles_, sid);
     }
 //    std::shuffle(tmp_ids.begin(), tmp_ids.end(), *generator_);
-    for (int i = 0; i < particles_.size(); ++i) {
-        particles_[i].set_shape_id(tmp_ids[i]);
-        CHECK(shapes_.count(particles_[i].shape_id()));
+    for (int i = 0; i < particles().size(); ++i) {
+        particles()[i].set_shape_id(tmp_ids[i]);
+        CHECK(shapes_.count(particles()[i].shape_id()));
     }
 
 
-    particles_.SystematicResampling();
-    mean_ = particles_.Mean();
+    particles().SystematicResampling(Philox(rng_key_, 0, rng_update_, kResamplingStream).Uniform());
+    mean_ = particles().Mean();
     std::cout << "mean(0)=" << mean_.transpose() << "\n";
-    particles_.PrintSummary();
+    particles().PrintSummary();
 }
 
 }
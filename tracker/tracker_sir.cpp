@@ -5,6 +5,12 @@
 
 #include "tracker.h"
 
+// stl
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <map>
+
 // system
 #include <sys/stat.h>
 #include <tracker.h>
@@ -12,7 +18,6 @@
 // 3rd party
 #include "tbb/parallel_for.h"
 #include "tbb/blocked_range.h"
-#include "mpreal.h"
 
 // own
 #include "tracker_utils.h"
@@ -37,21 +42,59 @@ float Tracker::LogLikelihoodFromEdgelist(const std::vector<EdgePixel> &edgelist,
         (*info)[0] = match_ratio;
         (*info)[1] = average_match_distance;
     }
+    return LogLikelihoodFromScore(match_ratio, average_match_distance, match_ratio_order);
+}
+
+float Tracker::LogLikelihoodFromScore(float match_ratio,
+                                      float average_match_distance,
+                                      float match_ratio_order) {
     return powf(match_ratio, match_ratio_order) / (average_match_distance + eps);
 //    return 1.0 / (average_match_distance + eps);
 }
 
+void Tracker::OneDimSearchScore(RendererPtr renderer,
+                                const Mat4f &model,
+                                std::array<float, 6> &score_and_corner) {
+    if (oned_reduce_on_device_) {
+        renderer->OneDimSearch(model, score_and_corner);
+    } else {
+        std::vector<PackedEdgePixel> edgelist;
+        renderer->OneDimSearch(model, edgelist);
+        ReduceEdgelist(edgelist, renderer->rows(), renderer->cols(), score_and_corner);
+    }
+}
+
+void Tracker::OneDimSearchScores(RendererPtr renderer,
+                                 const Mat4fColMajorList &models,
+                                 std::vector<std::array<float, 6>> &score_and_corners) {
+    score_and_corners.resize(models.size());
+    if (oned_batch_size_ <= 1) {
+        // one pose at a time honors the region of interest
+        for (int i = 0; i < models.size(); ++i) {
+            OneDimSearchScore(renderer, models[i], score_and_corners[i]);
+        }
+    } else if (oned_reduce_on_device_) {
+        renderer->OneDimSearchBatch(models, score_and_corners);
+    } else {
+        std::vector<std::vector<PackedEdgePixel>> edgelists;
+        renderer->OneDimSearchBatch(models, edgelists);
+        for (int i = 0; i < models.size(); ++i) {
+            ReduceEdgelist(edgelists[i], renderer->rows(), renderer->cols(), score_and_corners[i]);
+        }
+    }
+}
+
 void Tracker::PFUpdate(int level) {
     CHECK(status_ != TrackerStatus::OUT_OF_VIEW);
     if (level < 0) level = scale_level_ - 1;
+    if (CNN_resampling_pending_) {
+        LOG(WARNING) << "CNN scores of the last update were never applied";
+        ApplyCNNLikelihood(std::chrono::steady_clock::now());
+    }
 
     timer_.Tick("update");
-    Particles<float, 4> saved_particles(particles_);
-    // reset log probability
-    for (auto &particle : particles_) {
-        particle.set_log_w(0);
-        particle.MakeValid();
-    }
+    ++rng_update_;
+    // log weights are carried over if the particles were not resampled in the last update
     int counter_invalid = ComputeProposals(level);
     ComputeLikelihood(level);
     ComputePrior(level);
@@ -60,31 +103,35 @@ void Tracker::PFUpdate(int level) {
     }
     timer_.Tock("update");
 
-    if (counter_invalid > particles_.size() / 2.0) {
+    if (counter_invalid > particles().size() / 2.0) {
         LOG(INFO) << TermColor::red << "use saved particles" << TermColor::endl;
-        particles_ = saved_particles;
+        particle_buffers_.Rollback();
         saved_status_ = status_;
         status_ = TrackerStatus::OUT_OF_VIEW;
+    } else if (BatchesCNN(level) && !std::isnan(particles().EffectiveSampleSize())) {
+        // resampling waits for the scores of the scene-wide batch, see ApplyCNNLikelihood,
+        // meanwhile the estimate below is taken from the weighted particles, degenerate
+        // weights are rolled back right away instead
+        CNN_resampling_pending_ = true;
     } else {
-        timer_.Tick("resampling");
-        bool resample_ok = particles_.SystematicResampling();
-        if (!resample_ok) {
-            // TODO: all samples have zero weights, need to re-initialize
-            LOG(INFO) << TermColor::yellow << "need to re-initialize" << TermColor::endl;
-            particles_ = saved_particles;
-        }
-        timer_.Tock("resampling");
+        ResampleParticles();
     }
 
     if(scale_level_ == 1
         || level == 0) {
-        best_shape_match_ = particles_.MostProbableIndex();
-        renderers_ = shapes_.at(best_shape_match_).render_engines_;
-        mean_ = particles_.Mean(best_shape_match_);
+        UpdateEstimate();
         history_.push_back(mean_);
         label_history_.push_back(best_shape_match_);
         std::cout << image_fullpath_ << "\n";
-        particles_.PrintSummary();
+        particles().PrintSummary();
+        if (likelihood_cache_) {
+            LOG(INFO) << "likelihood cache hit rate=" << likelihood_cache_->hit_rate()
+                      << " (" << likelihood_cache_->hits() << "/"
+                      << likelihood_cache_->hits() + likelihood_cache_->misses() << ")";
+        }
+        if (use_geometric_gating_) {
+            LOG(INFO) << gated_poses_ << " poses rejected by the projected bounding box";
+        }
         LogDebugInfo();
 
     }
@@ -93,193 +140,536 @@ void Tracker::PFUpdate(int level) {
     gwm_ = gwr_ * SE3(MatForRender());
 }
 
+void Tracker::ResampleParticles() {
+    timer_.Tick("resampling");
+    // NaN if no valid particle carries weight
+    double ess = particles().EffectiveSampleSize();
+    bool resample_ok = !std::isnan(ess);
+    if (!resample_ok) {
+        // the update is dropped below
+    } else if (resampling_ess_threshold_ >= 1 || ess < resampling_ess_threshold_ * particles().size()) {
+        // a threshold of 1 always resamples as before
+        Philox generator(rng_key_, 0, rng_update_, kResamplingStream);
+        int num_particles = particles().size();
+        if (use_kld_sampling_) {
+            num_particles = particles().KLDSampleSize(generator.Uniform(), kld_bin_size_,
+                                                     kld_epsilon_, kld_upper_quantile_,
+                                                     kld_min_num_particles_, kld_max_num_particles_);
+            LOG(INFO) << "KLD-sampling: " << particles().size() << " -> " << num_particles << " particles";
+        }
+        resample_ok = particles().Resample(resampling_scheme_, generator, num_particles);
+    } else {
+        LOG(INFO) << "skip resampling with effective sample size " << ess << "/" << particles().size();
+    }
+    if (!resample_ok) {
+        LOG(WARNING) << TermColor::yellow << "all the weights are zero, particles of the last update are kept, "
+                     << "need to re-initialize" << TermColor::endl;
+        particle_buffers_.Rollback();
+    } else {
+        particle_buffers_.Commit();
+    }
+    timer_.Tock("resampling");
+}
+
+void Tracker::UpdateEstimate() {
+    best_shape_match_ = particles().MostProbableIndex();
+    renderers_ = shapes_.at(best_shape_match_).render_engines_;
+    mean_ = particles().Mean(best_shape_match_);
+}
+
 int Tracker::ComputeProposals(int level) {
     if (level < 0) level = scale_level_ - 1;
     int invalid_counter(0);
-    std::uniform_real_distribution<float> uniform_dist(0, 1);
-    for (auto &particle : particles_) {
-        Vec4f perturbation = RandomVector<4>(0, 1, generator_);
-        particle.Perturbate(proposal_std_.cwiseProduct(perturbation));
-        // mixed kernel for azimuth estimation
-        if (uniform_dist(*generator_) < azi_uniform_mix_) {
-            particle.v()[3] = uniform_dist(*generator_) * 2 * M_PI;
+    int n = particles().size();
+    // standard normal perturbations, one row per particle
+    ParticleArray<float, 4>::StateMatrix perturbation(n, 4);
+    FillNormal(rng_key_, rng_update_, kProposalStream, 0, n, 4, perturbation.data());
+    // the proposal is written out of place to the other buffer, which becomes current
+    // and is committed or rolled back at the end of the update
+    particle_buffers_.Begin().Perturbate(particle_buffers_.committed(), perturbation, proposal_std_);
+    // mixed kernel for azimuth estimation
+    Eigen::Matrix<float, Eigen::Dynamic, 2, Eigen::ColMajor> mix(n, 2);
+    FillUniform(rng_key_, rng_update_, kAzimuthMixStream, 0, n, 2, mix.data());
+    for (int i = 0; i < n; ++i) {
+        if (mix(i, 0) < azi_uniform_mix_) {
+            particles()[i].v()[3] = mix(i, 1) * 2 * M_PI;
         }
-        particle.v()[3] = WarpAngle(particle.v(3));
+    }
+    particles().WarpAngle(3);
 
 //        if (particle.v(2) < log(0.1) || particle.v(2) > log(5.0)) {
 //            particle.MakeInvalid();
 //            particle.set_zero_w();
 //            ++invalid_counter;
 //            continue;
-//        } else
-        {
-            particle.MakeValid();
-            double log_proposal(0);
-            for (int i = 0; i < 3; ++i) {
-                double tmp = perturbation(i);
-                log_proposal += -(tmp * tmp * 0.5);
+//        }
+    particles().MakeValid();
+    Eigen::VectorXd log_proposal = ParticleArray<float, 4>::GaussianLogDensity(perturbation, 3);
+    CHECK(log_proposal.allFinite()) << "abnormal log proposal value";
+    particles().AddLogWeights(-log_proposal_weight_[level] * log_proposal);
+    return invalid_counter;
+}
+
+void Tracker::OneDimSearchScores(int level,
+                                 const std::vector<ShapeId> &sids,
+                                 const std::vector<Vec4f> &states,
+                                 std::vector<std::array<float, 6>> &score_and_corners) {
+    CHECK_EQ(sids.size(), states.size());
+    int n = states.size();
+    score_and_corners.resize(n);
+    // distinct poses to be searched, bucketed by shape
+    std::map<ShapeId, std::vector<int>> buckets;
+    std::vector<Vec4f> poses;
+    std::vector<int> pose_index(n, -1);     // -1 for cache hits & rejected poses
+    std::vector<LikelihoodCache::Key> keys;
+    std::unordered_map<LikelihoodCache::Key, int, LikelihoodCache::KeyHash> pending;
+    int hits(0);
+    for (int i = 0; i < n; ++i) {
+        if (use_geometric_gating_ && GeometricGate(sids[i], level, states[i], score_and_corners[i])) {
+            ++gated_poses_;
+            continue;
+        }
+        Vec4f pose = states[i];
+        if (likelihood_cache_) {
+            auto key = likelihood_cache_->Quantize(sids[i], level, states[i], &pose);
+            if (likelihood_cache_->Find(key, score_and_corners[i])) {
+                ++hits;
+                continue;
             }
-            CHECK(std::isnormal(log_proposal)) << "abnormal log proposal value: pert=" << perturbation.transpose();
-            log_proposal *= log_proposal_weight_[level];
-            particle.set_log_w(particle.log_w() - log_proposal);
+            // same bin as an earlier state of this call
+            auto it = pending.find(key);
+            if (it != pending.end()) {
+                pose_index[i] = it->second;
+                ++hits;
+                continue;
+            }
+            pending[key] = poses.size();
+            keys.push_back(key);
         }
+        pose_index[i] = poses.size();
+        buckets[sids[i]].push_back(poses.size());
+        poses.push_back(pose);
+    }
+    if (likelihood_cache_) likelihood_cache_->Record(hits, poses.size());
+
+    // each task is a batch of one shape, such that a render engine is bound once per batch
+    struct Batch {
+        ShapeId sid;
+        const int *indices;
+        int size;
+    };
+    std::vector<Batch> batches;
+    int batch_size = std::max(1, oned_batch_size_);
+    for (const auto &bucket : buckets) {
+        const std::vector<int> &indices = bucket.second;
+        for (int start = 0; start < indices.size(); start += batch_size) {
+            batches.push_back({bucket.first, &indices[start], std::min<int>(batch_size, indices.size() - start)});
+        }
+    }
+    std::vector<std::array<float, 6>> pose_scores(poses.size());
+    ForEach(batches.size(), [this, level, &batches, &poses, &pose_scores](int b, int worker) {
+        const Batch &batch = batches[b];
+        Mat4fColMajorList models(batch.size);
+        for (int k = 0; k < batch.size; ++k) models[k] = MatForRender(poses[batch.indices[k]]);
+        std::vector<std::array<float, 6>> batch_scores;
+        OneDimSearchScores(LikelihoodRenderer(batch.sid, level, worker), models, batch_scores);
+        for (int k = 0; k < batch.size; ++k) pose_scores[batch.indices[k]] = batch_scores[k];
+    });
+
+    // scatter back
+    if (likelihood_cache_) {
+        for (int k = 0; k < poses.size(); ++k) likelihood_cache_->Insert(keys[k], pose_scores[k]);
+    }
+    for (int i = 0; i < n; ++i) {
+        if (pose_index[i] >= 0) score_and_corners[i] = pose_scores[pose_index[i]];
     }
-    return invalid_counter;
+}
+
+void Tracker::ResetLikelihoodCache() {
+    if (!likelihood_cache_) return;
+    float radius(0);
+    for (int sid : shape_ids_) {
+        radius = std::max(radius, shapes_.at(sid).radius_);
+    }
+    std::vector<Vec4f> bin_size(scale_level_);
+    for (int level = 0; level < scale_level_; ++level) {
+        // x & y are normalized image coordinates, depth and azimuth changes move the contour
+        // by about the projected radius times the change
+        float radius_px = std::max(1.0f, fx_[level] * radius / std::exp(mean_(2)));
+        bin_size[level] << likelihood_cache_quantization_ / fx_[level],
+            likelihood_cache_quantization_ / fy_[level],
+            likelihood_cache_quantization_ / radius_px,
+            likelihood_cache_quantization_ / radius_px;
+    }
+    likelihood_cache_->Reset(bin_size);
+}
+
+cv::Rect Tracker::PredictRegion(int level) const {
+    cv::Rect image(0, 0, cols_[level], rows_[level]);
+    float radius(0);
+    for (int sid : shape_ids_) {
+        radius = std::max(radius, shapes_.at(sid).radius_);
+    }
+    float z_near = renderers_[level]->z_near();
+    SE3 gcr = grc_.inv();
+    Vec2f tl(std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+    Vec2f br(std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest());
+    for (const auto &particle : particles()) {
+        // object center in the current camera frame
+        Vec3f center = gcr * Vec3f(MatForRender(particle.v()).block<3, 1>(0, 3));
+        // the projection of the cube enclosing the bounding sphere encloses the projection of the object
+        for (int k = 0; k < 8; ++k) {
+            Vec3f corner = center + radius * Vec3f((k & 1) ? 1 : -1, (k & 2) ? 1 : -1, (k & 4) ? 1 : -1);
+            if (corner(2) <= z_near) return image;
+            Vec2f xp = Project(corner, level);
+            tl = tl.cwiseMin(xp);
+            br = br.cwiseMax(xp);
+        }
+    }
+    int margin = oned_search_.search_line_length_;
+    return cv::Rect(cv::Point(std::floor(tl(0)) - margin, std::floor(tl(1)) - margin),
+                    cv::Point(std::ceil(br(0)) + margin + 1, std::ceil(br(1)) + margin + 1)) & image;
+}
+
+int Tracker::ProjectBoundingBox(ShapeId sid, const Vec4f &state, cv::Rect &box) const {
+    float z_near = renderers_[0]->z_near();
+    SE3 gcr = grc_.inv();
+    Mat4f model = MatForRender(state);
+    Mat3f R = model.block<3, 3>(0, 0);
+    Vec3f T = model.block<3, 1>(0, 3);
+    Vec2f tl(std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+    Vec2f br(std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest());
+    const std::vector<Vec3f> &control_points = shapes_.at(sid).control_points_;
+    int behind(0);
+    for (int k = 0; k < 8; ++k) {
+        Vec3f corner = gcr * Vec3f(R * control_points[k] + T);
+        if (corner(2) <= z_near) {
+            ++behind;
+            continue;
+        }
+        Vec2f xp = Project(corner, 0);
+        tl = tl.cwiseMin(xp);
+        br = br.cwiseMax(xp);
+    }
+    if (behind > 0) {
+        box = cv::Rect();
+    } else {
+        // keep far off-screen projections within a range where the area fits in an integer
+        tl = tl.cwiseMax(-1e4f).cwiseMin(1e4f);
+        br = br.cwiseMax(-1e4f).cwiseMin(1e4f);
+        box = cv::Rect(cv::Point(std::floor(tl(0)), std::floor(tl(1))),
+                       cv::Point(std::ceil(br(0)), std::ceil(br(1))));
+    }
+    return behind;
+}
+
+cv::Rect Tracker::HypothesisBox(ShapeId sid, const Vec4f &state) const {
+    cv::Rect image(0, 0, cols_[0], rows_[0]);
+    cv::Rect box;
+    return ProjectBoundingBox(sid, state, box) == 0 ? box & image : image;
+}
+
+bool Tracker::GeometricGate(ShapeId sid, int level, const Vec4f &state,
+                            std::array<float, 6> &score_and_corner) const {
+    cv::Rect box;
+    int behind = ProjectBoundingBox(sid, state, box);
+    // the projection is unbounded if the box crosses the near plane, nothing to reject then
+    if (behind > 0 && behind < 8) return false;
+
+    cv::Rect visible = box & cv::Rect(0, 0, cols_[0], rows_[0]);
+    bool rejected = visible.area() < gating_min_visible_ratio_ * std::max(1, box.area());
+    // the box of the 3D bounding box encloses the silhouette, thus the IoU threshold is loose
+    if (!rejected && best_bbox_index_ >= 0) {
+        rejected = ComputeIoU(box, best_bbox_) < gating_min_iou_;
+    }
+    if (rejected) {
+        // nothing matched, the log-likelihood is zero as if no edge pixel was found
+        float ratio = rows_[level] / (float) rows_[0];
+        score_and_corner = {0, 0,
+                            visible.x * ratio, visible.y * ratio,
+                            (visible.x + visible.width) * ratio, (visible.y + visible.height) * ratio};
+    }
+    return rejected;
+}
+
+std::vector<RendererGroupPtr> Tracker::RenderGroups(int level) const {
+    std::vector<RendererGroupPtr> groups{render_groups_[level]};
+    for (const auto &worker : likelihood_workers_) {
+        groups.push_back(worker.render_groups_[level]);
+    }
+    return groups;
+}
+
+RendererPtr Tracker::LikelihoodRenderer(ShapeId sid, int level, int worker) const {
+    if (worker < 0) return shapes_.at(sid).render_engines_[level];
+    return likelihood_workers_[worker].render_engines_.at(sid)[level];
+}
+
+void Tracker::ForEach(int n, const std::function<void(int, int)> &func) {
+    if (likelihood_workers_.empty()) {
+        for (int i = 0; i < n; ++i) func(i, -1);
+        return;
+    }
+    // the arena runs at most one task per worker, should more tasks ever run at once,
+    // e.g., in a nested arena, they wait for a worker to become idle
+    likelihood_arena_->execute([this, n, &func]() {
+        tbb::parallel_for(tbb::blocked_range<int>(0, n),
+                          [this, &func](const tbb::blocked_range<int> &range) {
+                              // isolated such that a thread waiting in the nested loops of the software
+                              // rasterizer does not pick up other tasks while holding a worker
+                              tbb::this_task_arena::isolate([this, &func, &range]() {
+                                  int worker;
+                                  idle_workers_.pop(worker);
+                                  for (int i = range.begin(); i < range.end(); ++i) func(i, worker);
+                                  idle_workers_.push(worker);
+                              });
+                          });
+    });
 }
 
 void Tracker::ComputeLikelihood(int level) {
     level = (level < 0 ? scale_level_-1 : level);
+    if (oned_use_roi_) {
+        cv::Rect roi = PredictRegion(level);
+        for (auto group : RenderGroups(level)) group->SetROI(roi);
+    }
 
-    RendererPtr renderer(nullptr);
-//    const auto &evidence = evidence_[level];
-//    const auto &evidence_dir = evidence_dir_[level];
-
-    std::vector<cv::Rect> hyp_bbox_list;    // hypothesized bounding boxes
-    std::uniform_real_distribution<float> uniform_dist(0, 1);
-    for (auto &particle : particles_) {
+    int n = particles().size();
+    // each particle draws from its own random stream, results do not depend on the number of workers
+    std::vector<Philox> generators;
+    generators.reserve(n);
+    for (int i = 0; i < n; ++i) generators.emplace_back(rng_key_, i, rng_update_, kShapeJumpStream);
 #ifndef FEH_USE_MCMC_SHAPE_IDENTIFICATION
-        if (uniform_dist(*generator_) < keep_id_prob_
+    // shape jumps come first, such that particles are grouped by the shape they are scored with
+    for (int i = 0; i < n; ++i) {
+        auto particle = particles()[i];
+        if (generators[i].Uniform() < keep_id_prob_
             || shape_ids_.size() == 1) {
             // keep the current shape id
         } else {
             // perturbate shape id
-            std::uniform_int_distribution<int> label_jump_dist(1, shape_ids_.size()-1);
-            int new_shape_id = shape_ids_.at((particle.shape_id() + label_jump_dist(*generator_)) % shape_ids_.size());
+            int label_jump = 1 + generators[i].UniformInt(shape_ids_.size()-1);
+            int new_shape_id = shape_ids_.at((particle.shape_id() + label_jump) % shape_ids_.size());
             particle.set_shape_id(new_shape_id);
         }
+    }
 #endif
-        // pick proper render engine
-        renderer = shapes_.at(particle.shape_id()).render_engines_[level];
-        double log_likelihood;
+    std::vector<ShapeId> sids(n);
+    std::vector<Vec4f> states(n);
+    for (int i = 0; i < n; ++i) {
+        sids[i] = particles()[i].shape_id();
+        states[i] = particles()[i].v();
+    }
+    // the CNN scores hypothesized bounding boxes while particles are scored by edges
+    // the scene-wide batch scores the hypotheses of the finest level once all the trackers are updated
+    bool use_CNN = use_CNN_ && CNN_client_;
+    bool batch_CNN = BatchesCNN(level);
+    std::future<std::vector<float>> CNN_reply;
+    std::chrono::steady_clock::time_point CNN_deadline;
+    std::vector<cv::Rect> hyp_bbox_list((use_CNN || batch_CNN) ? n : 0);
+    std::vector<int> CNN_box_index;     // particle -> unique box sent
+    if ((use_CNN || batch_CNN) && CNN_early_hypotheses_) {
+        for (int i = 0; i < n; ++i) hyp_bbox_list[i] = HypothesisBox(sids[i], states[i]);
+    }
+    if (use_CNN && CNN_early_hypotheses_) {
+        timer_.Tick("sending hypotheses");
+        CNN_reply = PublishBBoxProposals(hyp_bbox_list, CNN_box_index);
+        CNN_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(CNN_deadline_ms_);
+        timer_.Tock("sending hypotheses");
+    }
+    std::vector<std::array<float, 6>> scores;
+    timer_.Tick("rendering");
+    OneDimSearchScores(level, sids, states, scores);
+    timer_.Tock("rendering");
+    std::vector<double> log_likelihood(n);
+    for (int i = 0; i < n; ++i) {
+        log_likelihood[i] = LogLikelihoodFromScore(scores[i][0], scores[i][1]);
+    }
+
+#ifdef FEH_USE_MCMC_SHAPE_IDENTIFICATION
+    ////////////////////////////////////////////////////////////////////////////////
+    // MONTE CARLO SHAPE IDENTIFICATION
+    ////////////////////////////////////////////////////////////////////////////////
+    if (shape_ids_.size() > 1 && keep_id_prob_ < 1.0f) {
+        // proposed shapes are scored in a second pass
+        std::vector<int> proposals;
+        std::vector<ShapeId> new_sids;
+        std::vector<Vec4f> new_states;
+        for (int i = 0; i < n; ++i) {
+            if (generators[i].Uniform() > keep_id_prob_) {
+                // random jum with probability keep_id_prob_
+                int label_jump = 1 + generators[i].UniformInt(shape_ids_.size()-1);
+                int new_shape_id = shape_ids_.at((sids[i] + label_jump) % shape_ids_.size());
+                CHECK_NE(new_shape_id, sids[i]);
+                proposals.push_back(i);
+                new_sids.push_back(new_shape_id);
+                new_states.push_back(states[i]);
+            }
+        }
+        std::vector<std::array<float, 6>> new_scores;
         timer_.Tick("rendering");
-        std::array<float, 6> score_and_corner;
-        std::vector<EdgePixel> edgelist;
-//        renderer->ComputeEdgePixels(MatForRender(particle.v()),
-//                                    edgelist);
-        renderer->OneDimSearch(MatForRender(particle.v()),
-                               edgelist);
+        OneDimSearchScores(level, new_sids, new_states, new_scores);
         timer_.Tock("rendering");
+        for (int k = 0; k < proposals.size(); ++k) {
+            int i = proposals[k];
+            double new_log_likelihood = LogLikelihoodFromScore(new_scores[k][0], new_scores[k][1]);
+            // min(1, new_l / old_l) computed in log space
+            double accept_ratio = std::exp(std::min(0.0, new_log_likelihood - log_likelihood[i]));
+            if (accept_ratio >= 1.0 ||
+                generators[i].Uniform() < accept_ratio) {
+                // accept
+                log_likelihood[i] = new_log_likelihood;
+                particles()[i].set_shape_id(new_sids[k]);
+            }
+        }
+    }   // END-OF-MONTE-CARLO-SHAPE-IDENTIFICATION
+#endif
 
-        if (use_CNN_) {
-            cv::Rect rect = RectEnclosedByContour(edgelist,
-                                                  renderer->rows(),
-                                                  renderer->cols());
+    for (int i = 0; i < n; ++i) {
+        auto particle = particles()[i];
+        particle.set_edge_log_likelihood(log_likelihood[i]);
+        particle.set_log_w(particle.log_w() + log_likelihood_weight_[level] * log_likelihood[i]);
+        if ((use_CNN || batch_CNN) && !CNN_early_hypotheses_) {
+            // bounding box enclosing the edge pixels
+            cv::Rect rect(cv::Point((int)scores[i][2], (int)scores[i][3]),
+                          cv::Point((int)scores[i][4], (int)scores[i][5]));
             // scale to match the input image size
-            float ratio = rows_[0] / (float) renderer->rows();
+            float ratio = rows_[0] / (float) rows_[level];
             rect.x *= ratio;
             rect.y *= ratio;
             rect.width *= ratio;
             rect.height *= ratio;
-            hyp_bbox_list.push_back(rect);
+            hyp_bbox_list[i] = rect;
         }
+    }
 
-        log_likelihood = LogLikelihoodFromEdgelist(edgelist);
-
-#ifdef FEH_USE_MCMC_SHAPE_IDENTIFICATION
-        ////////////////////////////////////////////////////////////////////////////////
-        ////////////////////////////////////////////////////////////////////////////////
-        ////////////////////////////////////////////////////////////////////////////////
-        // MONTE CARLO SHAPE IDENTIFICATION
-        ////////////////////////////////////////////////////////////////////////////////
-        ////////////////////////////////////////////////////////////////////////////////
-        ////////////////////////////////////////////////////////////////////////////////
-        if (shape_ids_.size() > 1 && keep_id_prob_ < 1.0f) {
-            if (uniform_dist(*generator_) > keep_id_prob_) {
-                // random jum with probability keep_id_prob_
-                std::uniform_int_distribution<int> label_jump_dist(1, shape_ids_.size()-1);
-                int new_shape_id = shape_ids_.at((particle.shape_id() + label_jump_dist(*generator_)) % shape_ids_.size());
-                CHECK_NE(new_shape_id, particle.shape_id());
-                particle.set_shape_id(new_shape_id);
-
-                double new_log_likelihood;
-                std::array<float, 6> score_and_corner;
-                std::vector<EdgePixel> edgelist;
-                shapes_.at(new_shape_id).render_engines_[level]->OneDimSearch(MatForRender(particle.v()),
-                                                                              edgelist);
-                new_log_likelihood = LogLikelihoodFromEdgelist(edgelist);
-                mpfr::mpreal new_l = mpfr::exp(new_log_likelihood);
-                mpfr::mpreal old_l = mpfr::exp(log_likelihood);
-                double accept_ratio = mpfr::min(1.0, new_l / old_l).toDouble();
-                if (accept_ratio >= 1.0 ||
-                    uniform_dist(*generator_) < accept_ratio) {
-                    // accept
-                    log_likelihood = new_log_likelihood;
-                    particle.set_shape_id(new_shape_id);
-                } else {
-                    // do nothing;
-                }
-            }
-        }   // END-OF-MONTE-CARLO-SHAPE-IDENTIFICATION
-#endif
-
-
-        particle.set_edge_log_likelihood(log_likelihood);
-        log_likelihood *= log_likelihood_weight_[level];
-        particle.set_log_w(particle.log_w() + log_likelihood);
+    if (oned_use_roi_) {
+        for (auto group : RenderGroups(level)) group->ClearROI();
     }
+    if (batch_CNN) CNN_batch_hypotheses_.swap(hyp_bbox_list);
 
     // use CNN as an extra likelihood term
-    if (use_CNN_) {
-        if (level == 0) quality_.CNN_score_ = 0;
-        // publish hypothesized bboxes so that Fast R-CNN can evaluate likelihood
-        timer_.Tick("sending hypotheses");
-        PublishBBoxProposals(hyp_bbox_list);
-        timer_.Tock("sending hypotheses");
+    if (use_CNN) {
+        if (!CNN_early_hypotheses_) {
+            // publish hypothesized bboxes so that Fast R-CNN can evaluate likelihood
+            timer_.Tick("sending hypotheses");
+            CNN_reply = PublishBBoxProposals(hyp_bbox_list, CNN_box_index);
+            CNN_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(CNN_deadline_ms_);
+            timer_.Tock("sending hypotheses");
+        }
 
         timer_.Tick("hypothesis evaluation by NN");
-        // wait messages likelihood messages
-        bool message_received(false);
-        while (!message_received) {
-            if (port_->handle() == 0) {
-                message_received = (handler_->tracker_id_ == id());
-                if (message_received) {
-                    DLOG(INFO) << "likelihood message received\n";
-                    const auto &scores(handler_->scores_);
-                    // now let's update particles with the second likelihood term
-                    CHECK_EQ(particles_.size(), scores.size());
-                    for (int i = 0; i < particles_.size(); ++i) {
-                        auto &particle(particles_[i]);
-                        double score = scores[i];
-                        quality_.CNN_score_ += score;
-//                if (score < CNN_prob_thresh_) {
-//                    particle.set_zero_w();
-//                    particle.MakeInvalid();
-//                } else
-                        {
-                            double CNN_logL = CNN_log_likelihood_weight_[level] * std::log(score);
-                            particle.set_log_w(particle.log_w() + CNN_logL);
-                        }
-                    }
-                    quality_.CNN_score_ /= (scores.size() + eps);
-                }
-            }
+        bool ready(true);
+        if (CNN_deadline_ms_ > 0) {
+            ready = CNN_reply.wait_until(CNN_deadline) == std::future_status::ready;
+        }
+        if (ready) {
+            DLOG(INFO) << "likelihood message received\n";
+            ready = ApplyCNNScores(CNN_reply.get(), CNN_box_index, level);
+        }
+        if (!ready) {
+            // the late reply is dropped by the client, the quality measure of the last reply is kept
+            ++CNN_timeouts_;
+            LOG(WARNING) << TermColor::yellow << "no CNN scores within " << CNN_deadline_ms_
+                         << " ms, edge-only weights (" << CNN_timeouts_ << " times, "
+                         << CNN_client_->pending() << " requests pending)" << TermColor::endl;
         }
         timer_.Tock("hypothesis evaluation by NN");
     }
 }
 
+bool Tracker::ApplyCNNScores(const std::vector<float> &box_scores,
+                             const std::vector<int> &box_index,
+                             int level) {
+    CHECK_EQ(particles().size(), box_index.size());
+    int num_boxes = box_index.empty() ? 0 : *std::max_element(box_index.begin(), box_index.end()) + 1;
+    if (box_scores.size() != num_boxes) {
+        LOG(WARNING) << "expected " << num_boxes << " CNN scores, got " << box_scores.size();
+        return false;
+    }
+    if (level == 0) quality_.CNN_score_ = 0;
+    // now let's update particles with the second likelihood term
+    for (int i = 0; i < particles().size(); ++i) {
+        auto &&particle(particles()[i]);
+        double score = box_scores[box_index[i]];
+        quality_.CNN_score_ += score;
+//        if (score < CNN_prob_thresh_) {
+//            particle.set_zero_w();
+//            particle.MakeInvalid();
+//        } else
+        {
+            double CNN_logL = CNN_log_likelihood_weight_[level] * std::log(score);
+            particle.set_log_w(particle.log_w() + CNN_logL);
+        }
+    }
+    quality_.CNN_score_ /= (particles().size() + eps);
+    return true;
+}
+
+void Tracker::RequestCNNLikelihood(BBoxLikelihoodBatcher &batcher) {
+    if (!CNN_resampling_pending_ || CNN_batch_reply_.valid()) return;
+    CHECK_EQ(CNN_batch_hypotheses_.size(), particles().size());
+    std::vector<cv::Rect> rects = UniqueBoxes(CNN_batch_hypotheses_, CNN_box_quantization_, CNN_batch_box_index_);
+    std::vector<vlslam_pb::BoundingBox> bboxes(rects.size());
+    for (int i = 0; i < rects.size(); ++i) {
+        const cv::Rect &rect = rects[i];
+        bboxes[i].set_top_left_x(rect.x);
+        bboxes[i].set_top_left_y(rect.y);
+        bboxes[i].set_bottom_right_x(rect.x + rect.width);
+        bboxes[i].set_bottom_right_y(rect.y + rect.height);
+        bboxes[i].set_class_name(class_name_);
+    }
+    CNN_batch_reply_ = batcher.Add(id(), bboxes);
+}
+
+void Tracker::ApplyCNNLikelihood(std::chrono::steady_clock::time_point deadline) {
+    if (!CNN_resampling_pending_) return;
+    CNN_resampling_pending_ = false;
+    timer_.Tick("hypothesis evaluation by NN");
+    bool ready = CNN_batch_reply_.valid()
+        && CNN_batch_reply_.wait_until(deadline) == std::future_status::ready;
+    if (ready) {
+        ready = ApplyCNNScores(CNN_batch_reply_.get(), CNN_batch_box_index_, 0);
+    } else {
+        // abandoned, the late reply is dropped by the batcher
+        CNN_batch_reply_ = std::future<std::vector<float>>();
+    }
+    if (!ready) {
+        ++CNN_timeouts_;
+        LOG(WARNING) << TermColor::yellow << "no CNN scores for tracker#" << id()
+                     << ", edge-only weights (" << CNN_timeouts_ << " times)" << TermColor::endl;
+    }
+    CNN_batch_hypotheses_.clear();
+    timer_.Tock("hypothesis evaluation by NN");
+
+    // finish the update of the finest level deferred by PFUpdate
+    ResampleParticles();
+    UpdateEstimate();
+    history_.back() = mean_;
+    label_history_.back() = best_shape_match_;
+    gwm_ = gwr_ * SE3(MatForRender());
+}
+
 void Tracker::ComputePrior(int level) {
     if (level < 0) level = scale_level_ - 1;
 //    if (convergence_counter_ > 0)
     {
-        for (auto &particle : particles_) {
-            if (particle.IsValid()) {
 //                Vec3f dv(particle.v().head<3>() - init_state_.head<3>());
 //                double log_prior(0);
 //                for (int i = 0; i < 4; ++i) {
 //                    double tmp = dv(i) / initial_std_(i);
 //                    log_prior += -(tmp * tmp * 0.5);
 //                }
-                double log_prior = (M_PI/2 - particle.v(3));
-                log_prior *= log_prior;
-                log_prior *= log_prior_weight_[level];
-                particle.set_log_w(particle.log_w() + log_prior);
-            }
-        }
+        Eigen::VectorXd log_prior = (M_PI/2 - particles().states().col(3).cast<double>().array()).square();
+        particles().AddLogWeights(log_prior_weight_[level] * log_prior, true);
     }
 }
 
-void Tracker::PublishBBoxProposals(const std::vector<cv::Rect> &rect_list) {
+std::future<std::vector<float>> Tracker::PublishBBoxProposals(const std::vector<cv::Rect> &hyp_bbox_list,
+                                                              std::vector<int> &index) {
+    // resampled particles mostly project to nearly identical boxes, each distinct box is sent once
+    std::vector<cv::Rect> rect_list = UniqueBoxes(hyp_bbox_list, CNN_box_quantization_, index);
+    DLOG(INFO) << rect_list.size() << " distinct boxes out of " << hyp_bbox_list.size();
     vlslam_pb::BoundingBoxList bboxlist;
     CHECK(!image_fullpath_.empty()) << "image path is empty";
     char ss[256];
@@ -295,54 +685,49 @@ void Tracker::PublishBBoxProposals(const std::vector<cv::Rect> &rect_list) {
         bbox->set_bottom_right_y(rect.y + rect.height);
         bbox->set_class_name(class_name_);
     }
-    uint8_t *send_data = new uint8_t[bboxlist.ByteSize()];
-    bboxlist.SerializeToArray(send_data, bboxlist.ByteSize());
-    port_->publish("bbox", send_data, bboxlist.ByteSize());
-    delete [] send_data;
+    auto reply = CNN_client_->Request(bboxlist);
     DLOG(INFO) << "LCM message with " << bboxlist.bounding_boxes_size() << " boxes sent\n";
+    return reply;
 }
 
 void Tracker::MakeMonteCarloMove(int level) {
     level = (level < 0 ? scale_level_-1 : level);
 
-    std::uniform_real_distribution<float> uni_dist(0, 1);
-
+    // flip azimuth to the complementary angle to explore symmetry of objects
+    std::vector<int> candidates;
+    std::vector<Philox> generators;
+    std::vector<ShapeId> sids;
+    std::vector<Vec4f> states;
     int valid_counter(0);
+    for (int i = 0; i < particles().size(); ++i) {
+        auto p = particles()[i];
+        if (!p.IsValid()) continue;
+        ++valid_counter;
+        Philox generator(rng_key_, i, rng_update_, kMonteCarloMoveStream);
+        if (generator.Uniform() > azi_flip_rate_) continue;
+        candidates.push_back(i);
+        generators.push_back(generator);
+        sids.push_back(p.shape_id());
+        states.push_back({p.v(0), p.v(1), p.v(2), WarpAngle( - p.v(3))});
+    }
+    std::vector<std::array<float, 6>> scores;
+    OneDimSearchScores(level, sids, states, scores);
+
     int moved_counter(0);
-    for (auto &p : particles_) {
-        if (p.IsValid()) {
-            ++valid_counter;
-            if (uni_dist(*generator_) > azi_flip_rate_) continue;
-            float ca = WarpAngle( - p.v(3));  // complementary angle
-            auto r = shapes_.at(p.shape_id()).render_engines_[level];
-            std::vector<EdgePixel> edgelist;
-            r->OneDimSearch(MatForRender({p.v(0), p.v(1), p.v(2), ca}), edgelist);
-            float total_dist(0);
-            int matches(0);
-            for (auto edgepixel : edgelist) {
-                if (edgepixel.depth >= 0) {
-                    total_dist += edgepixel.depth;
-                    matches += 1;
-                }
-            }
-            float match_ratio = matches / (edgelist.size() + eps);
-            float average_match_distance = total_dist / (matches + eps);
-            double new_log_likelihood = match_ratio / (average_match_distance + eps);
-            mpfr::mpreal new_l = mpfr::exp(new_log_likelihood);
-            mpfr::mpreal old_l = mpfr::exp(p.edge_log_likelihood());
-            double accept_rate = mpfr::min(1.0, new_l / old_l).toDouble();
-            if (accept_rate >= 1.0
-                || uni_dist(*generator_) < accept_rate) {
-                // accept with probability of accept_rate
-
-                // modify log likelihood
-                p.set_log_w(p.log_w()
-                                - log_likelihood_weight_[level] * p.edge_log_likelihood()
-                                + log_likelihood_weight_[level] * new_log_likelihood);
-                p.v()(3) = ca;  // change azimuth
-                ++moved_counter;
-//                std::cout << "new_l/old_l=" << new_l << "/" << old_l << "\n";
-            }
+    for (int k = 0; k < candidates.size(); ++k) {
+        auto p = particles()[candidates[k]];
+        double new_log_likelihood = LogLikelihoodFromScore(scores[k][0], scores[k][1]);
+        double accept_rate = std::exp(std::min(0.0, new_log_likelihood - p.edge_log_likelihood()));
+        if (accept_rate >= 1.0
+            || generators[k].Uniform() < accept_rate) {
+            // accept with probability of accept_rate
+
+            // modify log likelihood
+            p.set_log_w(p.log_w()
+                            - log_likelihood_weight_[level] * p.edge_log_likelihood()
+                            + log_likelihood_weight_[level] * new_log_likelihood);
+            p.v()(3) = states[k](3);  // change azimuth
+            ++moved_counter;
         }
     }
     std::cout << TermColor::red << "MCMC move #" << moved_counter
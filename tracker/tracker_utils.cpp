@@ -3,6 +3,10 @@
 //
 #include "tracker_utils.h"
 
+// stl
+#include <array>
+#include <map>
+
 // 3rd party
 #include "opencv2/highgui/highgui.hpp"
 #include "opencv2/imgproc/imgproc.hpp"
@@ -184,7 +188,9 @@ float BBoxArea(const vlslam_pb::BoundingBox &bbox) {
                 * (bbox.top_left_y() - bbox.bottom_right_y()));
 }
 
-cv::Rect RectEnclosedByContour(const std::vector<EdgePixel> &edgelist, int rows, int cols) {
+namespace {
+template <typename EdgePixelT>
+cv::Rect RectEnclosedByContourImpl(const std::vector<EdgePixelT> &edgelist, int rows, int cols) {
     if (!edgelist.empty()) {
         int min_x = 10000;
         int min_y = 10000;
@@ -205,6 +211,15 @@ cv::Rect RectEnclosedByContour(const std::vector<EdgePixel> &edgelist, int rows,
         return cv::Rect(cv::Point(0, 0), cv::Point(0, 0));
     }
 }
+}   // namespace
+
+cv::Rect RectEnclosedByContour(const std::vector<EdgePixel> &edgelist, int rows, int cols) {
+    return RectEnclosedByContourImpl(edgelist, rows, cols);
+}
+
+cv::Rect RectEnclosedByContour(const std::vector<PackedEdgePixel> &edgelist, int rows, int cols) {
+    return RectEnclosedByContourImpl(edgelist, rows, cols);
+}
 
 float ComputeIoU(cv::Rect r1, cv::Rect r2) {
 //    cv::Rect intersection = r1 & r2;
@@ -237,6 +252,30 @@ cv::Rect InflateRect(const cv::Rect &rect, int rows, int cols, int pad) {
     return out;
 }
 
+std::vector<cv::Rect> UniqueBoxes(const std::vector<cv::Rect> &boxes, int cell_size, std::vector<int> &index) {
+    CHECK_GT(cell_size, 0);
+    std::map<std::array<int, 4>, int> position;
+    std::vector<cv::Rect> out;
+    index.resize(boxes.size());
+    for (int i = 0; i < boxes.size(); ++i) {
+        const cv::Rect &box = boxes[i];
+        // corners rounded to the nearest grid point
+        std::array<int, 4> key{
+            (int)std::floor(box.x / (float)cell_size + 0.5f),
+            (int)std::floor(box.y / (float)cell_size + 0.5f),
+            (int)std::floor((box.x + box.width) / (float)cell_size + 0.5f),
+            (int)std::floor((box.y + box.height) / (float)cell_size + 0.5f)};
+        auto it = position.find(key);
+        if (it == position.end()) {
+            it = position.insert({key, (int)out.size()}).first;
+            out.push_back(cv::Rect(cv::Point(key[0] * cell_size, key[1] * cell_size),
+                                   cv::Point(key[2] * cell_size, key[3] * cell_size)));
+        }
+        index[i] = it->second;
+    }
+    return out;
+}
+
 void ComputeColorHistograms(const cv::Mat &image,
                             const cv::Rect &bbox,
                             cv::Rect &inflated_bbox,
@@ -57,8 +57,13 @@ float WarpAngle(float angle);
 float BBoxArea(const vlslam_pb::BoundingBox &bbox);
 /// \brief: Compute the smallest bounding box which covers the contour/mask.
 cv::Rect RectEnclosedByContour(const std::vector<EdgePixel> &edgelist, int rows, int cols);
+cv::Rect RectEnclosedByContour(const std::vector<PackedEdgePixel> &edgelist, int rows, int cols);
 float ComputeIoU(cv::Rect r1, cv::Rect r2);
 cv::Rect InflateRect(const cv::Rect &rect, int rows=480, int cols=640, int pad=8);
+/// \brief: Snap the corners of boxes to a grid and drop duplicates, in order of first occurrence.
+/// \param cell_size: grid spacing in pixels, 1 drops exact duplicates only.
+/// \param index: index[i] is the position of the snapped boxes[i] in the returned list.
+std::vector<cv::Rect> UniqueBoxes(const std::vector<cv::Rect> &boxes, int cell_size, std::vector<int> &index);
 
 const uint8_t kColorGreen[] = {0, 255, 0};
 const uint8_t kColorRed[] = {0, 0, 255};